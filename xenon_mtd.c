@@ -26,6 +26,7 @@
 #include <linux/types.h>
 
 #include "xenon_mtd.h"
+#include "xenon_nandfs.h"
 
 /*
  * https://www.kernel.org/doc/htmldocs/mtdnand/
@@ -135,7 +136,7 @@ static int __init xenonflash_init_one(ulong addr)
 
 static void __exit xenonflash_remove_one(void)
 {
-
+	xenon_nandfs_remove_one();
 }
 
 
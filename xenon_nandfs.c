@@ -30,6 +30,14 @@
 	#include <stdio.h>
 	#include <stdlib.h>
 	#include <string.h>
+	#include <dirent.h>
+	#include <time.h>
+	#include <sys/stat.h>
+	#include <pthread.h>
+	#include <sys/resource.h>
+	#include <unistd.h>
+	#include <fcntl.h>
+	#include <sys/mman.h>
 	#define vmalloc malloc
 	#define vfree free
 	#define printk printf 
@@ -39,6 +47,9 @@
 
 	#include <linux/vmalloc.h>
 
+	#define STAT_PHASE(p)
+	#define STAT_ECC_PAGE()
+
 #endif
 
 static xenon_nand nand = {0};
@@ -49,6 +60,112 @@ static DUMPDATA dumpdata;
 	unsigned char fixed_type = -1;
 	FILE * pFile;
 	
+	#define PHASE_NONE		0
+	#define PHASE_INIT		1
+	#define PHASE_PARSELBA	2
+	#define PHASE_SPLITROOT	3
+	#define PHASE_EXTRACT	4
+	#define PHASE_COMMAND	5
+	#define PHASE_COUNT		6
+
+	typedef struct _TOOL_STATS{
+		unsigned long long BytesRead;
+		unsigned long long ReadCalls;
+		unsigned long long BytesWritten;
+		unsigned long long PagesChecked;
+		double Wall;
+		double Cpu;
+	} TOOL_STATS;
+
+	static const char* phase_names[PHASE_COUNT] = {"none", "init", "parselba", "splitroot", "extract", "command"};
+	static TOOL_STATS stats_total, stats_phase[PHASE_COUNT], stats_mark;
+	static int stats_cur = PHASE_NONE;
+	static bool stats_on = false;
+
+	#define STAT_PHASE(p) statPhase(p)
+	#define STAT_ECC_PAGE() (stats_total.PagesChecked++)
+
+	static void statClock(TOOL_STATS* st)
+	{
+		struct timespec ts;
+		struct rusage ru;
+
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		getrusage(RUSAGE_SELF, &ru);
+		st->Wall = ts.tv_sec + (ts.tv_nsec / 1e9);
+		st->Cpu = ru.ru_utime.tv_sec + ru.ru_stime.tv_sec + ((ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) / 1e6);
+	}
+
+	// closes the running phase, charging it everything counted since it began, and opens p
+	static void statPhase(int p)
+	{
+		TOOL_STATS now = stats_total;
+		TOOL_STATS* ph = &stats_phase[stats_cur];
+
+		statClock(&now);
+		if(stats_cur != PHASE_NONE)
+		{
+			ph->BytesRead += now.BytesRead - stats_mark.BytesRead;
+			ph->ReadCalls += now.ReadCalls - stats_mark.ReadCalls;
+			ph->BytesWritten += now.BytesWritten - stats_mark.BytesWritten;
+			ph->PagesChecked += now.PagesChecked - stats_mark.PagesChecked;
+			ph->Wall += now.Wall - stats_mark.Wall;
+			ph->Cpu += now.Cpu - stats_mark.Cpu;
+		}
+		stats_mark = now;
+		stats_cur = p;
+	}
+
+	static void statReport(void)
+	{
+		struct rusage ru;
+		int i;
+		bool first = true;
+
+		statPhase(PHASE_NONE);
+		getrusage(RUSAGE_SELF, &ru);
+
+		fprintf(stderr, "\n%-10s %10s %10s %14s %10s %14s %10s\n", "phase", "wall s", "cpu s", "read B", "reads", "written B", "edc pages");
+		for(i=PHASE_INIT; i<PHASE_COUNT; i++)
+		{
+			if((stats_phase[i].ReadCalls == 0) && (stats_phase[i].Wall == 0))
+				continue;
+			fprintf(stderr, "%-10s %10.3f %10.3f %14llu %10llu %14llu %10llu\n", phase_names[i], stats_phase[i].Wall, stats_phase[i].Cpu,
+				stats_phase[i].BytesRead, stats_phase[i].ReadCalls, stats_phase[i].BytesWritten, stats_phase[i].PagesChecked);
+		}
+		fprintf(stderr, "peak rss: %ld KB\n", ru.ru_maxrss);
+
+		// one line of JSON for dashboards
+		fprintf(stderr, "STATS {\"peak_rss_kb\":%ld,\"phases\":{", ru.ru_maxrss);
+		for(i=PHASE_INIT; i<PHASE_COUNT; i++)
+		{
+			if((stats_phase[i].ReadCalls == 0) && (stats_phase[i].Wall == 0))
+				continue;
+			fprintf(stderr, "%s\"%s\":{\"wall\":%.6f,\"cpu\":%.6f,\"bytes_read\":%llu,\"read_calls\":%llu,\"bytes_written\":%llu,\"edc_pages\":%llu}",
+				first ? "" : ",", phase_names[i], stats_phase[i].Wall, stats_phase[i].Cpu, stats_phase[i].BytesRead,
+				stats_phase[i].ReadCalls, stats_phase[i].BytesWritten, stats_phase[i].PagesChecked);
+			first = false;
+		}
+		fprintf(stderr, "}}\n");
+	}
+
+	static size_t statRead(void* buf, size_t size, size_t n, FILE* f)
+	{
+		size_t ret = fread(buf, size, n, f);
+
+		stats_total.ReadCalls++;
+		stats_total.BytesRead += ret * size;
+		return ret;
+	}
+
+	static size_t statWrite(const void* buf, size_t size, size_t n, FILE* f)
+	{
+		size_t ret = fwrite(buf, size, n, f);
+
+		stats_total.BytesWritten += ret * size;
+		return ret;
+	}
+
 	static inline unsigned short __builtin_bswap16(unsigned short a)
 	{
 	  return (a<<8)|(a>>8);
@@ -61,12 +178,13 @@ static DUMPDATA dumpdata;
 		unsigned int addr = block * nand.BlockSzPhys;
 		//printf("Reading block %04x from addr %08x\n", block, addr);
 		fseek(pFile, addr, SEEK_SET);
-		fread(buf ,nand.BlockSzPhys, 1, pFile);
+		statRead(buf ,nand.BlockSzPhys, 1, pFile);
 		for(i=0;i<nand.PagesInBlock; i++){
 			memcpy(&user[i*nand.PageSz], &buf[i*nand.PageSzPhys], nand.PageSz);
 			memcpy(&spare[i*nand.MetaSz], &buf[(i*nand.PageSzPhys)+nand.PageSz], nand.MetaSz);
 		}
 		vfree(buf);
+		return 0;
 	}
 	
 	int xenon_sfc_ReadSmallBlockSeparate(unsigned char* user, unsigned char* spare, unsigned int block)
@@ -76,12 +194,13 @@ static DUMPDATA dumpdata;
 		unsigned int addr = block * 0x4200;
 		//printf("Reading block %04x from addr %08x\n", block, addr);
 		fseek(pFile, addr, SEEK_SET);
-		fread(buf ,0x4200, 1, pFile);
+		statRead(buf ,0x4200, 1, pFile);
 		for(i=0;i<32; i++){
 			memcpy(&user[i*0x200], &buf[i*0x210], 0x200);
 			memcpy(&spare[i*0x10], &buf[(i*0x210)+0x200], 0x10);
 		}
 		vfree(buf);
+		return 0;
 	}
 
 	int xenon_sfc_ReadBlockUser(unsigned char* buf, unsigned int block)
@@ -122,7 +241,63 @@ static DUMPDATA dumpdata;
 	void xenon_sfc_ReadMapData(unsigned char* buf, unsigned int startaddr, unsigned int total_len)
 	{
 		fseek(pFile, startaddr, SEEK_SET);
-		fread(buf, total_len, 1, pFile);
+		statRead(buf, total_len, 1, pFile);
+	}
+
+	int xenon_sfc_ReadPagePhy(unsigned char* buf, unsigned int page)
+	{
+		xenon_sfc_ReadMapData(buf, page * nand.PageSzPhys, nand.PageSzPhys);
+		return 0;
+	}
+
+	unsigned char* mapView = NULL;
+	size_t mapLen = 0;
+
+	// the dump stands in for the flash window, mapped on first use and again once it has grown
+	unsigned char* xenon_sfc_MapData(unsigned int startaddr, unsigned int total_len)
+	{
+		if((startaddr + total_len) > mapLen)
+		{
+			if(mapView)
+				munmap(mapView, mapLen);
+			mapView = NULL;
+			fflush(pFile);
+			fseek(pFile, 0, SEEK_END);
+			mapLen = ftell(pFile);
+			if((startaddr + total_len) <= mapLen)
+				mapView = (unsigned char*)mmap(NULL, mapLen, PROT_READ, MAP_SHARED, fileno(pFile), 0);
+			if((mapView == NULL) || (mapView == MAP_FAILED))
+			{
+				mapView = NULL;
+				mapLen = 0;
+				return NULL;
+			}
+		}
+		return &mapView[startaddr];
+	}
+
+	// writes land in the dump itself, MMC blocks are BlockSz like everywhere else in the tool
+	int xenon_sfc_WriteBlocks(unsigned char* buf, unsigned int block, unsigned int block_cnt)
+	{
+		unsigned int sz = nand.MMC ? nand.BlockSz : nand.BlockSzPhys;
+
+		fseek(pFile, block*sz, SEEK_SET);
+		if(statWrite(buf, sz, block_cnt, pFile) != block_cnt)
+			return 1;
+		fflush(pFile);
+		return 0;
+	}
+
+	// config writes through the SFC only happen in the driver, a cached config stays current
+	unsigned int xenon_sfc_GetConfigGen(void)
+	{
+		return 0;
+	}
+
+	int xenon_sfc_ReadBlock(unsigned char* buf, unsigned int block)
+	{
+		xenon_sfc_ReadMapData(buf, (block * nand.BlockSzPhys), nand.BlockSzPhys);
+		return 0;
 	}
 	
 	bool xenon_sfc_GetNandStruct(xenon_nand* xe_nand)
@@ -161,10 +336,17 @@ static DUMPDATA dumpdata;
 					xe_nand->MetaType = META_TYPE_BG;
 					xe_nand->isBBCont = true;
 					xe_nand->isBB = true;
-					xe_nand->SizeDump = 0x4200000;
+					// 64MB system area dump unless the file holds a full 256/512MB image
+					fseek(pFile, 0, SEEK_END);
+					if(ftell(pFile) >= 0x21000000)
+						xe_nand->SizeData = 0x20000000;
+					else if(ftell(pFile) >= 0x10800000)
+						xe_nand->SizeData = 0x10000000;
+					else
+						xe_nand->SizeData = BB_SYSTEM_AREA;
+					xe_nand->SizeSpare = xe_nand->SizeData >> 5;
+					xe_nand->SizeDump = xe_nand->SizeData + xe_nand->SizeSpare;
 					xe_nand->BlockSzPhys = 0x21000;
-					xe_nand->SizeData = 0x4000000;
-					xe_nand->SizeSpare = 0x200000;
 					xe_nand->PagesInBlock = 256;
 					xe_nand->BlockSz = 0x20000;
 					xe_nand->SizeUsableFs = 0x1E0;
@@ -211,53 +393,13 @@ static DUMPDATA dumpdata;
 		return xe_nand->init;
 	}
 	
-	int main(int argc, char *argv[])
-	{
-		if(argc != 3)
-		{
-			printf("Usage: %s nandtype dump_filename.bin\n", argv[0]);
-			printf("Valid nandtypes:\n\n");
-			printf("sm - Small Block (Xenon, Zephyr, Falcon, some Jasper 16MB)\n");
-			printf("bos - Big on Small Block (some Jasper 16MB)\n");
-			printf("bg - Big Block (Jasper 256/512MB\n");
-			printf("mmc - eMMC NAND (Corona)\n");
-			return 1;
-		}
-		
-		if(!strcmp(argv[1],"sm"))
-			fixed_type = META_TYPE_SM;
-		else if(!strcmp(argv[1],"bos"))
-			fixed_type = META_TYPE_BOS;
-		else if(!strcmp(argv[1],"bg"))
-			fixed_type = META_TYPE_BG;
-		else if(!strcmp(argv[1],"mmc"))
-			fixed_type = META_TYPE_NONE;
-		else
-		{
-			printf("Unsupported meta-type: %s\n", argv[1]);
-			return 2;
-		}
-		
-		pFile = fopen(argv[2],"rb");
-		if (pFile==NULL)
-		{
-			printf("Failed opening \'%s\'!!!\n", argv[2]);
-			return 4;
-		}
-		
-		xenon_nandfs_init_one();
-		fclose (pFile);
-		
-		return 0;
-	}
-
 int writeToFile(char* filename, unsigned char *buf, unsigned int size)
 {
 	FILE* outfile;
 	outfile = fopen(filename, "wb");
 	if(outfile != NULL)
 	{
-		fwrite(buf, size, 1, outfile);
+		statWrite(buf, size, 1, outfile);
 		fclose(outfile);
 		return 0;
 	}
@@ -277,368 +419,4454 @@ int fileExists(char* filename)
 	return ret;
 }
 
-void appendBlockToFile(char* filename, unsigned int block, unsigned int len)
+// names from the dump become paths below an output directory, they may not leave it
+int safeName(const char* name)
 {
-	FILE* outfile;
-	unsigned int fsStartBlock = dumpdata.FSStartBlock<<3;
-	unsigned int offsetUser = block*nand.BlockSz;
-	unsigned char *userbuf = (unsigned char *)vmalloc(nand.BlockSz);
-	unsigned char* sparebuf = (unsigned char *)vmalloc(nand.MetaSz*nand.PagesInBlock);
+	return name[0] && strcmp(name, ".") && strcmp(name, "..") && !strchr(name, '/');
+}
 
+void appendBlockToFile(char* filename, unsigned int cluster, unsigned int len)
+{
+	FILE* outfile;
+	unsigned char *userbuf = (unsigned char *)vmalloc(FS_CLUSTER_SIZE);
 
-	if(nand.MMC)
-		xenon_sfc_ReadMapData(userbuf, offsetUser, nand.BlockSz); 
-	else
-		xenon_sfc_ReadSmallBlockSeparate(userbuf, sparebuf, fsStartBlock + block);
+	xenon_nandfs_ReadCluster(userbuf, cluster);
 	
 	if(fileExists(filename))
 		outfile = fopen(filename, "ab+");
 	else
 		outfile = fopen(filename, "wb");
-	fwrite(userbuf, len, 1, outfile);
+	statWrite(userbuf, len, 1, outfile);
 	fclose(outfile);
 	
 	vfree(userbuf);
-	vfree(sparebuf);
 }
-#endif
-
-void xenon_nandfs_CalcECC(unsigned int *data, unsigned char* edc) {
-	unsigned int i=0, val=0;
-	unsigned int v=0;
-
-	for (i = 0; i < 0x1066; i++)
-	{
-		if (!(i & 31))
-			v = ~__builtin_bswap32(*data++);
-		val ^= v & 1;
-		v>>=1;
-		if (val & 1)
-			val ^= 0x6954559;
-		val >>= 1;
-	}
 
-	val = ~val;
+int hashTreeSave(char* filename, HASHTREE* tree)
+{
+	FILE* outfile;
+	unsigned int hdr[3] = {HASHTREE_MAGIC, tree->LeafCount, tree->BlockSz};
 
-	// 26 bit ecc data
-	edc[0] = ((val << 6) | (data[0x20C] & 0x3F)) & 0xFF;
-	edc[1] = (val >> 2) & 0xFF;
-	edc[2] = (val >> 10) & 0xFF;
-	edc[3] = (val >> 18) & 0xFF;
+	outfile = fopen(filename, "wb");
+	if(outfile == NULL)
+		return 1;
+	statWrite(hdr, sizeof(hdr), 1, outfile);
+	statWrite(tree->Node, SHA_DIGEST_LEN, tree->LeafBase*2, outfile);
+	fclose(outfile);
+	return 0;
 }
 
-unsigned short xenon_nandfs_GetLBA(METADATA* meta)
+int hashTreeLoad(char* filename, HASHTREE* tree)
 {
-	unsigned short ret = 0;
-	
-	switch (nand.MetaType)
-	{
-		case META_TYPE_SM:
-			ret =  (((meta->sm.BlockID0&0xF)<<8)+(meta->sm.BlockID1));
-			break;
-		case META_TYPE_BOS:
-			ret =  (((meta->bos.BlockID0&0xF)<<8)+(meta->bos.BlockID1&0xFF));
-			break;
-		case META_TYPE_BG:
-			ret =  (((meta->bg.BlockID0&0xF)<<8)+(meta->bg.BlockID1&0xFF));
-			break;
-	}
-	return ret;
-}
+	FILE* infile;
+	unsigned int hdr[3];
+	int ret = 1;
 
-unsigned char xenon_nandfs_GetBlockType(METADATA* meta)
-{
-	unsigned char ret = 0;
-	
-	switch (nand.MetaType)
+	infile = fopen(filename, "rb");
+	if(infile == NULL)
+		return 1;
+	// the header is untrusted, only a tree over the geometry of the opened dump is accepted
+	if((statRead(hdr, sizeof(hdr), 1, infile) == 1) && (hdr[0] == HASHTREE_MAGIC) &&
+		(hdr[1] == (nand.SizeDump / nand.BlockSzPhys)) && (hdr[2] == nand.BlockSzPhys) &&
+		xenon_nandfs_HashTreeInit(tree, hdr[1], hdr[2]))
 	{
-		case META_TYPE_SM:
-			ret =  (meta->sm.FsBlockType&0x3F);
-			break;
-		case META_TYPE_BOS:
-			ret =  (meta->bos.FsBlockType&0x3F);
-			break;
-		case META_TYPE_BG:
-			ret =  (meta->bg.FsBlockType&0x3F);
-			break;
+		if(statRead(tree->Node, SHA_DIGEST_LEN, tree->LeafBase*2, infile) == tree->LeafBase*2)
+			ret = 0;
+		else
+			xenon_nandfs_HashTreeFree(tree);
 	}
+	fclose(infile);
 	return ret;
 }
 
-unsigned char xenon_nandfs_GetBadBlockMark(METADATA* meta)
+void printDigest(char* prefix, unsigned char* digest)
 {
-	unsigned char ret = 0;
-	
-	switch (nand.MetaType)
-	{
-		case META_TYPE_SM:
-			ret =  meta->sm.BadBlock;
-			break;
-		case META_TYPE_BOS:
-			ret =  meta->bos.BadBlock;
-			break;
-		case META_TYPE_BG:
-			ret =  meta->bg.BadBlock;
-			break;
-	}
-	return ret;
-}
+	int i;
 
-unsigned int xenon_nandfs_GetFsSize(METADATA* meta)
-{
-	unsigned int ret = 0;
-	
-	switch (nand.MetaType)
-	{
-		case META_TYPE_SM:
-			ret = ((meta->sm.FsSize0<<8)+meta->sm.FsSize1);
-			break;
-		case META_TYPE_BOS:
-			ret = (((meta->bos.FsSize0<<8)&0xFF)+(meta->bos.FsSize1&0xFF));
-			break;
-		case META_TYPE_BG:
-			ret = (((meta->bg.FsSize0&0xFF)<<8)+(meta->bg.FsSize1&0xFF));
-			break;
-	}
-	return ret;
+	printf("%s", prefix);
+	for(i=0; i<SHA_DIGEST_LEN; i++)
+		printf("%02x", digest[i]);
+	printf("\n");
 }
 
-unsigned int xenon_nandfs_GetFsFreepages(METADATA* meta)
+bool openFs(void)
 {
-	unsigned int ret = 0;
-	
-	switch (nand.MetaType)
+	bool ret = false;
+
+	STAT_PHASE(PHASE_INIT);
+	if(xenon_nandfs_init())
 	{
-		case META_TYPE_SM:
-			ret =  meta->sm.FsPageCount;
-			break;
-		case META_TYPE_BOS:
-			ret =  meta->bos.FsPageCount;
-			break;
-		case META_TYPE_BG:
-			ret =  (meta->bg.FsPageCount * 4);
-			break;
+		STAT_PHASE(PHASE_PARSELBA);
+		xenon_nandfs_ParseLBA();
+		STAT_PHASE(PHASE_SPLITROOT);
+		xenon_nandfs_SplitFsRootBuf();
+		ret = true;
 	}
+	else
+		printk(KERN_INFO "FSRoot wasn't found\n");
+	STAT_PHASE(PHASE_COMMAND);
 	return ret;
 }
 
-unsigned int xenon_nandfs_GetFsSequence(METADATA* meta)
+int cmdFsck(void)
 {
-	unsigned int ret = 0;
-	
-	switch (nand.MetaType)
+	FSCK_RESULT res;
+	unsigned int i;
+	int problems;
+
+	if(!openFs())
+		return 7;
+
+	problems = xenon_nandfs_CheckFs(&res);
+	if(problems < 0)
+		return 6;
+
+	for(i=0; i<MAX_FSENT; i++)
 	{
-		case META_TYPE_SM:
-			ret =  (meta->sm.FsSequence0+(meta->sm.FsSequence1<<8)+(meta->sm.FsSequence2<<16));
-			break;
-		case META_TYPE_BOS:
-			ret =  (meta->bos.FsSequence0+(meta->bos.FsSequence1<<8)+(meta->bos.FsSequence2<<16));
-			break;
-		case META_TYPE_BG:
-			ret =  (meta->bg.FsSequence0+(meta->bg.FsSequence1<<8)+(meta->bg.FsSequence2<<16));
-			break;
+		if(!res.EntFlags[i])
+			continue;
+		printf("%-22.22s%s%s%s%s\n", dumpdata.FsEnt[i]->FileName,
+			(res.EntFlags[i] & FSCK_CROSSLINKED) ? " cross-linked" : "",
+			(res.EntFlags[i] & FSCK_CYCLIC) ? " cyclic" : "",
+			(res.EntFlags[i] & FSCK_TRUNCATED) ? " truncated" : "",
+			(res.EntFlags[i] & FSCK_BADLENGTH) ? " length mismatch" : "");
 	}
-	return ret;
+	printf("files: %d clusters: 0x%x used: 0x%x free: 0x%x orphaned: 0x%x\n", res.Files, res.Clusters, res.Used, res.Free, res.Orphaned);
+	printf("cross-linked: %d cyclic: %d truncated: %d length mismatch: %d\n", res.CrossLinked, res.Cyclic, res.Truncated, res.BadLength);
+	return problems ? 8 : 0;
 }
 
-bool xenon_nandfs_CheckMMCAnchorSha(unsigned char* buf)
+#define PACK_COPY		-1
+#define PACK_ERASE		-2
+#define PACK_ROOT		-3 // -3 - n for the n-th small block of the root
+#define PACK_ANCHOR		-16
+
+typedef struct _PACK_FILE{
+	char Name[22];
+	char Path[512];
+	unsigned int Size;
+	unsigned int Stamp;
+	unsigned short StartCluster;
+} PACK_FILE;
+
+static int packFileCmp(const void* a, const void* b)
 {
-	//unsigned char* data = buf;
-	//CryptSha(&data[MMC_ANCHOR_HASH_LEN], (0x200-MMC_ANCHOR_HASH_LEN), NULL, 0, NULL, 0, sha, MMC_ANCHOR_HASH_LEN);
-	return 0;
+	return strcmp(((PACK_FILE*)a)->Name, ((PACK_FILE*)b)->Name);
 }
 
-unsigned short xenon_nandfs_GetMMCAnchorVer(unsigned char* buf)
+static unsigned int packTimeStamp(time_t t)
 {
-	unsigned char* data = buf;
-	unsigned short tmp = (data[MMC_ANCHOR_VERSION_POS]<<8|data[MMC_ANCHOR_VERSION_POS+1]);
+	struct tm* tm = localtime(&t);
+	unsigned int stamp;
 
-	return tmp;
+	stamp = (((tm->tm_year - 80) & 0x7F) << 25) | ((tm->tm_mon + 1) << 21) | (tm->tm_mday << 16);
+	stamp |= (tm->tm_hour << 11) | (tm->tm_min << 5) | (tm->tm_sec >> 1);
+	return stamp;
 }
 
-unsigned short xenon_nandfs_GetMMCMobileBlock(unsigned char* buf, unsigned char mobi)
+static int packScanDir(char* dirname, PACK_FILE* files)
 {
-	unsigned char* data = buf;
-	unsigned char mob = mobi - MOBILE_BASE;
-	unsigned char offset = MMC_ANCHOR_MOBI_START+(mob*MMC_ANCHOR_MOBI_SIZE);
-	unsigned short tmp = data[offset]<<8|data[offset+1];
-	
-	return tmp;
-}
+	DIR* dir;
+	struct dirent* de;
+	struct stat st;
+	int cnt = 0;
 
-unsigned short xenon_nandfs_GetMMCMobileSize(unsigned char* buf, unsigned char mobi)
-{
-	unsigned char* data = buf;
-	unsigned char mob = mobi - MOBILE_BASE;
-	unsigned char offset = MMC_ANCHOR_MOBI_START+(mob*MMC_ANCHOR_MOBI_SIZE)+0x2;
-	unsigned short tmp = data[offset]<<8|data[offset+1];
-	
-	return __builtin_bswap16(tmp);
+	dir = opendir(dirname);
+	if(dir == NULL)
+		return -1;
+	while((de = readdir(dir)) != NULL)
+	{
+		if(de->d_name[0] == '.')
+			continue;
+		if(strlen(de->d_name) >= sizeof(files[0].Name))
+		{
+			printf("skipping \'%s\', name too long\n", de->d_name);
+			continue;
+		}
+		if(cnt == MAX_FSENT)
+		{
+			printf("too many files, only %d fit into the FSRoot\n", MAX_FSENT);
+			break;
+		}
+		snprintf(files[cnt].Path, sizeof(files[cnt].Path), "%s/%s", dirname, de->d_name);
+		if((stat(files[cnt].Path, &st) != 0) || !S_ISREG(st.st_mode))
+			continue;
+		memset(files[cnt].Name, 0, sizeof(files[cnt].Name));
+		strcpy(files[cnt].Name, de->d_name);
+		files[cnt].Size = st.st_size;
+		files[cnt].Stamp = packTimeStamp(st.st_mtime);
+		cnt++;
+	}
+	closedir(dir);
+	qsort(files, cnt, sizeof(PACK_FILE), packFileCmp);
+	return cnt;
 }
 
-bool xenon_nandfs_CheckECC(PAGEDATA* pdata)
+int cmdPack(char* dirname, char* outname)
 {
-	unsigned char ecd[4];
-	xenon_nandfs_CalcECC((unsigned int*)pdata->User, ecd);
-	if ((ecd[0] == pdata->Meta.sm.ECC0) &&
-		(ecd[1] == pdata->Meta.sm.ECC1) &&
-		(ecd[2] == pdata->Meta.sm.ECC2) &&
-		(ecd[3] == pdata->Meta.sm.ECC3))
-		return 0;
-	return 1;
-}
+	PACK_FILE* files = (PACK_FILE *)vmalloc(MAX_FSENT * sizeof(PACK_FILE));
+	unsigned short chain[FS_CHAIN_COUNT];
+	unsigned char root[FSROOT_SIZE*2];
+	unsigned char* avail;
+	int* plan;
+	int* unitCluster;
+	unsigned int* claim = NULL;
+	unsigned int unitSz, units, fsBase, clusters, rootUnit = 0, rootUnits, anchorUnit = 0;
+	unsigned int i, j, k, c, u, next, need, seq;
+	unsigned char* tmpl;
+	unsigned char* outbuf;
+	unsigned char* databuf;
+	FILE* outfile;
+	FILE* infile = NULL;
+	int cnt, cur = -1, ret = 0;
+	FS_ENT* ent;
+	FS_ENT ents[MAX_FSENT];
+	FS_ALLOC alloc;
+	unsigned int wear, bestWear = 0;
 
-int xenon_nandfs_ExtractFsEntry(void)
-{
+	if(!openFs())
+		return 7;
+
+	memset(&alloc, 0, sizeof(FS_ALLOC));
+	cnt = packScanDir(dirname, files);
+	if(cnt < 0)
+	{
+		printf("Failed opening \'%s\'!!!\n", dirname);
+		vfree(files);
+		return 4;
+	}
+
+	unitSz = nand.MMC ? nand.BlockSz : SMALL_BLOCK_SZ_PHYS;
+	units = (nand.MMC ? nand.SizeData : nand.SizeDump) / unitSz;
+	fsBase = nand.isBB ? (dumpdata.FSStartBlock<<3) : 0;
+	clusters = xenon_nandfs_GetClusterCount();
+	rootUnits = nand.isBB ? 8 : 1;
+
+	avail = (unsigned char *)vmalloc(clusters);
+	plan = (int *)vmalloc(units * sizeof(int));
+	unitCluster = (int *)vmalloc(units * sizeof(int));
+	tmpl = (unsigned char *)vmalloc(unitSz);
+	outbuf = (unsigned char *)vmalloc(unitSz);
+	databuf = (unsigned char *)vmalloc(SMALL_BLOCK_SZ_PHYS);
+	memset(avail, 0, clusters);
+	for(u=0; u<units; u++)
+	{
+		plan[u] = PACK_COPY;
+		unitCluster[u] = -1;
+	}
+
+	for(c=0; c<clusters; c++)
+	{
+		chain[c] = __builtin_bswap16(dumpdata.pFSRootBufShort[c]);
+		u = xenon_nandfs_GetClusterBlock(c) + fsBase;
+		if(u < units)
+			unitCluster[u] = c;
+	}
+
+	// erased big block slots take the LBA of their own position, like an in place update does
+	if(nand.isBB)
+	{
+		claim = (unsigned int *)vmalloc(clusters * sizeof(unsigned int));
+		xenon_nandfs_FindErasedSlots(claim, clusters);
+		for(c=0; c<clusters; c++)
+		{
+			u = c + fsBase;
+			if((claim[c] == (unsigned int)INVALID) || (u >= units) || (unitCluster[u] >= 0))
+				continue;
+			dumpdata.LBAMap[c] = claim[c];
+			unitCluster[u] = c;
+		}
+	}
+
+	// release everything the old entries own, avail marks visited clusters to survive damaged chains
+	for(i=0; i<MAX_FSENT; i++)
+	{
+		ent = dumpdata.FsEnt[i];
+		if((ent->FileName[0] == 0) || (ent->FileName[0] == FS_ENT_ERASED))
+			continue;
+		for(c = __builtin_bswap16(ent->StartCluster); (c < clusters) && !avail[c]; c = next)
+		{
+			avail[c] = 1;
+			next = chain[c];
+			chain[c] = FS_CHAIN_FREE;
+		}
+	}
+
+	// never hand out the old root, Mobiles, config and anchor blocks
+	for(u = dumpdata.FSRootBlock*rootUnits; u < ((dumpdata.FSRootBlock+1)*rootUnits) && (u < units); u++)
+	{
+		// a root left behind by an earlier pack is released, the new image only needs one
+		if((unitCluster[u] >= 0) && !avail[unitCluster[u]] && (chain[unitCluster[u]] == FS_CHAIN_END))
+		{
+			chain[unitCluster[u]] = FS_CHAIN_FREE;
+			if(!nand.MMC)
+				plan[u] = PACK_ERASE;
+		}
+		unitCluster[u] = -1;
+	}
+
+	// the allocator keeps the free map from here on, clusters outside usable units are reserved
+	if(!xenon_nandfs_AllocInit(&alloc, chain, clusters))
+	{
+		ret = 9;
+		goto out;
+	}
+	xenon_nandfs_AllocLoadWear(&alloc);
+	xenon_nandfs_AllocReserveSystem(&alloc);
+	for(c=0; c<clusters; c++)
+	{
+		u = xenon_nandfs_GetClusterBlock(c) + fsBase;
+		if((u >= units) || (unitCluster[u] != (int)c))
+			xenon_nandfs_AllocReserve(&alloc, c);
+	}
+
+	// the new root goes into the least worn free (Bg)Block, the old one stays intact
+	rootUnit = units;
+	for(u=0; u < units; u += rootUnits)
+	{
+		for(j=0, wear=0; j<rootUnits; j++)
+		{
+			if((u+j >= units) || (unitCluster[u+j] < 0) || !xenon_nandfs_AllocIsFree(&alloc, unitCluster[u+j]))
+				break;
+			wear += alloc.Wear[unitCluster[u+j]];
+		}
+		if((j == rootUnits) && ((rootUnit == units) || (wear < bestWear)))
+		{
+			rootUnit = u;
+			bestWear = wear;
+		}
+	}
+	if(rootUnit >= units)
+	{
+		printf("No free block left for the new FSRoot\n");
+		ret = 9;
+		goto out;
+	}
+	for(j=0; j<rootUnits; j++)
+	{
+		xenon_nandfs_AllocSetChain(&alloc, unitCluster[rootUnit+j], FS_CHAIN_END);
+		plan[rootUnit+j] = PACK_ROOT - j;
+	}
+
+	for(i=0; i<(unsigned int)cnt; i++)
+	{
+		need = (files[i].Size + FS_CLUSTER_SIZE - 1) / FS_CLUSTER_SIZE;
+		c = xenon_nandfs_AllocChain(&alloc, need);
+		if(c == INVALID)
+		{
+			printf("Out of free clusters while packing \'%s\'\n", files[i].Name);
+			ret = 9;
+			goto out;
+		}
+		files[i].StartCluster = c;
+		for(k=0; k<need; k++, c = chain[c])
+			plan[xenon_nandfs_GetClusterBlock(c) + fsBase] = (i<<16)|k;
+	}
+
+	// clusters freed but not reused are erased so stale data can't resurface
+	if(!nand.MMC)
+		for(c=0; c<clusters; c++)
+			if(xenon_nandfs_AllocIsFree(&alloc, c) && (__builtin_bswap16(dumpdata.pFSRootBufShort[c]) != FS_CHAIN_FREE))
+				plan[xenon_nandfs_GetClusterBlock(c) + fsBase] = PACK_ERASE;
+
+	for(c=clusters; c<FS_CHAIN_COUNT; c++)
+		chain[c] = __builtin_bswap16(dumpdata.pFSRootBufShort[c]);
+	memset(ents, 0, sizeof(ents));
+	for(i=0; i<(unsigned int)cnt; i++)
+	{
+		memcpy(ents[i].FileName, files[i].Name, sizeof(ents[i].FileName));
+		ents[i].StartCluster = __builtin_bswap16(files[i].StartCluster);
+		ents[i].ClusterSz = __builtin_bswap32(files[i].Size);
+		ents[i].TypeTime = __builtin_bswap32(files[i].Stamp);
+	}
+	xenon_nandfs_BuildRoot(root, chain, ents);
+	seq = dumpdata.FSRootVer + 1;
+
+	if(nand.MMC)
+	{
+		anchorUnit = nand.ConfigBlock - MMC_ANCHOR_BLOCKS + (dumpdata.AnchorNum ^ 1);
+		plan[anchorUnit] = PACK_ANCHOR;
+	}
+
+	outfile = fopen(outname, "wb");
+	if(outfile == NULL)
+	{
+		printf("Failed opening \'%s\'!!!\n", outname);
+		ret = 4;
+		goto out;
+	}
+
+	// single streaming pass, one block of template in and one block of image out
+	for(u=0; u<units; u++)
+	{
+		xenon_sfc_ReadMapData(tmpl, u*unitSz, unitSz);
+		if(plan[u] == PACK_COPY)
+			memcpy(outbuf, tmpl, unitSz);
+		else if(plan[u] == PACK_ERASE)
+			memset(outbuf, 0xFF, unitSz);
+		else if(plan[u] == PACK_ANCHOR)
+		{
+			// newest anchor is copied into the other slot with the new root and version
+			xenon_sfc_ReadMapData(outbuf, (nand.ConfigBlock - MMC_ANCHOR_BLOCKS + dumpdata.AnchorNum)*unitSz, unitSz);
+			xenon_nandfs_SetMMCAnchorVer(outbuf, seq);
+			xenon_nandfs_SetMMCMobileBlock(outbuf, MOBILE_FSROOT, rootUnit);
+			xenon_nandfs_SetMMCAnchorSha(outbuf);
+		}
+		else if(plan[u] <= PACK_ROOT)
+		{
+			j = PACK_ROOT - plan[u];
+			if(nand.MMC)
+				memcpy(outbuf, root, FSROOT_SIZE*2);
+			else
+			{
+				xenon_sfc_ReadMapData(databuf, ((dumpdata.FSRootBlock*rootUnits)+j)*unitSz, unitSz);
+				xenon_nandfs_BuildRootBlock(outbuf, databuf, j ? NULL : root, seq, u);
+			}
+		}
+		else
+		{
+			i = plan[u]>>16;
+			k = plan[u]&0xFFFF;
+			if(cur != (int)i)
+			{
+				if(infile)
+					fclose(infile);
+				infile = fopen(files[i].Path, "rb");
+				cur = i;
+			}
+			memset(databuf, 0, SMALL_BLOCK_SZ);
+			if(infile)
+			{
+				fseek(infile, k*FS_CLUSTER_SIZE, SEEK_SET);
+				statRead(databuf, 1, FS_CLUSTER_SIZE, infile);
+			}
+			// a claimed slot is still erased, it gets its LBA with the data
+			if(nand.isBB && (xenon_sfc_ClassifyBlock(&tmpl[nand.PageSz], NULL, sizeof(METADATA), sizeof(METADATA), 0) & BLKCLS_ERASED))
+				xenon_nandfs_SetLBA(&((PAGEDATA*)tmpl)->Meta, dumpdata.LBAMap[unitCluster[u]]);
+			if(nand.MMC)
+				memcpy(outbuf, databuf, unitSz);
+			else
+				xenon_nandfs_BuildClusterBlock(outbuf, tmpl, databuf, unitCluster[u]);
+		}
+		statWrite(outbuf, unitSz, 1, outfile);
+	}
+	if(infile)
+		fclose(infile);
+	fclose(outfile);
+
+	printf("Packed %d file(s), FSRoot v %d at block 0x%x\n", cnt, seq, rootUnit/rootUnits);
+
+out:
+	xenon_nandfs_AllocDone(&alloc);
+	vfree(files);
+	vfree(avail);
+	vfree(plan);
+	vfree(unitCluster);
+	if(claim)
+		vfree(claim);
+	vfree(tmpl);
+	vfree(outbuf);
+	vfree(databuf);
+	return ret;
+}
+
+int cmdTranscode(char* type, char* outname)
+{
+	unsigned char dstType;
+	unsigned char* buf = (unsigned char *)vmalloc(SMALL_BLOCK_SZ_PHYS);
+	unsigned int u, i, units, skipped = 0;
+	PAGEDATA* page;
+	METADATA meta;
+	FILE* outfile;
+	bool bad;
+
+	if(!strcmp(type,"sm"))
+		dstType = META_TYPE_SM;
+	else if(!strcmp(type,"bos"))
+		dstType = META_TYPE_BOS;
+	else if(!strcmp(type,"bg"))
+		dstType = META_TYPE_BG;
+	else
+	{
+		printf("Unsupported target meta-type: %s\n", type);
+		vfree(buf);
+		return 2;
+	}
+	if(nand.MMC)
+	{
+		printf("eMMC images have no spare data to transcode\n");
+		vfree(buf);
+		return 2;
+	}
+	// big block moves the FSRoot and Mobiles to big block boundaries and has another size,
+	// re-laying the spare alone doesn't give an image that can be opened
+	if((nand.MetaType == META_TYPE_BG) != (dstType == META_TYPE_BG))
+	{
+		printf("Transcoding between small and big block layouts isn't supported, use gen or pack\n");
+		vfree(buf);
+		return 2;
+	}
+
+	outfile = fopen(outname, "wb");
+	if(outfile == NULL)
+	{
+		printf("Failed opening \'%s\'!!!\n", outname);
+		vfree(buf);
+		return 4;
+	}
+
+	// SM, BOS and BG share the 0x210 page, so one small block in and out is all the memory needed
+	fseek(pFile, 0, SEEK_END);
+	units = ftell(pFile);
+	if(units > nand.SizeDump)
+		units = nand.SizeDump;
+	units /= SMALL_BLOCK_SZ_PHYS;
+	for(u=0; u<units; u++)
+	{
+		xenon_sfc_ReadMapData(buf, u*SMALL_BLOCK_SZ_PHYS, SMALL_BLOCK_SZ_PHYS);
+		for(i=0; i<SMALL_BLOCK_PAGES; i++)
+		{
+			page = (PAGEDATA*)&buf[i*sizeof(PAGEDATA)];
+			if(xenon_sfc_ClassifyBlock((unsigned char*)&page->Meta, NULL, sizeof(METADATA), sizeof(METADATA), 0) & BLKCLS_ERASED)
+				continue;
+			bad = (xenon_nandfs_GetBadBlockMark(&page->Meta) != 0xFF);
+			if(!xenon_nandfs_TranscodeMeta(&page->Meta, nand.MetaType, &meta, dstType, u % 8))
+				skipped++;
+			memcpy(&page->Meta, &meta, sizeof(METADATA));
+			if(!bad)
+				xenon_nandfs_SetECC(page);
+		}
+		statWrite(buf, SMALL_BLOCK_SZ_PHYS, 1, outfile);
+	}
+	fclose(outfile);
+	vfree(buf);
+
+	if(skipped)
+		printf("%d page(s) carry a block type %s can't express\n", skipped, type);
+	printf("Transcoded 0x%x blocks\n", units);
+	return 0;
+}
+
+typedef struct _EXPORT_ENT{
+	FS_ENT Ent;
+	unsigned int ClusterCount;
+	unsigned char Chain[SHA_DIGEST_LEN]; // over the cluster numbers, see exportChain
+	unsigned char (*Digest)[SHA_DIGEST_LEN];
+} EXPORT_ENT;
+
+static void exportFreeManifest(EXPORT_ENT* ents, unsigned int cnt)
+{
+	unsigned int i;
+
+	for(i=0; i<cnt; i++)
+		vfree(ents[i].Digest);
+	vfree(ents);
+}
+
+// returns the number of entries, 0 if there is no usable manifest
+static unsigned int exportLoadManifest(char* filename, EXPORT_ENT** ents)
+{
+	FILE* infile;
+	unsigned int hdr[2], i;
+	EXPORT_ENT* e;
+
+	infile = fopen(filename, "rb");
+	if(infile == NULL)
+		return 0;
+	if((statRead(hdr, sizeof(hdr), 1, infile) != 1) || (hdr[0] != EXPORT_MAGIC) || (hdr[1] > MAX_FSENT))
+	{
+		fclose(infile);
+		return 0;
+	}
+	e = (EXPORT_ENT *)vmalloc(MAX_FSENT * sizeof(EXPORT_ENT));
+	memset(e, 0, MAX_FSENT * sizeof(EXPORT_ENT));
+	for(i=0; i<hdr[1]; i++)
+	{
+		if((statRead(&e[i].Ent, sizeof(FS_ENT), 1, infile) != 1) ||
+			(statRead(&e[i].ClusterCount, sizeof(unsigned int), 1, infile) != 1) ||
+			(statRead(e[i].Chain, SHA_DIGEST_LEN, 1, infile) != 1) ||
+			(e[i].ClusterCount > FS_CHAIN_COUNT))
+			break;
+		e[i].Digest = (unsigned char (*)[SHA_DIGEST_LEN])vmalloc(e[i].ClusterCount * SHA_DIGEST_LEN + 1);
+		if(statRead(e[i].Digest, SHA_DIGEST_LEN, e[i].ClusterCount, infile) != e[i].ClusterCount)
+		{
+			i++;
+			break;
+		}
+	}
+	fclose(infile);
+	if(i != hdr[1])
+	{
+		printf("Manifest \'%s\' is truncated, exporting everything\n", filename);
+		exportFreeManifest(e, i);
+		return 0;
+	}
+	*ents = e;
+	return hdr[1];
+}
+
+// hashes the cluster numbers of a file from the chain table alone, nothing is read from the flash
+static void exportChain(FS_ENT* ent, unsigned char* digest)
+{
+	unsigned int cluster = __builtin_bswap16(ent->StartCluster);
+	unsigned int left = __builtin_bswap32(ent->ClusterSz);
+	unsigned int cnt = 0;
+	unsigned short c;
+	SHA_CTX ctx;
+
+	xenon_nandfs_ShaInit(&ctx);
+	while((left > 0) && (cluster < FS_CHAIN_SPECIAL) && (cnt++ < FS_CHAIN_COUNT))
+	{
+		c = cluster;
+		xenon_nandfs_ShaUpdate(&ctx, (unsigned char*)&c, sizeof(c));
+		left -= (left > FS_CLUSTER_SIZE) ? FS_CLUSTER_SIZE : left;
+		cluster = __builtin_bswap16(dumpdata.pFSRootBufShort[cluster]);
+	}
+	xenon_nandfs_ShaFinal(&ctx, digest);
+}
+
+// walks the chain of a file, hashing every cluster and writing it to outfile if given
+static unsigned int exportWalk(FS_ENT* ent, unsigned char (*digest)[SHA_DIGEST_LEN], unsigned char* buf, FILE* outfile)
+{
+	unsigned int cluster = __builtin_bswap16(ent->StartCluster);
+	unsigned int left = __builtin_bswap32(ent->ClusterSz);
+	unsigned int len, cnt = 0;
+
+	while((left > 0) && (cluster < FS_CHAIN_SPECIAL) && (cnt < FS_CHAIN_COUNT))
+	{
+		len = (left > FS_CLUSTER_SIZE) ? FS_CLUSTER_SIZE : left;
+		xenon_nandfs_ReadCluster(buf, cluster);
+		xenon_nandfs_Sha(buf, len, digest[cnt++]);
+		if(outfile)
+			statWrite(buf, len, 1, outfile);
+		left -= len;
+		cluster = __builtin_bswap16(dumpdata.pFSRootBufShort[cluster]);
+	}
+	return cnt;
+}
+
+int cmdExport(char* dirname)
+{
+	EXPORT_ENT* prev = NULL;
+	EXPORT_ENT* cur;
+	EXPORT_ENT* old;
+	unsigned int prevCnt, curCnt = 0;
+	unsigned int i, j, written = 0, unchanged = 0;
+	unsigned char* buf;
+	FS_ENT* ent;
+	char path[512], name[sizeof(ent->FileName)+1];
+	FILE* outfile;
+
+	if(!openFs())
+		return 5;
+	mkdir(dirname, 0755);
+	snprintf(path, sizeof(path), "%s/.manifest", dirname);
+	prevCnt = exportLoadManifest(path, &prev);
+
+	buf = (unsigned char *)vmalloc(FS_CLUSTER_SIZE);
+	cur = (EXPORT_ENT *)vmalloc(MAX_FSENT * sizeof(EXPORT_ENT));
+	memset(cur, 0, MAX_FSENT * sizeof(EXPORT_ENT));
+
+	for(i=0; i<MAX_FSENT; i++)
+	{
+		ent = dumpdata.FsEnt[i];
+		if((ent->FileName[0] == 0) || (ent->FileName[0] == FS_ENT_ERASED))
+			continue;
+		snprintf(name, sizeof(name), "%.22s", ent->FileName);
+		if(!safeName(name))
+		{
+			printf("skipping '%s', not a plain file name\n", name);
+			continue;
+		}
+
+		old = NULL;
+		for(j=0; j<prevCnt; j++)
+		{
+			if(strncmp(prev[j].Ent.FileName, ent->FileName, sizeof(ent->FileName)) == 0)
+			{
+				old = &prev[j];
+				break;
+			}
+		}
+
+		memcpy(&cur[curCnt].Ent, ent, sizeof(FS_ENT));
+		cur[curCnt].Digest = (unsigned char (*)[SHA_DIGEST_LEN])vmalloc(FS_CHAIN_COUNT * SHA_DIGEST_LEN);
+		snprintf(path, sizeof(path), "%s/%s", dirname, name);
+		exportChain(ent, cur[curCnt].Chain);
+
+		// same entry on the same clusters: clusters are never rewritten in place, so the file is current
+		// without reading anything; same entry elsewhere: hash the clusters and only rewrite on a change
+		if(old && (old->Ent.StartCluster == ent->StartCluster) && (old->Ent.ClusterSz == ent->ClusterSz) &&
+			(old->Ent.TypeTime == ent->TypeTime) && fileExists(path))
+		{
+			if(memcmp(cur[curCnt].Chain, old->Chain, SHA_DIGEST_LEN) == 0)
+			{
+				cur[curCnt].ClusterCount = old->ClusterCount;
+				memcpy(cur[curCnt].Digest, old->Digest, old->ClusterCount * SHA_DIGEST_LEN);
+				unchanged++;
+				curCnt++;
+				continue;
+			}
+			cur[curCnt].ClusterCount = exportWalk(ent, cur[curCnt].Digest, buf, NULL);
+			if((cur[curCnt].ClusterCount == old->ClusterCount) &&
+				(memcmp(cur[curCnt].Digest, old->Digest, old->ClusterCount * SHA_DIGEST_LEN) == 0))
+			{
+				unchanged++;
+				curCnt++;
+				continue;
+			}
+		}
+
+		outfile = fopen(path, "wb");
+		if(outfile == NULL)
+		{
+			printf("Failed opening \'%s\'!!!\n", path);
+			vfree(cur[curCnt].Digest);
+			continue;
+		}
+		cur[curCnt].ClusterCount = exportWalk(ent, cur[curCnt].Digest, buf, outfile);
+		fclose(outfile);
+		printf("%s: %s\n", old ? "changed" : "new", name);
+		written++;
+		curCnt++;
+	}
+
+	for(j=0; j<prevCnt; j++)
+	{
+		for(i=0; i<curCnt; i++)
+			if(strncmp(prev[j].Ent.FileName, cur[i].Ent.FileName, sizeof(cur[i].Ent.FileName)) == 0)
+				break;
+		if(i == curCnt)
+			printf("removed: %.22s\n", prev[j].Ent.FileName);
+	}
+
+	snprintf(path, sizeof(path), "%s/.manifest", dirname);
+	outfile = fopen(path, "wb");
+	if(outfile != NULL)
+	{
+		unsigned int hdr[2] = {EXPORT_MAGIC, curCnt};
+		statWrite(hdr, sizeof(hdr), 1, outfile);
+		for(i=0; i<curCnt; i++)
+		{
+			statWrite(&cur[i].Ent, sizeof(FS_ENT), 1, outfile);
+			statWrite(&cur[i].ClusterCount, sizeof(unsigned int), 1, outfile);
+			statWrite(cur[i].Chain, SHA_DIGEST_LEN, 1, outfile);
+			statWrite(cur[i].Digest, SHA_DIGEST_LEN, cur[i].ClusterCount, outfile);
+		}
+		fclose(outfile);
+	}
+	else
+		printf("Failed writing \'%s\'!!!\n", path);
+
+	printf("%d file(s) written, %d unchanged\n", written, unchanged);
+	exportFreeManifest(cur, curCnt);
+	if(prevCnt)
+		exportFreeManifest(prev, prevCnt);
+	vfree(buf);
+	return 0;
+}
+
+int cmdCompare(char* othername)
+{
+	FILE* other;
+	unsigned char* buf = (unsigned char *)vmalloc(nand.BlockSzPhys);
+	unsigned char* ref = (unsigned char *)vmalloc(nand.BlockSzPhys);
+	unsigned int block, cls, blocks;
+	unsigned int erased = 0, same = 0, user = 0, spare = 0, both = 0;
+	int ret = 0;
+
+	other = fopen(othername, "rb");
+	if(other == NULL)
+	{
+		printf("Failed opening \'%s\'!!!\n", othername);
+		vfree(buf);
+		vfree(ref);
+		return 4;
+	}
+
+	blocks = nand.SizeDump / nand.BlockSzPhys;
+	for(block=0; block<blocks; block++)
+	{
+		xenon_sfc_ReadMapData(buf, block*nand.BlockSzPhys, nand.BlockSzPhys);
+		fseek(other, block*nand.BlockSzPhys, SEEK_SET);
+		if(statRead(ref, nand.BlockSzPhys, 1, other) != 1)
+			break;
+		cls = xenon_sfc_ClassifyBlock(buf, ref, nand.BlockSzPhys, nand.PageSz, nand.MetaSz);
+		if(cls & BLKCLS_ERASED)
+			erased++;
+		switch(cls & BLKCLS_CHANGED)
+		{
+			case 0:
+				same++;
+				continue;
+			case BLKCLS_USER_CHANGED:
+				user++;
+				break;
+			case BLKCLS_SPARE_CHANGED:
+				spare++;
+				break;
+			default:
+				both++;
+				break;
+		}
+		printf("block 0x%x: %s%s%s\n", block, (cls & BLKCLS_USER_CHANGED) ? "user " : "",
+			(cls & BLKCLS_SPARE_CHANGED) ? "spare " : "", (cls & BLKCLS_ERASED) ? "(erased)" : "");
+	}
+	fclose(other);
+	vfree(buf);
+	vfree(ref);
+
+	printf("0x%x blocks: %d identical, %d erased, %d user only, %d spare only, %d both\n", block, same, erased, user, spare, both);
+	if(user || spare || both)
+		ret = 8;
+	return ret;
+}
+
+#define STREAM_FREE		0
+#define STREAM_READ		1
+#define STREAM_DONE		2
+
+#define STREAM_DEFAULT_CEILING	(8*1024*1024)
+
+// ring of block buffers shared by the reader, transform and writer threads
+typedef struct _STREAM{
+	unsigned int SlotCount;
+	unsigned int Blocks;
+	unsigned char** Buf;
+	unsigned int* Len;
+	int* State;
+	pthread_mutex_t Lock;
+	pthread_cond_t Cond;
+	FILE* Out;
+	bool Raw;
+	SHA_CTX Sha;
+	unsigned int PagesChecked;
+	unsigned int EccErrors;
+} STREAM;
+
+static void streamWait(STREAM* st, unsigned int slot, int state)
+{
+	pthread_mutex_lock(&st->Lock);
+	while(st->State[slot] != state)
+		pthread_cond_wait(&st->Cond, &st->Lock);
+	pthread_mutex_unlock(&st->Lock);
+}
+
+static void streamPost(STREAM* st, unsigned int slot, int state)
+{
+	pthread_mutex_lock(&st->Lock);
+	st->State[slot] = state;
+	pthread_cond_broadcast(&st->Cond);
+	pthread_mutex_unlock(&st->Lock);
+}
+
+static void* streamReader(void* arg)
+{
+	STREAM* st = (STREAM*)arg;
+	unsigned int b, slot;
+
+	for(b=0; b<st->Blocks; b++)
+	{
+		slot = b % st->SlotCount;
+		streamWait(st, slot, STREAM_FREE);
+		xenon_sfc_ReadMapData(st->Buf[slot], b*nand.BlockSzPhys, nand.BlockSzPhys);
+		st->Len[slot] = nand.BlockSzPhys;
+		streamPost(st, slot, STREAM_READ);
+	}
+	return NULL;
+}
+
+// checks the EDC of every written page, strips the spare unless raw and hashes what goes out
+static void* streamTransform(void* arg)
+{
+	STREAM* st = (STREAM*)arg;
+	unsigned int b, i, slot;
+	unsigned char* buf;
+	PAGEDATA* page;
+
+	for(b=0; b<st->Blocks; b++)
+	{
+		slot = b % st->SlotCount;
+		streamWait(st, slot, STREAM_READ);
+		buf = st->Buf[slot];
+		if(!nand.MMC)
+		{
+			for(i=0; i<(nand.BlockSzPhys/sizeof(PAGEDATA)); i++)
+			{
+				page = (PAGEDATA*)&buf[i*sizeof(PAGEDATA)];
+				if(xenon_sfc_ClassifyBlock((unsigned char*)&page->Meta, NULL, sizeof(METADATA), sizeof(METADATA), 0) & BLKCLS_ERASED)
+					continue;
+				st->PagesChecked++;
+				if(xenon_nandfs_CheckECC(page)) // non-zero on mismatch
+					st->EccErrors++;
+			}
+			if(!st->Raw)
+			{
+				// moves towards the front only, so it can be done in place
+				for(i=0; i<(nand.BlockSzPhys/sizeof(PAGEDATA)); i++)
+					memmove(&buf[i*sizeof(page->User)], &buf[i*sizeof(PAGEDATA)], sizeof(page->User));
+				st->Len[slot] = nand.BlockSz;
+			}
+		}
+		xenon_nandfs_ShaUpdate(&st->Sha, buf, st->Len[slot]);
+		streamPost(st, slot, STREAM_DONE);
+	}
+	return NULL;
+}
+
+static void* streamWriter(void* arg)
+{
+	STREAM* st = (STREAM*)arg;
+	unsigned int b, slot;
+
+	for(b=0; b<st->Blocks; b++)
+	{
+		slot = b % st->SlotCount;
+		streamWait(st, slot, STREAM_DONE);
+		statWrite(st->Buf[slot], st->Len[slot], 1, st->Out);
+		streamPost(st, slot, STREAM_FREE);
+	}
+	return NULL;
+}
+
+int cmdStream(char* outname, char* mode, char* ceiling)
+{
+	STREAM st;
+	pthread_t reader, transform, writer;
+	unsigned int i, limit = STREAM_DEFAULT_CEILING;
+	unsigned char digest[SHA_DIGEST_LEN];
+	unsigned int size;
+
+	memset(&st, 0, sizeof(STREAM));
+	if(mode)
+		st.Raw = !strcmp(mode, "raw");
+	if(ceiling)
+		limit = strtoul(ceiling, NULL, 0) * 1024;
+
+	// the ring is the only thing that scales, so the ceiling is the ring size
+	st.SlotCount = limit / nand.BlockSzPhys;
+	if(st.SlotCount == 0)
+		st.SlotCount = 1;
+	fseek(pFile, 0, SEEK_END);
+	size = ftell(pFile);
+	if(size > nand.SizeDump)
+		size = nand.SizeDump;
+	st.Blocks = size / nand.BlockSzPhys;
+
+	st.Out = fopen(outname, "wb");
+	if(st.Out == NULL)
+	{
+		printf("Failed opening \'%s\'!!!\n", outname);
+		return 4;
+	}
+	st.Buf = (unsigned char **)vmalloc(st.SlotCount * sizeof(unsigned char*));
+	st.Len = (unsigned int *)vmalloc(st.SlotCount * sizeof(unsigned int));
+	st.State = (int *)vmalloc(st.SlotCount * sizeof(int));
+	for(i=0; i<st.SlotCount; i++)
+	{
+		st.Buf[i] = (unsigned char *)vmalloc(nand.BlockSzPhys);
+		st.State[i] = STREAM_FREE;
+	}
+	pthread_mutex_init(&st.Lock, NULL);
+	pthread_cond_init(&st.Cond, NULL);
+	xenon_nandfs_ShaInit(&st.Sha);
+
+	pthread_create(&reader, NULL, streamReader, &st);
+	pthread_create(&transform, NULL, streamTransform, &st);
+	pthread_create(&writer, NULL, streamWriter, &st);
+	pthread_join(reader, NULL);
+	pthread_join(transform, NULL);
+	pthread_join(writer, NULL);
+
+	fclose(st.Out);
+	xenon_nandfs_ShaFinal(&st.Sha, digest);
+	printf("0x%x blocks through %d buffer(s) of 0x%x bytes\n", st.Blocks, st.SlotCount, nand.BlockSzPhys);
+	if(!nand.MMC)
+		printf("%d page(s) checked, %d EDC error(s)\n", st.PagesChecked, st.EccErrors);
+	printDigest("sha1: ", digest);
+
+	pthread_cond_destroy(&st.Cond);
+	pthread_mutex_destroy(&st.Lock);
+	for(i=0; i<st.SlotCount; i++)
+		vfree(st.Buf[i]);
+	vfree(st.Buf);
+	vfree(st.Len);
+	vfree(st.State);
+	return st.EccErrors ? 8 : 0;
+}
+
+#define GEN_ERASED		-1
+#define GEN_SYSTEM		-2
+#define GEN_BAD			-3
+#define GEN_ROOT		-4
+#define GEN_STALE_ROOT	-5
+#define GEN_ANCHOR		-6
+#define GEN_STALE_ANCHOR	-7
+#define GEN_TAIL		-8 // rest of a BgBlock whose first unit holds a Mobile, left erased
+#define GEN_MOBILE		-0x100 // -0x100 - (mobi<<4) - stale, page pattern in genMobilePages
+
+#define GEN_BOOT_UNITS	0x40
+#define GEN_MOBILES		4
+#define GEN_STAMP		0x44A16000 // 2014-05-01 12:00
+
+static unsigned int gen_seed;
+
+static unsigned int genRand(void)
+{
+	gen_seed ^= gen_seed << 13;
+	gen_seed ^= gen_seed >> 17;
+	gen_seed ^= gen_seed << 5;
+	return gen_seed;
+}
+
+// file and mobile contents are derived from their position, so bench can regenerate them
+static void genFill(unsigned char* buf, unsigned int len, unsigned int tag)
+{
+	unsigned int i, x = tag * 2654435761u + 1;
+
+	for(i=0; i<len; i++)
+	{
+		x = x * 1103515245 + 12345;
+		buf[i] = x >> 16;
+	}
+}
+
+// returns a random free unit, big block aligned on BG so Mobiles and roots own their block;
+// -1 once nothing free is found
+static int genAlloc(int* plan, unsigned int first, unsigned int last)
+{
+	unsigned int step = nand.isBB ? 8 : 1;
+	unsigned int tries, u, j;
+
+	for(tries=0; tries<0x10000; tries++)
+	{
+		u = first + (genRand() % (last - first));
+		u -= u % step;
+		if(u < first)
+			continue;
+		for(j=0; j<step; j++)
+			if(plan[u+j] != GEN_ERASED)
+				break;
+		if(j == step)
+			return u;
+	}
+	return -1;
+}
+
+static void genMeta(PAGEDATA* page, META_FIELDS* f, unsigned int unit)
+{
+	METADATA sm;
+
+	xenon_nandfs_PackMeta(f, META_TYPE_SM, &sm);
+	if(nand.MetaType == META_TYPE_SM)
+		memcpy(&page->Meta, &sm, sizeof(METADATA));
+	else
+		xenon_nandfs_TranscodeMeta(&sm, META_TYPE_SM, &page->Meta, nand.MetaType, unit % 8);
+	xenon_nandfs_SetECC(page);
+}
+
+static void genUnit(unsigned char* out, unsigned char* data, int plan, unsigned int unit, unsigned int seq, unsigned int mobiSize)
+{
+	META_FIELDS f;
+	unsigned int i, pages, inst, stale;
+	PAGEDATA* page;
+
+	memset(&f, 0, sizeof(META_FIELDS));
+	f.LBA = unit;
+	f.BadBlock = 0xFF;
+	f.Sequence = seq;
+	if(plan == GEN_ROOT || plan == GEN_STALE_ROOT)
+		f.BlockType = MOBILE_FSROOT;
+
+	if(plan == GEN_BAD)
+	{
+		memset(out, 0xFF, SMALL_BLOCK_SZ_PHYS);
+		for(i=0; i<SMALL_BLOCK_PAGES; i++)
+		{
+			page = (PAGEDATA*)&out[i*sizeof(PAGEDATA)];
+			xenon_nandfs_SetBadBlockMark(&page->Meta, 0x00);
+		}
+		return;
+	}
+
+	if(plan <= GEN_MOBILE)
+	{
+		// stale instances first, the newest one last
+		f.BlockType = (-(plan - GEN_MOBILE)) >> 4;
+		stale = (-(plan - GEN_MOBILE)) & 0xF;
+		pages = (mobiSize + sizeof(page->User) - 1) / sizeof(page->User);
+		f.FsPageCount = SMALL_BLOCK_PAGES - pages;
+		f.FsSize0 = (mobiSize >> 8) & 0xFF;
+		f.FsSize1 = mobiSize & 0xFF;
+		if((stale + 1) * pages > SMALL_BLOCK_PAGES)
+			stale = (SMALL_BLOCK_PAGES / pages) - 1;
+		memset(out, 0xFF, SMALL_BLOCK_SZ_PHYS);
+		for(inst=0; inst<=stale; inst++)
+		{
+			f.Sequence = seq - stale + inst;
+			genFill(data, pages*sizeof(page->User), (f.BlockType<<16) | f.Sequence);
+			for(i=0; i<pages; i++)
+			{
+				page = (PAGEDATA*)&out[((inst*pages)+i)*sizeof(PAGEDATA)];
+				memcpy(page->User, &data[i*sizeof(page->User)], sizeof(page->User));
+				genMeta(page, &f, unit);
+			}
+		}
+		return;
+	}
+
+	for(i=0; i<SMALL_BLOCK_PAGES; i++)
+	{
+		page = (PAGEDATA*)&out[i*sizeof(PAGEDATA)];
+		memcpy(page->User, &data[i*sizeof(page->User)], sizeof(page->User));
+		genMeta(page, &f, unit);
+	}
+}
+
+// gen [files] [frag%] [badblocks] [stale] [seed]: writes a consistent image for the selected nandtype
+int cmdGen(int argc, char** argv)
+{
+	unsigned int files = (argc > 0) ? strtoul(argv[0], NULL, 0) : 32;
+	unsigned int frag = (argc > 1) ? strtoul(argv[1], NULL, 0) : 10;
+	unsigned int bad = (argc > 2) ? strtoul(argv[2], NULL, 0) : 2;
+	unsigned int stale = (argc > 3) ? strtoul(argv[3], NULL, 0) : 2;
+	unsigned short chain[FS_CHAIN_COUNT];
+	unsigned char fsent[FSROOT_SIZE];
+	unsigned char root[FS_CLUSTER_SIZE];
+	unsigned int mobiSize[GEN_MOBILES], mobiUnit[GEN_MOBILES];
+	unsigned int unitSz, units, clusters, sysEnd, rootUnit, rootUnits, cur = GEN_BOOT_UNITS;
+	unsigned int i, j, k, u, size, need, prev, seq = 0x20;
+	unsigned char* data;
+	unsigned char* out;
+	int* plan;
+	int a, ret = 0;
+	FS_ENT* ent;
+
+	gen_seed = (argc > 4) ? strtoul(argv[4], NULL, 0) : 1;
+	if(gen_seed == 0)
+		gen_seed = 1;
+	if(files > MAX_FSENT)
+		files = MAX_FSENT;
+	if(stale > 7)
+		stale = 7;
+
+	unitSz = nand.MMC ? FS_CLUSTER_SIZE : SMALL_BLOCK_SZ_PHYS;
+	units = (nand.MMC ? nand.SizeData : nand.SizeDump) / unitSz;
+	rootUnits = nand.isBB ? 8 : 1;
+	sysEnd = (nand.ConfigBlock - (nand.MMC ? MMC_ANCHOR_BLOCKS : 0)) * (nand.BlockSz / FS_CLUSTER_SIZE);
+	clusters = units;
+	if(nand.isBB)
+		clusters = sysEnd; // the FS window ends at the config blocks
+	if(clusters > FS_CHAIN_COUNT)
+		clusters = FS_CHAIN_COUNT;
+
+	plan = (int *)vmalloc(units * sizeof(int));
+	data = (unsigned char *)vmalloc(FS_CLUSTER_SIZE);
+	out = (unsigned char *)vmalloc(SMALL_BLOCK_SZ_PHYS);
+	for(u=0; u<units; u++)
+		plan[u] = ((u < GEN_BOOT_UNITS) || (u >= sysEnd)) ? GEN_SYSTEM : GEN_ERASED;
+	for(i=0; i<FS_CHAIN_COUNT; i++)
+		chain[i] = (i < clusters) ? FS_CHAIN_FREE : FS_CHAIN_RESERVED;
+	for(u=0; u<clusters; u++)
+		if(plan[u] == GEN_SYSTEM)
+			chain[u] = FS_CHAIN_RESERVED;
+	memset(fsent, 0, sizeof(fsent));
+
+	// system structures land on random blocks, then files fill up around them; on BG each one
+	// owns its whole BgBlock like the root written by pack
+	a = genAlloc(plan, GEN_BOOT_UNITS, clusters);
+	if(a < 0)
+	{
+		printf("No room for the FSRoot\n");
+		ret = 9;
+		goto out;
+	}
+	rootUnit = a;
+	for(j=0; j<rootUnits; j++)
+	{
+		plan[rootUnit+j] = GEN_ROOT;
+		chain[rootUnit+j] = FS_CHAIN_END;
+	}
+	for(i=0; i<GEN_MOBILES; i++)
+	{
+		mobiSize[i] = (1 + (genRand() % 4)) * 0x800; // 4..16 pages, multiples of 4 for BG
+		need = rootUnits;
+		if(nand.MMC)
+		{
+			mobiSize[i] *= 4; // whole blocks on MMC, up to 4
+			need = (mobiSize[i] + FS_CLUSTER_SIZE - 1) / FS_CLUSTER_SIZE;
+		}
+		a = genAlloc(plan, GEN_BOOT_UNITS, clusters - need);
+		if(a < 0)
+		{
+			printf("No room for Mobile%c\n", MOBILE_BASE+1+i+0x11);
+			ret = 9;
+			goto out;
+		}
+		mobiUnit[i] = a;
+		for(j=0; j<need; j++)
+		{
+			plan[a+j] = GEN_MOBILE - ((MOBILE_BASE+1+i)<<4) - (nand.MMC ? 0 : stale);
+			if(nand.isBB && j)
+				plan[a+j] = GEN_TAIL;
+			chain[a+j] = FS_CHAIN_RESERVED;
+		}
+	}
+	for(i=0; (i<bad) && !nand.MMC; i++)
+	{
+		a = genAlloc(plan, GEN_BOOT_UNITS, clusters);
+		if(a < 0)
+			break;
+		for(j=0; j<rootUnits; j++)
+		{
+			plan[a+j] = GEN_BAD;
+			chain[a+j] = FS_CHAIN_RESERVED;
+		}
+	}
+	if(i < bad)
+	{
+		printf("Only room for %d bad block(s)\n", i);
+		bad = i;
+	}
+	for(i=0; i<stale; i++)
+	{
+		// old roots are left in free space, the chain table doesn't know them anymore
+		a = genAlloc(plan, GEN_BOOT_UNITS, clusters);
+		if(a < 0)
+		{
+			printf("Only room for %d stale root(s)\n", i);
+			stale = i;
+			break;
+		}
+		for(j=0; j<rootUnits; j++)
+			plan[a+j] = GEN_STALE_ROOT;
+	}
+
+	for(i=0; i<files; i++)
+	{
+		ent = (FS_ENT*)&fsent[i*sizeof(FS_ENT)];
+		snprintf(ent->FileName, sizeof(ent->FileName), "file%03d.bin", i);
+		size = 1 + (genRand() % (8*FS_CLUSTER_SIZE));
+		ent->ClusterSz = __builtin_bswap32(size);
+		ent->TypeTime = __builtin_bswap32(GEN_STAMP + i);
+		need = (size + FS_CLUSTER_SIZE - 1) / FS_CLUSTER_SIZE;
+		prev = FS_CHAIN_END;
+		for(k=0; k<need; k++)
+		{
+			if((genRand() % 100) < frag)
+				cur = GEN_BOOT_UNITS + (genRand() % (clusters - GEN_BOOT_UNITS));
+			for(j=0; j<clusters; j++, cur++)
+			{
+				if(cur >= clusters)
+					cur = GEN_BOOT_UNITS;
+				if((plan[cur] == GEN_ERASED) && (chain[cur] == FS_CHAIN_FREE))
+					break;
+			}
+			if(j == clusters)
+			{
+				printf("Image full after %d file(s)\n", i);
+				break;
+			}
+			plan[cur] = (i<<8)|k;
+			chain[cur] = FS_CHAIN_END;
+			if(prev == FS_CHAIN_END)
+				ent->StartCluster = __builtin_bswap16(cur);
+			else
+				chain[prev] = cur;
+			prev = cur;
+		}
+		if(k < need)
+		{
+			ent->ClusterSz = __builtin_bswap32(k*FS_CLUSTER_SIZE);
+			if(k == 0)
+				memset(ent, 0, sizeof(FS_ENT));
+			files = i + (k ? 1 : 0);
+			break;
+		}
+	}
+
+	// chain and entry tables alternate page by page inside the root block
+	for(i=0; i<FS_CHAIN_COUNT; i++)
+		chain[i] = __builtin_bswap16(chain[i]);
+	for(i=0; i<(FS_CLUSTER_SIZE/0x400); i++)
+	{
+		memcpy(&root[i*0x400], &((unsigned char*)chain)[i*0x200], 0x200);
+		memcpy(&root[(i*0x400)+0x200], &fsent[i*0x200], 0x200);
+	}
+
+	fseek(pFile, 0, SEEK_SET);
+	for(u=0; u<units; u++)
+	{
+		if(nand.MMC)
+		{
+			memset(out, 0, FS_CLUSTER_SIZE);
+			if(plan[u] == GEN_ROOT)
+				memcpy(out, root, FS_CLUSTER_SIZE);
+			else if(plan[u] == GEN_STALE_ROOT)
+				genFill(out, FS_CLUSTER_SIZE, u);
+			else if(plan[u] >= 0)
+				genFill(out, FS_CLUSTER_SIZE, plan[u]);
+			else if(plan[u] <= GEN_MOBILE)
+				genFill(out, FS_CLUSTER_SIZE, (-(plan[u] - GEN_MOBILE)) + u);
+			else if((u == sysEnd) || (u == sysEnd + 1))
+			{
+				// the second anchor is the newer one, the first one a version behind
+				memset(out, 0, MMC_ANCHOR_SIZE);
+				xenon_nandfs_SetMMCAnchorVer(out, seq - ((u == sysEnd) ? 1 : 0));
+				xenon_nandfs_SetMMCMobileBlock(out, MOBILE_FSROOT, rootUnit);
+				for(i=0; i<GEN_MOBILES; i++)
+				{
+					xenon_nandfs_SetMMCMobileBlock(out, MOBILE_BASE+1+i, mobiUnit[i]);
+					xenon_nandfs_SetMMCMobileSize(out, MOBILE_BASE+1+i, (mobiSize[i] + FS_CLUSTER_SIZE - 1) / FS_CLUSTER_SIZE);
+				}
+				xenon_nandfs_SetMMCAnchorSha(out);
+			}
+			else if(plan[u] == GEN_SYSTEM)
+				genFill(out, FS_CLUSTER_SIZE, 0x80000000 | u);
+			statWrite(out, FS_CLUSTER_SIZE, 1, pFile);
+			continue;
+		}
+
+		switch(plan[u])
+		{
+			case GEN_ERASED:
+			case GEN_TAIL:
+				memset(out, 0xFF, SMALL_BLOCK_SZ_PHYS);
+				break;
+			case GEN_ROOT:
+				// the rest of a root BgBlock only carries its spare, the LBA maps it onto itself
+				memset(data, 0, FS_CLUSTER_SIZE);
+				genUnit(out, (u == rootUnit) ? root : data, GEN_ROOT, u, seq, 0);
+				break;
+			case GEN_STALE_ROOT:
+				genFill(data, FS_CLUSTER_SIZE, u);
+				genUnit(out, data, GEN_STALE_ROOT, u, seq - 1 - (genRand() % 0x10), 0);
+				break;
+			case GEN_SYSTEM:
+				genFill(data, FS_CLUSTER_SIZE, 0x80000000 | u);
+				genUnit(out, data, GEN_SYSTEM, u, 0, 0);
+				break;
+			default:
+				if(plan[u] <= GEN_MOBILE)
+				{
+					i = ((-(plan[u] - GEN_MOBILE)) >> 4) - MOBILE_BASE - 1;
+					genUnit(out, data, plan[u], u, seq, mobiSize[i]);
+				}
+				else if(plan[u] == GEN_BAD)
+					genUnit(out, data, GEN_BAD, u, 0, 0);
+				else
+				{
+					genFill(data, FS_CLUSTER_SIZE, plan[u]);
+					genUnit(out, data, plan[u], u, 0, 0);
+				}
+				break;
+		}
+		statWrite(out, SMALL_BLOCK_SZ_PHYS, 1, pFile);
+	}
+	fflush(pFile);
+
+	printf("0x%x units, 0x%x clusters, root at unit 0x%x, %d file(s), %d%% fragmented, %d bad, %d stale\n",
+		units, clusters, rootUnit, files, frag, nand.MMC ? 0 : bad, stale);
+out:
+	vfree(plan);
+	vfree(data);
+	vfree(out);
+	return ret;
+}
+
+#define BENCH_SCAN		0
+#define BENCH_LBA		1
+#define BENCH_LIST		2
+#define BENCH_EXTRACT	3
+#define BENCH_VERIFY	4
+#define BENCH_COUNT		5
+
+#define BENCH_TOLERANCE	25 // percent slower than baseline before it counts as a regression
+#define BENCH_FLOOR		0.001 // seconds, anything faster is timer noise
+
+static const char* bench_names[BENCH_COUNT] = {"scan", "lba", "list", "extract", "verify"};
+
+static double benchNow(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + (ts.tv_nsec / 1e9);
+}
+
+static unsigned int benchExtract(unsigned char* buf)
+{
+	unsigned int i, cnt = 0;
+	unsigned char (*digest)[SHA_DIGEST_LEN] = (unsigned char (*)[SHA_DIGEST_LEN])vmalloc(FS_CHAIN_COUNT * SHA_DIGEST_LEN);
+
+	for(i=0; i<MAX_FSENT; i++)
+	{
+		if((dumpdata.FsEnt[i]->FileName[0] == 0) || (dumpdata.FsEnt[i]->FileName[0] == FS_ENT_ERASED))
+			continue;
+		cnt += exportWalk(dumpdata.FsEnt[i], digest, buf, NULL);
+	}
+	vfree(digest);
+	return cnt;
+}
+
+static unsigned int benchVerify(unsigned char* buf)
+{
+	FSCK_RESULT res;
+	unsigned int u, i, bad = 0;
+	PAGEDATA* page;
+
+	bad = xenon_nandfs_CheckFs(&res);
+	if(nand.MMC)
+		return bad;
+	for(u=0; u<(nand.SizeDump/SMALL_BLOCK_SZ_PHYS); u++)
+	{
+		xenon_sfc_ReadMapData(buf, u*SMALL_BLOCK_SZ_PHYS, SMALL_BLOCK_SZ_PHYS);
+		for(i=0; i<SMALL_BLOCK_PAGES; i++)
+		{
+			page = (PAGEDATA*)&buf[i*sizeof(PAGEDATA)];
+			if(xenon_sfc_ClassifyBlock((unsigned char*)&page->Meta, NULL, sizeof(METADATA), sizeof(METADATA), 0) & BLKCLS_ERASED)
+				continue;
+			if(xenon_nandfs_GetBadBlockMark(&page->Meta) != 0xFF)
+				continue;
+			if(xenon_nandfs_CheckECC(page))
+				bad++;
+		}
+	}
+	return bad;
+}
+
+// times every stage, best of runs, against the numbers stored in baseline (written on first use)
+int cmdBench(char* baseline, char* runsArg)
+{
+	unsigned int runs = runsArg ? strtoul(runsArg, NULL, 0) : 3;
+	double best[BENCH_COUNT], base[BENCH_COUNT], t;
+	unsigned int r, i, clusters = 0, errors = 0;
+	unsigned char* buf = (unsigned char *)vmalloc(SMALL_BLOCK_SZ_PHYS);
+	char name[32];
+	int quiet, saved, ret = 0;
+	bool haveBase = false;
+	FILE* f;
+
+	if(runs == 0)
+		runs = 1;
+	for(i=0; i<BENCH_COUNT; i++)
+		best[i] = 1e9;
+
+	// the scanner talks a lot, keep it off the terminal while timing
+	fflush(stdout);
+	saved = dup(1);
+	quiet = open("/dev/null", O_WRONLY);
+	for(r=0; r<runs; r++)
+	{
+		dup2(quiet, 1);
+		if(dumpdata.LBAMap)
+			vfree(dumpdata.LBAMap);
+		xenon_nandfs_FreeConfig();
+		memset(&dumpdata, 0, sizeof(DUMPDATA));
+		t = benchNow();
+		if(!xenon_nandfs_init())
+		{
+			fflush(stdout);
+			dup2(saved, 1);
+			printf("FSRoot wasn't found\n");
+			ret = 5;
+			break;
+		}
+		t = benchNow() - t;
+		if(t < best[BENCH_SCAN]) best[BENCH_SCAN] = t;
+
+		t = benchNow();
+		xenon_nandfs_ParseLBA();
+		t = benchNow() - t;
+		if(t < best[BENCH_LBA]) best[BENCH_LBA] = t;
+
+		t = benchNow();
+		xenon_nandfs_SplitFsRootBuf();
+		for(i=0; i<MAX_FSENT; i++)
+			if(dumpdata.FsEnt[i]->FileName[0] != 0)
+				printf("%.22s\n", dumpdata.FsEnt[i]->FileName);
+		fflush(stdout);
+		t = benchNow() - t;
+		if(t < best[BENCH_LIST]) best[BENCH_LIST] = t;
+
+		t = benchNow();
+		clusters = benchExtract(buf);
+		t = benchNow() - t;
+		if(t < best[BENCH_EXTRACT]) best[BENCH_EXTRACT] = t;
+
+		t = benchNow();
+		errors = benchVerify(buf);
+		t = benchNow() - t;
+		if(t < best[BENCH_VERIFY]) best[BENCH_VERIFY] = t;
+		fflush(stdout);
+		dup2(saved, 1);
+	}
+	close(quiet);
+	close(saved);
+	vfree(buf);
+	if(ret)
+		return ret;
+
+	f = fopen(baseline, "r");
+	if(f != NULL)
+	{
+		haveBase = true;
+		for(i=0; i<BENCH_COUNT; i++)
+			base[i] = 0;
+		while(fscanf(f, "%31s %lf", name, &t) == 2)
+			for(i=0; i<BENCH_COUNT; i++)
+				if(!strcmp(name, bench_names[i]))
+					base[i] = t;
+		fclose(f);
+	}
+
+	printf("%d cluster(s) extracted, %d verify error(s), best of %d run(s)\n", clusters, errors, runs);
+	for(i=0; i<BENCH_COUNT; i++)
+	{
+		printf("%-8s %10.6f s", bench_names[i], best[i]);
+		if(haveBase && (base[i] > 0))
+		{
+			printf("  baseline %10.6f s  %+6.1f%%", base[i], ((best[i] / base[i]) - 1) * 100);
+			if((best[i] > base[i] * (100 + BENCH_TOLERANCE) / 100) && ((best[i] - base[i]) > BENCH_FLOOR))
+			{
+				printf("  REGRESSION");
+				ret = 9;
+			}
+		}
+		printf("\n");
+	}
+
+	if(!haveBase)
+	{
+		f = fopen(baseline, "w");
+		if(f == NULL)
+			printf("Failed writing \'%s\'!!!\n", baseline);
+		else
+		{
+			for(i=0; i<BENCH_COUNT; i++)
+				fprintf(f, "%s %.6f\n", bench_names[i], best[i]);
+			fclose(f);
+			printf("Baseline written to \'%s\'\n", baseline);
+		}
+	}
+	if(errors)
+		ret = 8;
+	return ret;
+}
+
+#define MU_MAX_EXTENTS	0x1000
+#define MU_CHUNK		0x100000 // bytes per read while extracting an extent
+#define MU_MAX_DEPTH	16
+
+// walks a directory, listing it or extracting into outdir when given; seen marks the first
+// cluster of every directory walked so far, a directory pointing back at one is not entered
+static int muWalk(FATX_VOL* vol, unsigned int dirCluster, char* path, char* outdir, FATX_EXTENT* ext, unsigned char* buf, unsigned char* seen, unsigned int depth)
+{
+	FATX_DIRENT* de;
+	FATX_EXTENT* sub;
+	unsigned char* dir;
+	char name[FATX_NAME_LEN + 1];
+	char child[512], outpath[512];
+	unsigned int runs, i, j, k, off, len, left, size, fileSz, chunk, first, files = 0;
+	FILE* outfile;
+
+	seen[dirCluster] = 1;
+	runs = xenon_nandfs_FatxExtents(vol, dirCluster, ext, MU_MAX_EXTENTS);
+	size = 0;
+	for(i=0; i<runs; i++)
+		size += ext[i].Count * vol->ClusterSz;
+	dir = (unsigned char *)vmalloc(size);
+	off = 0;
+	for(i=0; i<runs; i++)
+	{
+		xenon_nandfs_FatxRead(vol, &dir[off], xenon_nandfs_FatxClusterOffset(vol, ext[i].Cluster), ext[i].Count * vol->ClusterSz);
+		off += ext[i].Count * vol->ClusterSz;
+	}
+
+	sub = (FATX_EXTENT *)vmalloc(MU_MAX_EXTENTS * sizeof(FATX_EXTENT));
+	for(off=0; off<size; off+=sizeof(FATX_DIRENT))
+	{
+		de = (FATX_DIRENT*)&dir[off];
+		if((de->NameLen == 0) || (de->NameLen == FATX_DIRENT_END))
+			break;
+		if((de->NameLen == FATX_DIRENT_DELETED) || (de->NameLen > FATX_NAME_LEN))
+			continue;
+		memcpy(name, de->Name, de->NameLen);
+		name[de->NameLen] = 0;
+		snprintf(child, sizeof(child), "%s/%s", path, name);
+		first = __builtin_bswap32(de->FirstCluster);
+		if(!safeName(name))
+		{
+			printf("** %s skipped, not a plain file name\n", child);
+			continue;
+		}
+
+		if(de->Attributes & FATX_ATTR_DIR)
+		{
+			if((first == 0) || (first > vol->ClusterCount) || seen[first] || (depth >= MU_MAX_DEPTH))
+			{
+				printf("** %s skipped, %s\n", child, (depth >= MU_MAX_DEPTH) ? "nested too deep" : "loops back or has no cluster");
+				continue;
+			}
+			printf("%-48s <dir>\n", child);
+			if(outdir)
+			{
+				snprintf(outpath, sizeof(outpath), "%s%s", outdir, child);
+				mkdir(outpath, 0755);
+			}
+			files += muWalk(vol, first, child, outdir, sub, buf, seen, depth + 1);
+			continue;
+		}
+
+		fileSz = __builtin_bswap32(de->FileSize);
+		runs = xenon_nandfs_FatxExtents(vol, first, sub, MU_MAX_EXTENTS);
+		printf("%-48s %10u bytes, %u extent(s)\n", child, fileSz, runs);
+		files++;
+		if(!outdir)
+			continue;
+
+		snprintf(outpath, sizeof(outpath), "%s%s", outdir, child);
+		outfile = fopen(outpath, "wb");
+		if(outfile == NULL)
+		{
+			printf("Failed opening \'%s\'!!!\n", outpath);
+			continue;
+		}
+		// whole extents go out in large reads, never cluster by cluster
+		left = fileSz;
+		for(j=0; (j<runs) && (left > 0); j++)
+		{
+			len = sub[j].Count * vol->ClusterSz;
+			if(len > left)
+				len = left;
+			for(k=0; k<len; k+=MU_CHUNK)
+			{
+				chunk = (len - k > MU_CHUNK) ? MU_CHUNK : (len - k);
+				xenon_nandfs_FatxRead(vol, buf, xenon_nandfs_FatxClusterOffset(vol, sub[j].Cluster) + k, chunk);
+				statWrite(buf, chunk, 1, outfile);
+			}
+			left -= len;
+		}
+		fclose(outfile);
+		if(left)
+			printf("** %s is truncated, 0x%x bytes missing\n", child, left);
+	}
+	vfree(sub);
+	vfree(dir);
+	return files;
+}
+
+int cmdMu(char* outdir)
+{
+	FATX_VOL vol;
+	FATX_EXTENT* ext;
+	unsigned char* buf;
+	unsigned char* seen;
+	int files;
+
+	if(!xenon_nandfs_FatxOpen(&vol))
+	{
+		printf("No MU partition found (BG dumps of 256/512MB only)\n");
+		return 10;
+	}
+	printf("MU at 0x%x, 0x%x bytes, cluster 0x%x, 0x%x clusters, root cluster 0x%x\n",
+		vol.Start, vol.Size, vol.ClusterSz, vol.ClusterCount, vol.RootCluster);
+	if(outdir)
+		mkdir(outdir, 0755);
+
+	ext = (FATX_EXTENT *)vmalloc(MU_MAX_EXTENTS * sizeof(FATX_EXTENT));
+	buf = (unsigned char *)vmalloc(MU_CHUNK);
+	seen = (unsigned char *)vmalloc(vol.ClusterCount + 1);
+	memset(seen, 0, vol.ClusterCount + 1);
+	files = (vol.RootCluster <= vol.ClusterCount) ? muWalk(&vol, vol.RootCluster, "", outdir, ext, buf, seen, 0) : 0;
+	printf("%d file(s)\n", files);
+	vfree(seen);
+	vfree(buf);
+	vfree(ext);
+	xenon_nandfs_FatxClose(&vol);
+	return 0;
+}
+
+#define GENMU_CLUSTER	0x4000
+#define GENMU_FULL		0x10800000 // dump size of a 256MB chip, spare included
+
+// user bytes at off of the MU, the spare of their pages is left as is
+static void genMuWrite(unsigned int off, const unsigned char* buf, unsigned int len)
+{
+	unsigned int start = (BB_SYSTEM_AREA / nand.BlockSz) * nand.BlockSzPhys, n;
+
+	while(len > 0)
+	{
+		n = nand.PageSz - (off % nand.PageSz);
+		if(n > len)
+			n = len;
+		fseek(pFile, start + ((off / nand.PageSz) * nand.PageSzPhys) + (off % nand.PageSz), SEEK_SET);
+		statWrite(buf, n, 1, pFile);
+		off += n;
+		buf += n;
+		len -= n;
+	}
+}
+
+static void genMuDirent(unsigned char* dir, unsigned int idx, const char* name, unsigned char attr, unsigned int first, unsigned int size)
+{
+	FATX_DIRENT* de = &((FATX_DIRENT*)dir)[idx];
+
+	memset(de, 0, sizeof(FATX_DIRENT));
+	de->NameLen = strlen(name);
+	de->Attributes = attr;
+	memcpy(de->Name, name, de->NameLen);
+	de->FirstCluster = __builtin_bswap32(first);
+	de->FileSize = __builtin_bswap32(size);
+}
+
+// chains count clusters from *next, every third one is skipped when frag is set; returns the first
+static unsigned int genMuChain(unsigned char* fat, unsigned int entSz, unsigned int* next, unsigned int count, bool frag)
+{
+	unsigned int i, c, first = *next, prev = 0;
+
+	for(i=0; i<count; i++)
+	{
+		c = *next;
+		*next += (frag && ((i % 3) == 2)) ? 2 : 1;
+		if(prev)
+		{
+			if(entSz == 2)
+				*(unsigned short*)&fat[prev*2] = __builtin_bswap16(c);
+			else
+				*(unsigned int*)&fat[prev*4] = __builtin_bswap32(c);
+		}
+		prev = c;
+	}
+	if(entSz == 2)
+		*(unsigned short*)&fat[prev*2] = 0xFFFF;
+	else
+		*(unsigned int*)&fat[prev*4] = 0xFFFFFFFF;
+	return first;
+}
+
+// writes a file of size bytes of genFill(tag) into the MU and into refdir/name when given
+static unsigned int genMuFile(unsigned char* fat, unsigned int entSz, unsigned int* next, unsigned int dataOff,
+	unsigned int size, unsigned int tag, bool frag, char* refdir, const char* name)
+{
+	unsigned int count = (size + GENMU_CLUSTER - 1) / GENMU_CLUSTER;
+	unsigned int first = genMuChain(fat, entSz, next, count, frag);
+	unsigned int i, c = first;
+	unsigned char* data = (unsigned char *)vmalloc(count * GENMU_CLUSTER);
+	char path[512];
+
+	memset(data, 0, count * GENMU_CLUSTER);
+	genFill(data, size, tag);
+	for(i=0; i<count; i++)
+	{
+		genMuWrite(dataOff + ((c - 1) * GENMU_CLUSTER), &data[i*GENMU_CLUSTER], GENMU_CLUSTER);
+		c += (frag && ((i % 3) == 2)) ? 2 : 1;
+	}
+	if(refdir)
+	{
+		snprintf(path, sizeof(path), "%s/%s", refdir, name);
+		writeToFile(path, data, size);
+	}
+	vfree(data);
+	return first;
+}
+
+// a small FATX volume behind the system area of a BG dump, so mu has something to list:
+// plain, exact and fragmented files, a subdirectory, a deleted entry and the entries a
+// hostile MU could carry, names that leave the output directory and directories looping back.
+// A 64MB dump is first padded to a 256MB chip; refdir gets what mu has to extract
+int cmdGenMu(char* refdir)
+{
+	unsigned int size, count, entSz, fatSz, dataOff, next = 1, root, sub, a, big, c, x;
+	unsigned char* fat;
+	unsigned char* dir;
+	unsigned char hdr[0x10];
+	char path[512];
+	long len;
+
+	if(!nand.isBB)
+	{
+		printf("The MU only exists on big block NAND\n");
+		return 10;
+	}
+	if(nand.SizeData <= BB_SYSTEM_AREA)
+	{
+		dir = (unsigned char *)vmalloc(nand.BlockSzPhys);
+		memset(dir, 0xFF, nand.BlockSzPhys);
+		fseek(pFile, 0, SEEK_END);
+		for(len = ftell(pFile); len < GENMU_FULL; len += nand.BlockSzPhys)
+			statWrite(dir, ((GENMU_FULL - len) > nand.BlockSzPhys) ? nand.BlockSzPhys : (GENMU_FULL - len), 1, pFile);
+		vfree(dir);
+		xenon_sfc_GetNandStruct(&nand);
+	}
+
+	// same geometry FatxOpen derives
+	size = nand.SizeData - BB_SYSTEM_AREA;
+	count = size / GENMU_CLUSTER;
+	entSz = (count < FATX_FAT16_LIMIT) ? 2 : 4;
+	fatSz = ((count + 1) * entSz + FATX_HEADER_SIZE - 1) & ~(FATX_HEADER_SIZE - 1);
+	dataOff = FATX_HEADER_SIZE + fatSz;
+	fat = (unsigned char *)vmalloc(fatSz);
+	dir = (unsigned char *)vmalloc(GENMU_CLUSTER);
+	memset(fat, 0, fatSz);
+	if(refdir)
+	{
+		mkdir(refdir, 0755);
+		snprintf(path, sizeof(path), "%s/Content", refdir);
+		mkdir(path, 0755);
+	}
+
+	root = genMuChain(fat, entSz, &next, 1, false);
+	sub = genMuChain(fat, entSz, &next, 1, false);
+	a = genMuFile(fat, entSz, &next, dataOff, 100, 1, false, refdir, "a.bin");
+	big = genMuFile(fat, entSz, &next, dataOff, 300000, 2, true, refdir, "big.dat");
+	c = genMuFile(fat, entSz, &next, dataOff, 2 * GENMU_CLUSTER, 3, false, refdir, "c.txt");
+	x = genMuFile(fat, entSz, &next, dataOff, 50000, 4, false, refdir, "Content/x.bin");
+
+	memset(dir, 0xFF, GENMU_CLUSTER);
+	genMuDirent(dir, 0, "a.bin", 0, a, 100);
+	genMuDirent(dir, 1, "big.dat", 0, big, 300000);
+	genMuDirent(dir, 2, "gone", 0, a, 100);
+	dir[2*sizeof(FATX_DIRENT)] = FATX_DIRENT_DELETED;
+	genMuDirent(dir, 3, "c.txt", 0, c, 2 * GENMU_CLUSTER);
+	genMuDirent(dir, 4, "Content", FATX_ATTR_DIR, sub, 0);
+	genMuDirent(dir, 5, "loop", FATX_ATTR_DIR, root, 0);
+	genMuDirent(dir, 6, "..", FATX_ATTR_DIR, sub, 0);
+	genMuDirent(dir, 7, "x/y", 0, a, 100);
+	genMuWrite(dataOff + ((root - 1) * GENMU_CLUSTER), dir, GENMU_CLUSTER);
+
+	memset(dir, 0xFF, GENMU_CLUSTER);
+	genMuDirent(dir, 0, "x.bin", 0, x, 50000);
+	genMuDirent(dir, 1, "up", FATX_ATTR_DIR, root, 0);
+	genMuWrite(dataOff + ((sub - 1) * GENMU_CLUSTER), dir, GENMU_CLUSTER);
+
+	genMuWrite(FATX_HEADER_SIZE, fat, fatSz);
+	memset(hdr, 0, sizeof(hdr));
+	*(unsigned int*)&hdr[0] = __builtin_bswap32(FATX_MAGIC);
+	*(unsigned int*)&hdr[8] = __builtin_bswap32(GENMU_CLUSTER / nand.PageSz);
+	*(unsigned int*)&hdr[12] = __builtin_bswap32(root);
+	genMuWrite(0, hdr, sizeof(hdr));
+	fflush(pFile);
+
+	printf("MU of 0x%x bytes, 0x%x clusters used, 4 file(s) to extract\n", size, next - 1);
+	vfree(fat);
+	vfree(dir);
+	return 0;
+}
+
+#define MOBILE_MAX_SEGS	(SMALL_BLOCK_PAGES * 8)
+
+// lists every indexed instance, or serves one straight out of the mapped dump
+int cmdMobile(int argc, char** argv)
+{
+	MOBILE_SEG seg[MOBILE_MAX_SEGS];
+	MOBILE_INST* inst;
+	unsigned int i, cnt, back = 0;
+	unsigned char mobi;
+	int idx;
+	FILE* outfile;
+
+	if(!openFs())
+		return 5;
+	if(argc == 0)
+	{
+		for(mobi = MOBILE_BASE+1; mobi < MOBILE_END; mobi++)
+		{
+			for(i=0; i<dumpdata.MobileHistCount; i++)
+			{
+				inst = &dumpdata.MobileHist[i];
+				if(inst->Mobile != mobi)
+					continue;
+				printf("Mobile%c  -%-3u block 0x%04x page %2d seq 0x%08x size 0x%x\n", 'A' + (mobi - MOBILE_BASE),
+					xenon_nandfs_GetMobileInstAge(i), inst->Block, inst->Page, inst->Sequence, inst->Size);
+			}
+		}
+		printf("%u instance(s)\n", dumpdata.MobileHistCount);
+		return 0;
+	}
+
+	mobi = MOBILE_BASE + ((argv[0][0] & ~0x20) - 'A'); // either case
+	if((argv[0][1] != 0) || (mobi <= MOBILE_BASE) || (mobi >= MOBILE_END) || (argc > 3) || (argc < 2))
+	{
+		printf("Usage: mobile [B-O [versions back] out.bin]\n");
+		return 3;
+	}
+	if(argc == 3)
+		back = strtoul(argv[1], NULL, 0);
+
+	idx = xenon_nandfs_FindMobileInst(mobi, back);
+	if(idx < 0)
+	{
+		printf("Mobile%c has no instance %u versions back\n", 'A' + (mobi - MOBILE_BASE), back);
+		return 10;
+	}
+	inst = &dumpdata.MobileHist[idx];
+	cnt = xenon_nandfs_MapMobileInst(inst, seg, MOBILE_MAX_SEGS);
+	if(cnt == 0)
+	{
+		printf("Mobile%c at block 0x%x is outside the dump\n", 'A' + (mobi - MOBILE_BASE), inst->Block);
+		return 10;
+	}
+
+	outfile = fopen(argv[argc-1], "wb");
+	if(outfile == NULL)
+	{
+		printf("Failed opening \'%s\'!!!\n", argv[argc-1]);
+		return 4;
+	}
+	for(i=0; i<cnt; i++)
+		statWrite(seg[i].Data, seg[i].Len, 1, outfile);
+	fclose(outfile);
+	printf("Mobile%c seq 0x%x, block 0x%x page %d, 0x%x bytes in %u piece(s)\n", 'A' + (mobi - MOBILE_BASE), inst->Sequence, inst->Block, inst->Page, inst->Size, cnt);
+	return 0;
+}
+
+// shows the state of the cached config blocks and optionally dumps a range of them
+int cmdConfig(int argc, char** argv)
+{
+	unsigned char buf[0x10];
+	unsigned int i, off, len, n;
+	int status;
+
+	for(i=0; i<CONFIG_BLOCKS; i++)
+		printf("Config block 0x%x: %s\n", nand.ConfigBlock + i, xenon_nandfs_IsConfigBlockValid(i) ? "ok" : "EDC error");
+	if(argc == 0)
+		return 0;
+
+	off = strtoul(argv[0], NULL, 0);
+	len = (argc > 1) ? strtoul(argv[1], NULL, 0) : 0x100;
+	for(i=0; i<len; i+=n)
+	{
+		n = ((len - i) > sizeof(buf)) ? sizeof(buf) : (len - i);
+		status = xenon_nandfs_ReadConfig(buf, off + i, n);
+		if(status)
+		{
+			printf("%s at 0x%x\n", (status == 1) ? "Out of range" : "Invalid block", off + i);
+			return 10;
+		}
+		printf("%05x:", off + i);
+		for(status=0; status<n; status++)
+			printf(" %02x", buf[status]);
+		printf("\n");
+	}
+	return 0;
+}
+
+// stages one put/truncate/rm into up
+int stageUpdate(FS_UPDATE* up, char* op, char** argv)
+{
+	FILE* infile;
+	struct stat st;
+	unsigned char* data;
+	int ret;
+
+	if(!strcmp(op, "put"))
+	{
+		infile = fopen(argv[1], "rb");
+		if((infile == NULL) || (fstat(fileno(infile), &st) != 0))
+		{
+			printf("Failed opening \'%s\'!!!\n", argv[1]);
+			if(infile)
+				fclose(infile);
+			return FS_ERR_IO;
+		}
+		data = (unsigned char *)vmalloc(st.st_size ? st.st_size : 1);
+		statRead(data, 1, st.st_size, infile);
+		fclose(infile);
+		ret = xenon_nandfs_UpdateWrite(up, argv[0], data, st.st_size, packTimeStamp(st.st_mtime));
+		vfree(data);
+	}
+	else if(!strcmp(op, "truncate"))
+		ret = xenon_nandfs_UpdateTruncate(up, argv[0], strtoul(argv[1], NULL, 0), packTimeStamp(time(NULL)));
+	else if(!strcmp(op, "rm"))
+		ret = xenon_nandfs_UpdateDelete(up, argv[0]);
+	else
+		ret = FS_ERR_NAME;
+	if(ret)
+		printf("%s \'%s\' failed: %s\n", op, argv[0], (ret == FS_ERR_NOTFOUND) ? "no such file" :
+			(ret == FS_ERR_NOSPACE) ? "out of free clusters" : (ret == FS_ERR_NAME) ? "bad name or FSRoot full" : "I/O error");
+	return ret;
+}
+
+int commitUpdate(FS_UPDATE* up)
+{
+	int ret = xenon_nandfs_UpdateCommit(up);
+
+	if(ret)
+		printf("Commit failed: %s\n", (ret == FS_ERR_NOSPACE) ? "no free block for the FSRoot" : "I/O error");
+	else
+		printf("%u block(s) programmed, FSRoot v %d at block 0x%x\n", up->Programs, dumpdata.FSRootVer, dumpdata.FSRootBlock);
+	return ret;
+}
+
+// in place update of one file, only the touched clusters and a new FSRoot get programmed
+int cmdUpdate(char* op, int argc, char** argv)
+{
+	FS_UPDATE* up;
+	int ret;
+
+	if(!openFs())
+		return 7;
+	up = (FS_UPDATE *)vmalloc(sizeof(FS_UPDATE));
+	if((up == NULL) || xenon_nandfs_UpdateBegin(up))
+	{
+		vfree(up);
+		return 6;
+	}
+	ret = stageUpdate(up, op, argv);
+	if(!ret)
+		ret = commitUpdate(up);
+	else
+		xenon_nandfs_UpdateAbort(up);
+	vfree(up);
+	return ret ? 10 + ret : 0;
+}
+
+// splits a script line into tok (5 entries), returns the token count, 0 for blank and comment
+// lines and -1 for anything that isn't one of the commands with exactly its arguments
+int batchLine(char* line, char** tok)
+{
+	char* end;
+	int n;
+
+	for(n=0, tok[0]=strtok(line, " \t\r\n"); tok[n] && (n < 4); tok[++n]=strtok(NULL, " \t\r\n"))
+		;
+	if((n == 0) || (tok[0][0] == '#'))
+		return 0;
+	if(!strcmp(tok[0], "rm"))
+		return (n == 2) ? n : -1;
+	if(!strcmp(tok[0], "put"))
+		return (n == 3) ? n : -1;
+	if(!strcmp(tok[0], "truncate") && (n == 3))
+	{
+		strtoul(tok[2], &end, 0);
+		return (*end == 0) ? n : -1;
+	}
+	return -1;
+}
+
+// every line of the script is "put name file", "truncate name size" or "rm name"; the whole
+// script is checked first, then all of it goes into one update, so the data is programmed first
+// and a single FSRoot follows
+int cmdBatch(char* scriptname)
+{
+	FS_UPDATE* up;
+	FILE* script;
+	char line[1024];
+	char* tok[5];
+	unsigned int lineNo = 0, ops = 0;
+	int ret = 0;
+
+	script = fopen(scriptname, "r");
+	if(script == NULL)
+	{
+		printf("Failed opening \'%s\'!!!\n", scriptname);
+		return 4;
+	}
+	while(fgets(line, sizeof(line), script))
+	{
+		lineNo++;
+		if(batchLine(line, tok) < 0)
+		{
+			printf("%s:%u: bad command, nothing written\n", scriptname, lineNo);
+			fclose(script);
+			return 10 + FS_ERR_NAME;
+		}
+	}
+	rewind(script);
+
+	if(!openFs())
+	{
+		fclose(script);
+		return 7;
+	}
+	up = (FS_UPDATE *)vmalloc(sizeof(FS_UPDATE));
+	if((up == NULL) || xenon_nandfs_UpdateBegin(up))
+	{
+		vfree(up);
+		fclose(script);
+		return 6;
+	}
+
+	for(lineNo=0; !ret && fgets(line, sizeof(line), script); )
+	{
+		lineNo++;
+		if(batchLine(line, tok) <= 0)
+			continue;
+		ret = stageUpdate(up, tok[0], &tok[1]);
+		if(ret)
+			printf("%s:%u: nothing written\n", scriptname, lineNo);
+		ops++;
+	}
+	fclose(script);
+
+	if(!ret)
+	{
+		printf("%u change(s) staged, %u cluster(s) to program\n", ops, up->StagedCount);
+		ret = commitUpdate(up);
+	}
+	else
+		xenon_nandfs_UpdateAbort(up);
+	vfree(up);
+	return ret ? 10 + ret : 0;
+}
+
+int cmdHashTree(char* dumpname)
+{
+	HASHTREE tree;
+	char treename[512];
+
+	snprintf(treename, sizeof(treename), "%s.htree", dumpname);
+	if(!xenon_nandfs_HashTreeInit(&tree, nand.SizeDump / nand.BlockSzPhys, nand.BlockSzPhys))
+		return 6;
+	xenon_nandfs_HashTreeBuild(&tree);
+	printDigest("root: ", tree.Node[1]);
+	if(hashTreeSave(treename, &tree))
+		printf("Failed writing \'%s\'!!!\n", treename);
+	xenon_nandfs_HashTreeFree(&tree);
+	return 0;
+}
+
+int cmdRehash(char* dumpname, int cnt, char** blocks)
+{
+	HASHTREE tree;
+	char treename[512];
+	unsigned int* blk = (unsigned int *)vmalloc(cnt * sizeof(unsigned int));
+	int i;
+
+	snprintf(treename, sizeof(treename), "%s.htree", dumpname);
+	if(hashTreeLoad(treename, &tree))
+	{
+		printf("Failed loading \'%s\'!!!\n", treename);
+		vfree(blk);
+		return 6;
+	}
+	for(i=0; i<cnt; i++)
+		blk[i] = strtoul(blocks[i], NULL, 0);
+	xenon_nandfs_HashTreeRefresh(&tree, blk, cnt);
+	printDigest("root: ", tree.Node[1]);
+	hashTreeSave(treename, &tree);
+	xenon_nandfs_HashTreeFree(&tree);
+	vfree(blk);
+	return 0;
+}
+
+int cmdHashDiff(char* dumpname, char* othername)
+{
+	HASHTREE tree, other;
+	char treename[512];
+	unsigned int* blk;
+	unsigned int i, cnt;
+
+	snprintf(treename, sizeof(treename), "%s.htree", dumpname);
+	if(hashTreeLoad(treename, &tree))
+	{
+		printf("Failed loading \'%s\'!!!\n", treename);
+		return 6;
+	}
+	if(hashTreeLoad(othername, &other))
+	{
+		printf("Failed loading \'%s\'!!!\n", othername);
+		xenon_nandfs_HashTreeFree(&tree);
+		return 6;
+	}
+	blk = (unsigned int *)vmalloc(tree.LeafCount * sizeof(unsigned int));
+	cnt = xenon_nandfs_HashTreeDiff(&tree, &other, blk, tree.LeafCount);
+	for(i=0; i<cnt; i++)
+		printf("block 0x%x differs\n", blk[i]);
+	printf("%d block(s) differ\n", cnt);
+	vfree(blk);
+	xenon_nandfs_HashTreeFree(&tree);
+	xenon_nandfs_HashTreeFree(&other);
+	return 0;
+}
+#endif
+
+#ifdef DEBUG
+
+#define SHA_ROL(x, n) (((x) << (n)) | ((x) >> (32 - (n))))
+
+static void _xenon_nandfs_ShaTransform(unsigned int* state, const unsigned char* block)
+{
+	unsigned int w[80], a, b, c, d, e, f, k, tmp;
+	int i;
+
+	for(i=0; i<16; i++)
+		w[i] = ((unsigned int)block[i*4]<<24)|(block[i*4+1]<<16)|(block[i*4+2]<<8)|block[i*4+3];
+	for(i=16; i<80; i++)
+		w[i] = SHA_ROL(w[i-3] ^ w[i-8] ^ w[i-14] ^ w[i-16], 1);
+
+	a = state[0];
+	b = state[1];
+	c = state[2];
+	d = state[3];
+	e = state[4];
+
+	for(i=0; i<80; i++)
+	{
+		if(i < 20)
+		{
+			f = (b & c) | (~b & d);
+			k = 0x5A827999;
+		}
+		else if(i < 40)
+		{
+			f = b ^ c ^ d;
+			k = 0x6ED9EBA1;
+		}
+		else if(i < 60)
+		{
+			f = (b & c) | (b & d) | (c & d);
+			k = 0x8F1BBCDC;
+		}
+		else
+		{
+			f = b ^ c ^ d;
+			k = 0xCA62C1D6;
+		}
+		tmp = SHA_ROL(a, 5) + f + e + k + w[i];
+		e = d;
+		d = c;
+		c = SHA_ROL(b, 30);
+		b = a;
+		a = tmp;
+	}
+
+	state[0] += a;
+	state[1] += b;
+	state[2] += c;
+	state[3] += d;
+	state[4] += e;
+}
+
+void xenon_nandfs_ShaInit(SHA_CTX* ctx)
+{
+	ctx->State[0] = 0x67452301;
+	ctx->State[1] = 0xEFCDAB89;
+	ctx->State[2] = 0x98BADCFE;
+	ctx->State[3] = 0x10325476;
+	ctx->State[4] = 0xC3D2E1F0;
+	ctx->Count = 0;
+}
+
+void xenon_nandfs_ShaUpdate(SHA_CTX* ctx, const unsigned char* data, unsigned int len)
+{
+	unsigned int used = ctx->Count % SHA_BLOCK_LEN;
+	unsigned int fill;
+
+	ctx->Count += len;
+	if(used)
+	{
+		fill = SHA_BLOCK_LEN - used;
+		if(len < fill)
+		{
+			memcpy(&ctx->Buf[used], data, len);
+			return;
+		}
+		memcpy(&ctx->Buf[used], data, fill);
+		_xenon_nandfs_ShaTransform(ctx->State, ctx->Buf);
+		data += fill;
+		len -= fill;
+	}
+	// hash whole blocks straight from the caller's buffer
+	while(len >= SHA_BLOCK_LEN)
+	{
+		_xenon_nandfs_ShaTransform(ctx->State, data);
+		data += SHA_BLOCK_LEN;
+		len -= SHA_BLOCK_LEN;
+	}
+	if(len)
+		memcpy(ctx->Buf, data, len);
+}
+
+void xenon_nandfs_ShaFinal(SHA_CTX* ctx, unsigned char* digest)
+{
+	unsigned long long bits = ctx->Count << 3;
+	unsigned int used = ctx->Count % SHA_BLOCK_LEN;
+	int i;
+
+	ctx->Buf[used++] = 0x80;
+	if(used > (SHA_BLOCK_LEN - 8))
+	{
+		memset(&ctx->Buf[used], 0, SHA_BLOCK_LEN - used);
+		_xenon_nandfs_ShaTransform(ctx->State, ctx->Buf);
+		used = 0;
+	}
+	memset(&ctx->Buf[used], 0, (SHA_BLOCK_LEN - 8) - used);
+	for(i=0; i<8; i++)
+		ctx->Buf[SHA_BLOCK_LEN-1-i] = (bits >> (i*8)) & 0xFF;
+	_xenon_nandfs_ShaTransform(ctx->State, ctx->Buf);
+
+	for(i=0; i<SHA_DIGEST_LEN; i++)
+		digest[i] = (ctx->State[i>>2] >> ((3-(i&3))*8)) & 0xFF;
+}
+
+void xenon_nandfs_Sha(const unsigned char* data, unsigned int len, unsigned char* digest)
+{
+	SHA_CTX ctx;
+
+	xenon_nandfs_ShaInit(&ctx);
+	xenon_nandfs_ShaUpdate(&ctx, data, len);
+	xenon_nandfs_ShaFinal(&ctx, digest);
+}
+
+#else
+
+// the kernel's sha1, picks up whatever accelerated version the platform has;
+// allocated once in xenon_nandfs_init_one before anything gets hashed
+static struct crypto_shash* sha_tfm = NULL;
+
+void xenon_nandfs_ShaInit(SHA_CTX* ctx)
+{
+	struct shash_desc* desc = (struct shash_desc*)ctx->Desc;
+
+	desc->tfm = sha_tfm;
+	crypto_shash_init(desc);
+}
+
+void xenon_nandfs_ShaUpdate(SHA_CTX* ctx, const unsigned char* data, unsigned int len)
+{
+	crypto_shash_update((struct shash_desc*)ctx->Desc, data, len);
+}
+
+void xenon_nandfs_ShaFinal(SHA_CTX* ctx, unsigned char* digest)
+{
+	crypto_shash_final((struct shash_desc*)ctx->Desc, digest);
+}
+
+void xenon_nandfs_Sha(const unsigned char* data, unsigned int len, unsigned char* digest)
+{
+	SHA_CTX ctx;
+	struct shash_desc* desc = (struct shash_desc*)ctx.Desc;
+
+	desc->tfm = sha_tfm;
+	crypto_shash_digest(desc, data, len, digest);
+}
+
+#endif
+
+void xenon_nandfs_CalcECC(unsigned int *data, unsigned char* edc) {
+	unsigned int i=0, val=0;
+	unsigned int v=0;
+	unsigned char* page = (unsigned char*)data;
+	unsigned char* p = page;
+
+	for (i = 0; i < 0x1066; i++)
+	{
+		if (!(i & 31))
+		{
+			// little endian words, independent of host byte order
+			v = ~(p[0] | (p[1]<<8) | (p[2]<<16) | ((unsigned int)p[3]<<24));
+			p += 4;
+		}
+		val ^= v & 1;
+		v>>=1;
+		if (val & 1)
+			val ^= 0x6954559;
+		val >>= 1;
+	}
+
+	val = ~val;
+
+	// 26 bit ecc data, edc[0] keeps the block type bits sharing its byte
+	edc[0] = ((val << 6) | (page[0x20C] & 0x3F)) & 0xFF;
+	edc[1] = (val >> 2) & 0xFF;
+	edc[2] = (val >> 10) & 0xFF;
+	edc[3] = (val >> 18) & 0xFF;
+}
+
+void xenon_nandfs_SetECC(PAGEDATA* pdata)
+{
+	unsigned char ecd[4];
+	unsigned char* meta = (unsigned char*)&pdata->Meta;
+
+	xenon_nandfs_CalcECC((unsigned int*)pdata->User, ecd);
+	meta[0xC] = ecd[0];
+	meta[0xD] = ecd[1];
+	meta[0xE] = ecd[2];
+	meta[0xF] = ecd[3];
+}
+
+unsigned short xenon_nandfs_GetLBA(METADATA* meta)
+{
+	unsigned short ret = 0;
+	
+	switch (nand.MetaType)
+	{
+		case META_TYPE_SM:
+			ret =  (((meta->sm.BlockID0&0xF)<<8)+(meta->sm.BlockID1));
+			break;
+		case META_TYPE_BOS:
+			ret =  (((meta->bos.BlockID0&0xF)<<8)+(meta->bos.BlockID1&0xFF));
+			break;
+		case META_TYPE_BG:
+			ret =  (((meta->bg.BlockID0&0xF)<<8)+(meta->bg.BlockID1&0xFF));
+			break;
+	}
+	return ret;
+}
+
+unsigned char xenon_nandfs_GetBlockType(METADATA* meta)
+{
+	unsigned char ret = 0;
+	
+	switch (nand.MetaType)
+	{
+		case META_TYPE_SM:
+			ret =  (meta->sm.FsBlockType&0x3F);
+			break;
+		case META_TYPE_BOS:
+			ret =  (meta->bos.FsBlockType&0x3F);
+			break;
+		case META_TYPE_BG:
+			ret =  (meta->bg.FsBlockType&0x3F);
+			break;
+	}
+	return ret;
+}
+
+unsigned char xenon_nandfs_GetBadBlockMark(METADATA* meta)
+{
+	unsigned char ret = 0;
+	
+	switch (nand.MetaType)
+	{
+		case META_TYPE_SM:
+			ret =  meta->sm.BadBlock;
+			break;
+		case META_TYPE_BOS:
+			ret =  meta->bos.BadBlock;
+			break;
+		case META_TYPE_BG:
+			ret =  meta->bg.BadBlock;
+			break;
+	}
+	return ret;
+}
+
+unsigned int xenon_nandfs_GetFsSize(METADATA* meta)
+{
+	unsigned int ret = 0;
+	
+	switch (nand.MetaType)
+	{
+		case META_TYPE_SM:
+			ret = ((meta->sm.FsSize0<<8)+meta->sm.FsSize1);
+			break;
+		case META_TYPE_BOS:
+			ret = (((meta->bos.FsSize0&0xFF)<<8)+(meta->bos.FsSize1&0xFF));
+			break;
+		case META_TYPE_BG:
+			ret = (((meta->bg.FsSize0&0xFF)<<8)+(meta->bg.FsSize1&0xFF));
+			break;
+	}
+	return ret;
+}
+
+unsigned int xenon_nandfs_GetFsFreepages(METADATA* meta)
+{
+	unsigned int ret = 0;
+	
+	switch (nand.MetaType)
+	{
+		case META_TYPE_SM:
+			ret =  meta->sm.FsPageCount;
+			break;
+		case META_TYPE_BOS:
+			ret =  meta->bos.FsPageCount;
+			break;
+		case META_TYPE_BG:
+			ret =  (meta->bg.FsPageCount * 4);
+			break;
+	}
+	return ret;
+}
+
+unsigned int xenon_nandfs_GetFsSequence(METADATA* meta)
+{
+	unsigned int ret = 0;
+	
+	switch (nand.MetaType)
+	{
+		case META_TYPE_SM:
+			ret =  (meta->sm.FsSequence0+(meta->sm.FsSequence1<<8)+(meta->sm.FsSequence2<<16));
+			break;
+		case META_TYPE_BOS:
+			ret =  (meta->bos.FsSequence0+(meta->bos.FsSequence1<<8)+(meta->bos.FsSequence2<<16));
+			break;
+		case META_TYPE_BG:
+			ret =  (meta->bg.FsSequence0+(meta->bg.FsSequence1<<8)+(meta->bg.FsSequence2<<16));
+			break;
+	}
+	return ret;
+}
+
+void xenon_nandfs_SetLBA(METADATA* meta, unsigned short lba)
+{
+	switch (nand.MetaType)
+	{
+		case META_TYPE_SM:
+			meta->sm.BlockID0 = (lba>>8)&0xF;
+			meta->sm.BlockID1 = lba&0xFF;
+			break;
+		case META_TYPE_BOS:
+			meta->bos.BlockID0 = (lba>>8)&0xF;
+			meta->bos.BlockID1 = lba&0xFF;
+			break;
+		case META_TYPE_BG:
+			meta->bg.BlockID0 = (lba>>8)&0xF;
+			meta->bg.BlockID1 = lba&0xFF;
+			break;
+	}
+}
+
+void xenon_nandfs_SetBlockType(METADATA* meta, unsigned char type)
+{
+	switch (nand.MetaType)
+	{
+		case META_TYPE_SM:
+			meta->sm.FsBlockType = type&0x3F;
+			break;
+		case META_TYPE_BOS:
+			meta->bos.FsBlockType = type&0x3F;
+			break;
+		case META_TYPE_BG:
+			meta->bg.FsBlockType = type&0x3F;
+			break;
+	}
+}
+
+void xenon_nandfs_SetFsSequence(METADATA* meta, unsigned int seq)
+{
+	switch (nand.MetaType)
+	{
+		case META_TYPE_SM:
+			meta->sm.FsSequence0 = seq&0xFF;
+			meta->sm.FsSequence1 = (seq>>8)&0xFF;
+			meta->sm.FsSequence2 = (seq>>16)&0xFF;
+			break;
+		case META_TYPE_BOS:
+			meta->bos.FsSequence0 = seq&0xFF;
+			meta->bos.FsSequence1 = (seq>>8)&0xFF;
+			meta->bos.FsSequence2 = (seq>>16)&0xFF;
+			break;
+		case META_TYPE_BG:
+			meta->bg.FsSequence0 = seq&0xFF;
+			meta->bg.FsSequence1 = (seq>>8)&0xFF;
+			meta->bg.FsSequence2 = (seq>>16)&0xFF;
+			break;
+	}
+}
+
+void xenon_nandfs_SetBadBlockMark(METADATA* meta, unsigned char mark)
+{
+	switch (nand.MetaType)
+	{
+		case META_TYPE_SM:
+			meta->sm.BadBlock = mark;
+			break;
+		case META_TYPE_BOS:
+			meta->bos.BadBlock = mark;
+			break;
+		case META_TYPE_BG:
+			meta->bg.BadBlock = mark;
+			break;
+	}
+}
+
+void xenon_nandfs_UnpackMeta(METADATA* meta, unsigned char type, META_FIELDS* f)
+{
+	memset(f, 0, sizeof(META_FIELDS));
+	switch (type)
+	{
+		case META_TYPE_SM:
+			f->LBA = ((meta->sm.BlockID0&0xF)<<8)+meta->sm.BlockID1;
+			f->Sequence = meta->sm.FsSequence0+(meta->sm.FsSequence1<<8)+(meta->sm.FsSequence2<<16);
+			f->Sequence3 = meta->sm.FsSequence3;
+			f->BadBlock = meta->sm.BadBlock;
+			f->FsSize0 = meta->sm.FsSize0;
+			f->FsSize1 = meta->sm.FsSize1;
+			f->FsPageCount = meta->sm.FsPageCount;
+			f->BlockType = meta->sm.FsBlockType;
+			break;
+		case META_TYPE_BOS:
+			f->LBA = ((meta->bos.BlockID0&0xF)<<8)+meta->bos.BlockID1;
+			f->Sequence = meta->bos.FsSequence0+(meta->bos.FsSequence1<<8)+(meta->bos.FsSequence2<<16);
+			f->Sequence3 = meta->bos.FsSequence3;
+			f->BadBlock = meta->bos.BadBlock;
+			f->FsSize0 = meta->bos.FsSize0;
+			f->FsSize1 = meta->bos.FsSize1;
+			f->FsPageCount = meta->bos.FsPageCount;
+			f->BlockType = meta->bos.FsBlockType;
+			break;
+		case META_TYPE_BG:
+			f->LBA = ((meta->bg.BlockID0&0xF)<<8)+meta->bg.BlockID1;
+			f->Sequence = meta->bg.FsSequence0+(meta->bg.FsSequence1<<8)+(meta->bg.FsSequence2<<16);
+			f->BadBlock = meta->bg.BadBlock;
+			f->FsSize0 = meta->bg.FsSize0;
+			f->FsSize1 = meta->bg.FsSize1;
+			f->FsPageCount = meta->bg.FsPageCount;
+			f->BlockType = meta->bg.FsBlockType;
+			break;
+	}
+}
+
+// ECC bytes are left zero, the caller sets them once the page is complete; a bad block
+// only carries its mark, the rest of its spare stays erased and gets no ECC
+void xenon_nandfs_PackMeta(META_FIELDS* f, unsigned char type, METADATA* meta)
+{
+	bool bad = (f->BadBlock != 0xFF);
+
+	memset(meta, bad ? 0xFF : 0, sizeof(METADATA));
+	switch (type)
+	{
+		case META_TYPE_SM:
+			meta->sm.BadBlock = f->BadBlock;
+			if(bad)
+				break;
+			meta->sm.BlockID0 = (f->LBA>>8)&0xF;
+			meta->sm.BlockID1 = f->LBA&0xFF;
+			meta->sm.FsSequence0 = f->Sequence&0xFF;
+			meta->sm.FsSequence1 = (f->Sequence>>8)&0xFF;
+			meta->sm.FsSequence2 = (f->Sequence>>16)&0xFF;
+			meta->sm.FsSequence3 = f->Sequence3;
+			meta->sm.FsSize0 = f->FsSize0;
+			meta->sm.FsSize1 = f->FsSize1;
+			meta->sm.FsPageCount = f->FsPageCount;
+			meta->sm.FsBlockType = f->BlockType&0x3F;
+			break;
+		case META_TYPE_BOS:
+			meta->bos.BadBlock = f->BadBlock;
+			if(bad)
+				break;
+			meta->bos.BlockID0 = (f->LBA>>8)&0xF;
+			meta->bos.BlockID1 = f->LBA&0xFF;
+			meta->bos.FsSequence0 = f->Sequence&0xFF;
+			meta->bos.FsSequence1 = (f->Sequence>>8)&0xFF;
+			meta->bos.FsSequence2 = (f->Sequence>>16)&0xFF;
+			meta->bos.FsSequence3 = f->Sequence3;
+			meta->bos.FsSize0 = f->FsSize0;
+			meta->bos.FsSize1 = f->FsSize1;
+			meta->bos.FsPageCount = f->FsPageCount;
+			meta->bos.FsBlockType = f->BlockType&0x3F;
+			break;
+		case META_TYPE_BG:
+			meta->bg.BadBlock = f->BadBlock;
+			if(bad)
+				break;
+			meta->bg.BlockID0 = (f->LBA>>8)&0xF;
+			meta->bg.BlockID1 = f->LBA&0xFF;
+			meta->bg.FsSequence0 = f->Sequence&0xFF;
+			meta->bg.FsSequence1 = (f->Sequence>>8)&0xFF;
+			meta->bg.FsSequence2 = (f->Sequence>>16)&0xFF;
+			meta->bg.FsSize0 = f->FsSize0;
+			meta->bg.FsSize1 = f->FsSize1;
+			meta->bg.FsPageCount = f->FsPageCount;
+			meta->bg.FsBlockType = f->BlockType&0x3F;
+			break;
+	}
+}
+
+// sub is the small block inside the big block, returns false for a block type the target can't express
+bool xenon_nandfs_TranscodeMeta(METADATA* src, unsigned char srcType, METADATA* dst, unsigned char dstType, unsigned int sub)
+{
+	META_FIELDS f;
+	unsigned int used;
+	bool ret = true;
+
+	xenon_nandfs_UnpackMeta(src, srcType, &f);
+
+	if((srcType != META_TYPE_BG) && (dstType == META_TYPE_BG))
+	{
+		f.LBA >>= 3;
+		if(f.BlockType == MOBILE_FSROOT)
+		{
+			// FS spans the whole system area: FSStartBlock = BB_SYSTEM_BLOCKS - FsPageCount - (FsSize0<<2) = 0
+			f.BlockType = BB_MOBILE_FSROOT;
+			f.FsSize1 = 0;
+			f.FsSize0 = (BB_SYSTEM_BLOCKS - CONFIG_BLOCKS)>>2;
+			f.FsPageCount = CONFIG_BLOCKS;
+		}
+		else if((f.BlockType > MOBILE_BASE) && (f.BlockType < MOBILE_END))
+		{
+			used = MOBILE_PB - f.FsPageCount;
+			f.FsPageCount = ((BB_MOBILE_PB*BB_MOBILE_MULTI) - used) / BB_MOBILE_MULTI;
+		}
+		f.Sequence3 = 0;
+	}
+	else if((srcType == META_TYPE_BG) && (dstType != META_TYPE_BG))
+	{
+		f.LBA = (f.LBA<<3) + sub;
+		if(f.BlockType == BB_MOBILE_FSROOT)
+		{
+			f.BlockType = MOBILE_FSROOT;
+			f.FsSize0 = 0;
+			f.FsSize1 = 0;
+			f.FsPageCount = 0;
+		}
+		else if(f.BlockType == MOBILE_FSROOT)
+			ret = false; // MobileA has no small block id, it would turn into an FSRoot
+		else if((f.BlockType > MOBILE_BASE) && (f.BlockType < MOBILE_END))
+		{
+			used = (BB_MOBILE_PB - f.FsPageCount) * BB_MOBILE_MULTI;
+			f.FsPageCount = (used >= MOBILE_PB) ? 0 : (MOBILE_PB - used);
+		}
+	}
+
+	xenon_nandfs_PackMeta(&f, dstType, dst);
+	return ret;
+}
+
+// returns true if the leading hash matches the rest of the anchor header
+bool xenon_nandfs_CheckMMCAnchorSha(unsigned char* buf)
+{
+	unsigned char* data = buf;
+	unsigned char sha[SHA_DIGEST_LEN];
+
+	xenon_nandfs_Sha(&data[MMC_ANCHOR_HASH_LEN], (MMC_ANCHOR_SIZE-MMC_ANCHOR_HASH_LEN), sha);
+	return (memcmp(sha, data, MMC_ANCHOR_HASH_LEN) == 0);
+}
+
+unsigned short xenon_nandfs_GetMMCAnchorVer(unsigned char* buf)
+{
+	unsigned char* data = buf;
+	unsigned short tmp = (data[MMC_ANCHOR_VERSION_POS]<<8|data[MMC_ANCHOR_VERSION_POS+1]);
+
+	return tmp;
+}
+
+unsigned short xenon_nandfs_GetMMCMobileBlock(unsigned char* buf, unsigned char mobi)
+{
+	unsigned char* data = buf;
+	unsigned char mob = mobi - MOBILE_BASE;
+	unsigned char offset = MMC_ANCHOR_MOBI_START+(mob*MMC_ANCHOR_MOBI_SIZE);
+	unsigned short tmp = data[offset]<<8|data[offset+1];
+	
+	return tmp;
+}
+
+void xenon_nandfs_SetMMCAnchorSha(unsigned char* buf)
+{
+	xenon_nandfs_Sha(&buf[MMC_ANCHOR_HASH_LEN], (MMC_ANCHOR_SIZE-MMC_ANCHOR_HASH_LEN), buf);
+}
+
+void xenon_nandfs_SetMMCAnchorVer(unsigned char* buf, unsigned short ver)
+{
+	buf[MMC_ANCHOR_VERSION_POS] = (ver>>8)&0xFF;
+	buf[MMC_ANCHOR_VERSION_POS+1] = ver&0xFF;
+}
+
+void xenon_nandfs_SetMMCMobileBlock(unsigned char* buf, unsigned char mobi, unsigned short block)
+{
+	unsigned char offset = MMC_ANCHOR_MOBI_START+((mobi - MOBILE_BASE)*MMC_ANCHOR_MOBI_SIZE);
+
+	buf[offset] = (block>>8)&0xFF;
+	buf[offset+1] = block&0xFF;
+}
+
+void xenon_nandfs_SetMMCMobileSize(unsigned char* buf, unsigned char mobi, unsigned short size)
+{
+	unsigned char offset = MMC_ANCHOR_MOBI_START+((mobi - MOBILE_BASE)*MMC_ANCHOR_MOBI_SIZE)+0x2;
+
+	buf[offset] = size&0xFF; // stored byteswapped, see GetMMCMobileSize
+	buf[offset+1] = (size>>8)&0xFF;
+}
+
+unsigned short xenon_nandfs_GetMMCMobileSize(unsigned char* buf, unsigned char mobi)
+{
+	unsigned char* data = buf;
+	unsigned char mob = mobi - MOBILE_BASE;
+	unsigned char offset = MMC_ANCHOR_MOBI_START+(mob*MMC_ANCHOR_MOBI_SIZE)+0x2;
+	unsigned short tmp = data[offset]<<8|data[offset+1];
+	
+	return __builtin_bswap16(tmp);
+}
+
+bool xenon_nandfs_CheckECC(PAGEDATA* pdata)
+{
+	unsigned char ecd[4];
+	unsigned char* meta = (unsigned char*)&pdata->Meta;
+
+	STAT_ECC_PAGE();
+	xenon_nandfs_CalcECC((unsigned int*)pdata->User, ecd);
+	if ((ecd[0] == meta[0xC]) &&
+		(ecd[1] == meta[0xD]) &&
+		(ecd[2] == meta[0xE]) &&
+		(ecd[3] == meta[0xF]))
+		return 0;
+	return 1;
+}
+
+// returns the small block holding a cluster, relative to FSStartBlock
+unsigned int xenon_nandfs_GetClusterBlock(unsigned int cluster)
+{
+	unsigned int block = cluster; // small block clusters are the blocks themselves
+
+	if(nand.isBB)
+	{
+		if(cluster >= dumpdata.LBACount)
+			return INVALID;
+		block = (dumpdata.LBAMap[cluster]<<3); // to SmallBlock
+		block -= (dumpdata.FSStartBlock<<3); // relative Adress
+		block += (cluster % 8); // smallBlock inside bigBlock
+	}
+	return block;
+}
+
+// reads the user data of one FS cluster
+int xenon_nandfs_ReadCluster(unsigned char* buf, unsigned int cluster)
+{
+	unsigned char spare[SMALL_BLOCK_PAGES*0x10];
+	unsigned int block = xenon_nandfs_GetClusterBlock(cluster);
+
+	if(block == (unsigned int)INVALID)
+	{
+		memset(buf, 0, FS_CLUSTER_SIZE);
+		return 1;
+	}
+	if(nand.MMC)
+		xenon_sfc_ReadMapData(buf, block*FS_CLUSTER_SIZE, FS_CLUSTER_SIZE);
+	else
+		xenon_sfc_ReadSmallBlockSeparate(buf, spare, (dumpdata.FSStartBlock<<3) + block);
+	return 0;
+}
+
+int xenon_nandfs_ExtractFsEntry(void)
+{
 	unsigned int i, k;
 	unsigned int fsBlock, realBlock;
 	unsigned int fsFileSize;
-	unsigned int fsStartBlock = dumpdata.FSStartBlock<<3; // Convert to Small Block
 //	FS_TIME_STAMP timeSt;
 	
-	dumpdata.pFSRootBufShort = (unsigned short*)dumpdata.FSRootBuf;
+	for(i=0; i<MAX_FSENT; i++)
+	{
+		if(dumpdata.FsEnt[i]->FileName[0] == 0)
+			continue;
+
+		printk(KERN_INFO "file: %s ", dumpdata.FsEnt[i]->FileName);
+		for(k=0; k< (22-strlen(dumpdata.FsEnt[i]->FileName)); k++)
+		{
+			printk(KERN_INFO " ");
+		}
+
+		fsBlock = __builtin_bswap16(dumpdata.FsEnt[i]->StartCluster);
+		fsFileSize = __builtin_bswap32(dumpdata.FsEnt[i]->ClusterSz);
+
+		printk(KERN_INFO "start: %04x size: %08x stamp: %08x\n", fsBlock, fsFileSize, (unsigned int)__builtin_bswap32(dumpdata.FsEnt[i]->TypeTime));
+
+		// extract the file
+		if(dumpdata.FsEnt[i]->FileName[0] == FS_ENT_ERASED){ // file is erased but still in the record
+			printk(KERN_INFO "   erased still has entry???");
+			continue;
+		}
+			
+		realBlock = xenon_nandfs_GetClusterBlock(fsBlock);
+
+		while(fsFileSize > FS_CLUSTER_SIZE)
+		{
+#ifdef DEBUG
+			printk(KERN_INFO "%04x:%04x, ", fsBlock, realBlock);
+#endif
+#ifdef WRITE_OUT
+			appendBlockToFile(dumpdata.FsEnt[i]->FileName, fsBlock, FS_CLUSTER_SIZE);
+#endif
+			fsFileSize = fsFileSize-FS_CLUSTER_SIZE;
+			fsBlock = __builtin_bswap16(dumpdata.pFSRootBufShort[fsBlock]); // gets next block
+			if(fsBlock >= FS_CHAIN_SPECIAL)
+				break;
+			realBlock = xenon_nandfs_GetClusterBlock(fsBlock);
+		}
+		if((fsFileSize > 0)&&(fsBlock<FS_CHAIN_FREE))
+		{
+#ifdef DEBUG
+			printk(KERN_INFO "%04x:%04x, ", fsBlock, realBlock);
+#endif
+#ifdef WRITE_OUT
+			appendBlockToFile(dumpdata.FsEnt[i]->FileName, fsBlock, fsFileSize);
+#endif
+		}
+		else
+			printk(KERN_INFO "** Couldn't write file tail! %04x:%04x, ", fsBlock, realBlock);
+	printk(KERN_INFO "\n\n");
+	} 
+	return 0;
+}
+
+// blocks that can hold FSRoot and Mobiles, everything past them is MU on big block
+unsigned int xenon_nandfs_GetSystemBlocks(void)
+{
+	if(nand.isBB && (nand.BlocksCount > (BB_SYSTEM_AREA / nand.BlockSz)))
+		return BB_SYSTEM_AREA / nand.BlockSz;
+	return nand.BlocksCount;
+}
+
+int xenon_nandfs_ParseLBA(void)
+{
+	int block, spare;
+	unsigned char* userbuf;
+	unsigned char* sparebuf;
+	int FsStart = dumpdata.FSStartBlock;
+	int FsSize = dumpdata.FSSize;
+	unsigned int lba_cnt=0;
+	unsigned short lba;
+	METADATA *meta;
+
+	if(FsStart >= xenon_nandfs_GetSystemBlocks())
+		FsSize = 0;
+	else if(FsStart + FsSize > xenon_nandfs_GetSystemBlocks())
+		FsSize = xenon_nandfs_GetSystemBlocks() - FsStart;
+
+	if(dumpdata.LBAMap)
+		vfree(dumpdata.LBAMap);
+	if(nand.MMC)
+		dumpdata.LBACount = nand.BlocksCount;
+	else if(nand.isBB)
+		dumpdata.LBACount = FsSize * (nand.BlockSz / SMALL_BLOCK_SZ);
+	else
+		dumpdata.LBACount = FsSize;
+	dumpdata.LBAMap = (unsigned short *)vmalloc(dumpdata.LBACount * sizeof(unsigned short));
+	if(dumpdata.LBAMap == NULL)
+	{
+		dumpdata.LBACount = 0;
+		return 1;
+	}
+
+	userbuf = (unsigned char *)vmalloc(nand.BlockSz);
+	sparebuf = (unsigned char *)vmalloc(nand.MetaSz*nand.PagesInBlock);
+		
+	if(nand.MMC)
+	{
+		for(block=0;block<nand.BlocksCount;block++)
+		{
+			dumpdata.LBAMap[lba_cnt] = block; // Hail to the phison, just this one time
+			lba_cnt++;
+		}
+	}
+	else
+	{
+		for(block=FsStart;block<(FsStart+FsSize);block++)
+		{
+			xenon_sfc_ReadBlockSeparate(userbuf, sparebuf, block);
+			if(nand.isBB)
+			{
+				for(spare=0;spare<(nand.MetaSz*nand.PagesInBlock);spare+=(nand.MetaSz*32))
+				{
+					meta = (METADATA*)&sparebuf[spare]; // 8 SmBlocks inside BgBlock for LBA
+					lba = xenon_nandfs_GetLBA(meta);
+					dumpdata.LBAMap[lba_cnt] = lba;
+					lba_cnt++;
+				}	
+			}
+			else
+			{
+				meta = (METADATA*)sparebuf;
+				lba = xenon_nandfs_GetLBA(meta);
+				dumpdata.LBAMap[lba_cnt] = lba;
+				lba_cnt++;
+			}
+		}
+	}
+	printk(KERN_INFO "Read 0x%x LBA entries\n",lba_cnt);
+	vfree(userbuf);
+	vfree(sparebuf);
+	return 0;
+}
+
+int xenon_nandfs_SplitFsRootBuf()
+{
+	int block = dumpdata.FSRootBlock;
+	unsigned int i, j, root_off, file_off, ttl_off;
+	unsigned char* data = (unsigned char *)vmalloc(nand.BlockSz);
+	
+	if(nand.MMC)
+		xenon_sfc_ReadMapData(data, (block*nand.BlockSz), nand.BlockSz);
+	else
+		xenon_sfc_ReadBlockUser(data, block);
 	
-	for(i=0; i<256; i++)
+	root_off = 0;
+	file_off = 0;
+	ttl_off = 0;
+	for(i=0; i<16; i++) // copy alternating 512 bytes into each buf
+	{
+		for(j=0; j<nand.PageSz; j++)
+		{
+			dumpdata.FSRootBuf[root_off+j] = data[ttl_off+j];
+			dumpdata.FSRootFileBuf[file_off+j] = data[ttl_off+j+512];
+		}
+		root_off += nand.PageSz;
+		file_off += nand.PageSz;
+		ttl_off  += (nand.PageSz*2);
+	}
+
+	dumpdata.pFSRootBufShort = (unsigned short*)dumpdata.FSRootBuf;
+	for(i=0; i<MAX_FSENT; i++)
+		dumpdata.FsEnt[i] = (FS_ENT*)&dumpdata.FSRootFileBuf[i*sizeof(FS_ENT)];
+
+#ifdef FSROOT_WRITE_OUT
+	writeToFile("fsrootbuf.bin", dumpdata.FSRootBuf, FSROOT_SIZE);
+	writeToFile("fsrootfilebuf.bin", dumpdata.FSRootFileBuf, FSROOT_SIZE);
+#endif
+	vfree(data);
+	return 0;
+}
+
+unsigned int xenon_nandfs_GetClusterCount(void)
+{
+	unsigned int clusters;
+
+	if(nand.MMC)
+		clusters = nand.BlocksCount;
+	else if(nand.isBB)
+		clusters = dumpdata.FSSize<<3; // 8 SmBlocks inside BgBlock
+	else
+		clusters = dumpdata.FSSize;
+
+	if(nand.isBB && (clusters > dumpdata.LBACount))
+		clusters = dumpdata.LBACount;
+	if(clusters > FS_CHAIN_COUNT)
+		clusters = FS_CHAIN_COUNT;
+	return clusters;
+}
+
+// one sweep over the chain table, every cluster gets claimed by at most one walk
+int xenon_nandfs_CheckFs(FSCK_RESULT* res)
+{
+	unsigned int i, cluster, next, len, expected, block, problems = 0;
+	unsigned short* owner;
+	FS_ENT* ent;
+
+	memset(res, 0, sizeof(FSCK_RESULT));
+	res->Clusters = xenon_nandfs_GetClusterCount();
+
+	owner = (unsigned short *)vmalloc(res->Clusters * sizeof(unsigned short));
+	if(!owner)
+		return -1;
+	memset(owner, 0xFF, res->Clusters * sizeof(unsigned short));
+
+	for(i=0; i<MAX_FSENT; i++)
+	{
+		ent = dumpdata.FsEnt[i];
+		if((ent->FileName[0] == 0) || (ent->FileName[0] == FS_ENT_ERASED))
+			continue;
+
+		res->Files++;
+		expected = (__builtin_bswap32(ent->ClusterSz) + FS_CLUSTER_SIZE - 1) / FS_CLUSTER_SIZE;
+		cluster = __builtin_bswap16(ent->StartCluster);
+		len = 0;
+
+		while(1)
+		{
+			if(cluster >= res->Clusters)
+			{
+				res->EntFlags[i] |= FSCK_TRUNCATED; // points past the table or at a marker
+				break;
+			}
+			if(owner[cluster] == i)
+			{
+				res->EntFlags[i] |= FSCK_CYCLIC;
+				break;
+			}
+			if(owner[cluster] != 0xFFFF)
+			{
+				res->EntFlags[i] |= FSCK_CROSSLINKED;
+				res->EntFlags[owner[cluster]] |= FSCK_CROSSLINKED;
+				break;
+			}
+			owner[cluster] = i;
+			len++;
+
+			next = __builtin_bswap16(dumpdata.pFSRootBufShort[cluster]);
+			if(next == FS_CHAIN_END)
+				break;
+			if(next == FS_CHAIN_FREE)
+			{
+				res->EntFlags[i] |= FSCK_TRUNCATED;
+				break;
+			}
+			cluster = next;
+		}
+
+		if(!(res->EntFlags[i] & (FSCK_TRUNCATED|FSCK_CYCLIC|FSCK_CROSSLINKED)) && (len != expected))
+			res->EntFlags[i] |= FSCK_BADLENGTH;
+	}
+
+	for(cluster=0; cluster<res->Clusters; cluster++)
+	{
+		next = __builtin_bswap16(dumpdata.pFSRootBufShort[cluster]);
+		block = xenon_nandfs_GetClusterBlock(cluster);
+		if(nand.isBB)
+			block = (block + (dumpdata.FSStartBlock<<3))>>3;
+		if(owner[cluster] != 0xFFFF)
+			res->Used++;
+		else if(block == dumpdata.FSRootBlock)
+			res->Used++; // the active FSRoot itself
+		else if(next == FS_CHAIN_FREE)
+			res->Free++;
+		else if((next < FS_CHAIN_SPECIAL) || (next == FS_CHAIN_END))
+			res->Orphaned++; // allocated, but no entry reaches it
+	}
+
+	for(i=0; i<MAX_FSENT; i++)
+	{
+		if(res->EntFlags[i] & FSCK_CROSSLINKED)
+			res->CrossLinked++;
+		if(res->EntFlags[i] & FSCK_CYCLIC)
+			res->Cyclic++;
+		if(res->EntFlags[i] & FSCK_TRUNCATED)
+			res->Truncated++;
+		if(res->EntFlags[i] & FSCK_BADLENGTH)
+			res->BadLength++;
+		if(res->EntFlags[i])
+			problems++;
+	}
+
+	vfree(owner);
+	return problems + res->Orphaned;
+}
+
+#define ALLOC_BIT(map, c)	((map[(c)>>5] >> ((c)&31)) & 1u)
+
+static inline void _xenon_nandfs_AllocMark(FS_ALLOC* a, unsigned int c, bool free)
+{
+	if(free == ALLOC_BIT(a->Free, c))
+		return;
+	if(free)
+	{
+		a->Free[c>>5] |= (1u << (c&31));
+		a->FreeCount++;
+	}
+	else
+	{
+		a->Free[c>>5] &= ~(1u << (c&31));
+		a->FreeCount--;
+	}
+}
+
+// the bitmap is built here once, afterwards every chain edit goes through AllocSetChain
+bool xenon_nandfs_AllocInit(FS_ALLOC* a, unsigned short* chain, unsigned int clusters)
+{
+	unsigned int c, words = (clusters + 31) >> 5;
+
+	memset(a, 0, sizeof(FS_ALLOC));
+	a->Clusters = clusters;
+	a->Chain = chain;
+	a->Free = (unsigned int *)vmalloc(words * sizeof(unsigned int));
+	a->Reserved = (unsigned int *)vmalloc(words * sizeof(unsigned int));
+	a->Wear = (unsigned int *)vmalloc(clusters * sizeof(unsigned int));
+	if((a->Free == NULL) || (a->Reserved == NULL) || (a->Wear == NULL))
+	{
+		xenon_nandfs_AllocDone(a);
+		return false;
+	}
+	memset(a->Free, 0, words * sizeof(unsigned int));
+	memset(a->Reserved, 0, words * sizeof(unsigned int));
+	memset(a->Wear, 0, clusters * sizeof(unsigned int));
+	for(c=0; c<clusters; c++)
+		if(chain[c] == FS_CHAIN_FREE)
+			_xenon_nandfs_AllocMark(a, c, true);
+	return true;
+}
+
+void xenon_nandfs_AllocDone(FS_ALLOC* a)
+{
+	if(a->Free)
+		vfree(a->Free);
+	if(a->Reserved)
+		vfree(a->Reserved);
+	if(a->Wear)
+		vfree(a->Wear);
+	if(a->Claim)
+		vfree(a->Claim);
+	memset(a, 0, sizeof(FS_ALLOC));
+}
+
+// GetClusterBlock with the claims of the allocator, a claimed slot holds the cluster of its position
+unsigned int xenon_nandfs_AllocClusterBlock(FS_ALLOC* a, unsigned int cluster)
+{
+	if(a->Claim && (cluster < a->Clusters) && (a->Claim[cluster] != (unsigned int)INVALID))
+		return cluster;
+	return xenon_nandfs_GetClusterBlock(cluster);
+}
+
+// every rewrite of a block stamps the current FsSequence into its spare, so a block that
+// carries a high sequence has been erased more often than one still holding an early one
+void xenon_nandfs_AllocLoadWear(FS_ALLOC* a)
+{
+	unsigned char page[SMALL_BLOCK_SZ_PHYS / SMALL_BLOCK_PAGES];
+	METADATA* meta = (METADATA*)&page[nand.PageSz];
+	unsigned int c, block, fsBase;
+
+	if(nand.MMC)
+		return; // no spare to learn from, all clusters look alike
+	fsBase = nand.isBB ? (dumpdata.FSStartBlock<<3) : 0;
+	for(c=0; c<a->Clusters; c++)
+	{
+		block = xenon_nandfs_AllocClusterBlock(a, c);
+		if((block == (unsigned int)INVALID) || ((block + fsBase) >= (nand.SizeDump / SMALL_BLOCK_SZ_PHYS)))
+			continue;
+		// only the first page's spare is needed, not the block
+		if(xenon_sfc_ReadPagePhy(page, (block + fsBase) * SMALL_BLOCK_PAGES) & STATUS_BB_ER)
+			continue;
+		if(xenon_sfc_ClassifyBlock((unsigned char*)meta, NULL, sizeof(METADATA), sizeof(METADATA), 0) & BLKCLS_ERASED)
+			continue;
+		a->Wear[c] = xenon_nandfs_GetFsSequence(meta);
+	}
+}
+
+// keeps the active FSRoot, the Mobiles, block 0 and everything from the anchors on out of reach
+void xenon_nandfs_AllocReserveSystem(FS_ALLOC* a)
+{
+	unsigned int c, i, unit, block, size, rootUnits, fsBase, sysEnd;
+
+	rootUnits = nand.isBB ? 8 : 1;
+	fsBase = nand.isBB ? (dumpdata.FSStartBlock<<3) : 0;
+	sysEnd = (nand.ConfigBlock - (nand.MMC ? MMC_ANCHOR_BLOCKS : 0)) * rootUnits;
+	for(c=0; c<a->Clusters; c++)
+	{
+		unit = xenon_nandfs_AllocClusterBlock(a, c);
+		if(unit == (unsigned int)INVALID)
+		{
+			xenon_nandfs_AllocReserve(a, c);
+			continue;
+		}
+		unit += fsBase;
+		block = unit / rootUnits;
+		if((unit == 0) || (unit >= sysEnd) || (block == dumpdata.FSRootBlock))
+		{
+			xenon_nandfs_AllocReserve(a, c);
+			continue;
+		}
+		for(i=0; i<MAX_MOBILE; i++)
+		{
+			if(dumpdata.Mobile[i].Block == 0)
+				continue;
+			size = nand.MMC ? ((dumpdata.Mobile[i].Size + nand.BlockSz - 1) / nand.BlockSz) : 1;
+			if((block >= dumpdata.Mobile[i].Block) && (block < (dumpdata.Mobile[i].Block + size)))
+				xenon_nandfs_AllocReserve(a, c);
+		}
+	}
+}
+
+bool xenon_nandfs_AllocIsFree(FS_ALLOC* a, unsigned int cluster)
+{
+	return (cluster < a->Clusters) && ALLOC_BIT(a->Free, cluster);
+}
+
+void xenon_nandfs_AllocReserve(FS_ALLOC* a, unsigned int cluster)
+{
+	if(cluster >= a->Clusters)
+		return;
+	a->Reserved[cluster>>5] |= (1u << (cluster&31));
+	_xenon_nandfs_AllocMark(a, cluster, false);
+}
+
+void xenon_nandfs_AllocSetChain(FS_ALLOC* a, unsigned int cluster, unsigned short next)
+{
+	if(cluster >= a->Clusters)
+		return;
+	a->Chain[cluster] = next;
+	_xenon_nandfs_AllocMark(a, cluster, (next == FS_CHAIN_FREE) && !ALLOC_BIT(a->Reserved, cluster));
+}
+
+// first cluster at or after c whose free bit equals want, whole words are skipped
+static unsigned int _xenon_nandfs_AllocNext(FS_ALLOC* a, unsigned int c, unsigned int want)
+{
+	unsigned int skip = want ? 0 : 0xFFFFFFFF;
+
+	while(c < a->Clusters)
+	{
+		if(((c&31) == 0) && (a->Free[c>>5] == skip))
+		{
+			c += 32;
+			continue;
+		}
+		if(ALLOC_BIT(a->Free, c) == want)
+			return c;
+		c++;
+	}
+	return a->Clusters;
+}
+
+// a free run that takes need whole with the least wear, ties go to the tightest fit so
+// long runs stay intact; without one, the longest run so the chain has few extents
+static unsigned int _xenon_nandfs_AllocFindRun(FS_ALLOC* a, unsigned int need, unsigned int* runLen)
+{
+	unsigned int c, end, i, wear, best = INVALID, bestLen = 0, bestWear = 0;
+	bool fit = false;
+
+	for(c = _xenon_nandfs_AllocNext(a, 0, 1); c < a->Clusters; c = _xenon_nandfs_AllocNext(a, end, 1))
+	{
+		end = _xenon_nandfs_AllocNext(a, c, 0);
+		if((end - c) >= need)
+		{
+			for(i=0, wear=0; i<need; i++)
+				wear += a->Wear[c+i];
+			if(!fit || (wear < bestWear) || ((wear == bestWear) && ((end - c) < bestLen)))
+			{
+				fit = true;
+				best = c;
+				bestLen = end - c;
+				bestWear = wear;
+			}
+		}
+		else if(!fit && ((end - c) > bestLen))
+		{
+			best = c;
+			bestLen = end - c;
+		}
+	}
+	*runLen = bestLen;
+	return best;
+}
+
+// links need clusters into a new chain, returns its first cluster or INVALID when space runs out
+unsigned int xenon_nandfs_AllocChain(FS_ALLOC* a, unsigned int need)
+{
+	unsigned int c, len, i, first = INVALID, last = INVALID;
+
+	if(need == 0)
+		return FS_CHAIN_END;
+	if(need > a->FreeCount)
+		return INVALID;
+	while(need > 0)
+	{
+		c = _xenon_nandfs_AllocFindRun(a, need, &len);
+		if(c == INVALID)
+			break;
+		if(len > need)
+			len = need;
+		for(i=c; i<(c+len); i++)
+		{
+			xenon_nandfs_AllocSetChain(a, i, FS_CHAIN_END);
+			if(last == INVALID)
+				first = i;
+			else
+				a->Chain[last] = i;
+			last = i;
+			a->Wear[i]++; // the block gets erased and written once more
+		}
+		need -= len;
+	}
+	return first;
+}
+
+// hands a whole chain back, returns the number of clusters released
+unsigned int xenon_nandfs_AllocFreeChain(FS_ALLOC* a, unsigned int cluster)
+{
+	unsigned int next, cnt = 0;
+
+	while((cluster < a->Clusters) && (a->Chain[cluster] != FS_CHAIN_FREE) && (cnt < a->Clusters))
+	{
+		next = a->Chain[cluster];
+		xenon_nandfs_AllocSetChain(a, cluster, FS_CHAIN_FREE);
+		cnt++;
+		if(next >= FS_CHAIN_SPECIAL)
+			break;
+		cluster = next;
+	}
+	return cnt;
+}
+
+// fills one small block of output, user data and spare interleaved like the dump
+void xenon_nandfs_BuildClusterBlock(unsigned char* out, unsigned char* tmpl, unsigned char* data, unsigned int cluster)
+{
+	unsigned int i;
+	PAGEDATA* page;
+	METADATA meta;
+
+	memset(&meta, 0, sizeof(METADATA));
+	if(nand.isBB)
+		xenon_nandfs_SetLBA(&meta, xenon_nandfs_GetLBA(&((PAGEDATA*)tmpl)->Meta)); // keep the BgBlock mapping
+	else
+		xenon_nandfs_SetLBA(&meta, cluster);
+	xenon_nandfs_SetBadBlockMark(&meta, 0xFF);
+
+	for(i=0; i<SMALL_BLOCK_PAGES; i++)
+	{
+		page = (PAGEDATA*)&out[i*sizeof(PAGEDATA)];
+		memcpy(page->User, &data[i*sizeof(page->User)], sizeof(page->User));
+		memcpy(&page->Meta, &meta, sizeof(METADATA));
+		xenon_nandfs_SetECC(page);
+	}
+}
+
+void xenon_nandfs_BuildRootBlock(unsigned char* out, unsigned char* tmpl, unsigned char* root, unsigned int seq, unsigned int block)
+{
+	unsigned int i;
+	PAGEDATA* page;
+
+	for(i=0; i<SMALL_BLOCK_PAGES; i++)
+	{
+		page = (PAGEDATA*)&out[i*sizeof(PAGEDATA)];
+		if(root)
+			memcpy(page->User, &root[i*sizeof(page->User)], sizeof(page->User));
+		else
+			memcpy(page->User, &tmpl[i*sizeof(PAGEDATA)], sizeof(page->User));
+		memcpy(&page->Meta, &tmpl[(i*sizeof(PAGEDATA))+sizeof(page->User)], sizeof(METADATA)); // spare of the old root
+		xenon_nandfs_SetFsSequence(&page->Meta, seq);
+		xenon_nandfs_SetLBA(&page->Meta, nand.isBB ? (block>>3) : block); // the root maps onto itself
+		xenon_nandfs_SetECC(page);
+	}
+}
+
+// FSRoot, chain table and FS_ENT table interleaved per page, chain in host order
+void xenon_nandfs_BuildRoot(unsigned char* root, unsigned short* chain, FS_ENT* ents)
+{
+	unsigned int c, k;
+
+	memset(root, 0, FSROOT_SIZE*2);
+	for(c=0; c<FS_CHAIN_COUNT; c++)
+	{
+		root[((c*2/nand.PageSz)*nand.PageSz*2)+((c*2)%nand.PageSz)] = (chain[c]>>8)&0xFF;
+		root[((c*2/nand.PageSz)*nand.PageSz*2)+((c*2)%nand.PageSz)+1] = chain[c]&0xFF;
+	}
+	for(k=0; k<(MAX_FSENT*sizeof(FS_ENT)); k+=sizeof(FS_ENT))
+		memcpy(&root[((k/nand.PageSz)*nand.PageSz*2)+nand.PageSz+(k%nand.PageSz)], &ents[k/sizeof(FS_ENT)], sizeof(FS_ENT));
+}
+
+// staged clusters sharing a programmable unit, a BgBlock on big block NAND and the
+// BlockSzPhys window of consecutive blocks on MMC
+static unsigned int _xenon_nandfs_StageGroup(unsigned int unit)
+{
+	if(nand.MMC)
+		return unit / (nand.BlockSzPhys / nand.BlockSz);
+	return nand.isBB ? ((unit + (dumpdata.FSStartBlock<<3))>>3) : unit;
+}
+
+// keeps the user data of a cluster in memory, nothing reaches the flash before the commit
+static int _xenon_nandfs_UpdateStage(FS_UPDATE* up, unsigned int cluster, unsigned char* data)
+{
+	if(xenon_nandfs_AllocClusterBlock(&up->Alloc, cluster) == (unsigned int)INVALID)
+		return FS_ERR_IO;
+	if(up->Staged[cluster] == NULL)
+	{
+		up->Staged[cluster] = (unsigned char *)vmalloc(FS_CLUSTER_SIZE);
+		if(up->Staged[cluster] == NULL)
+			return FS_ERR_IO;
+		up->StagedCount++;
+	}
+	memcpy(up->Staged[cluster], data, FS_CLUSTER_SIZE);
+	return 0;
+}
+
+static void _xenon_nandfs_UpdateUnstage(FS_UPDATE* up, unsigned int cluster)
+{
+	if(up->Staged[cluster] == NULL)
+		return;
+	vfree(up->Staged[cluster]);
+	up->Staged[cluster] = NULL;
+	up->StagedCount--;
+}
+
+// staged data wins over what the flash still holds
+static void _xenon_nandfs_UpdateReadCluster(FS_UPDATE* up, unsigned char* buf, unsigned int cluster)
+{
+	if(up->Staged[cluster])
+		memcpy(buf, up->Staged[cluster], FS_CLUSTER_SIZE);
+	else
+		xenon_nandfs_ReadCluster(buf, cluster);
+}
+
+// programs every staged cluster, each (Bg)Block once whatever number of its clusters changed,
+// the rest of it is rewritten as it was; on MMC runs of consecutive blocks go out in one write
+static int _xenon_nandfs_UpdateFlush(FS_UPDATE* up)
+{
+	unsigned int c, c2, g, sub, first, last, filled, groupUnits;
+	unsigned int* units;
+	METADATA* meta;
+	int ret = 0;
+
+	units = (unsigned int *)vmalloc(up->Alloc.Clusters * sizeof(unsigned int));
+	if(units == NULL)
+		return FS_ERR_IO;
+	for(c=0; c<up->Alloc.Clusters; c++)
+		units[c] = up->Staged[c] ? xenon_nandfs_AllocClusterBlock(&up->Alloc, c) : INVALID;
+	groupUnits = nand.MMC ? (nand.BlockSzPhys / nand.BlockSz) : 1;
+
+	for(c=0; (c<up->Alloc.Clusters) && !ret; c++)
+	{
+		if(up->Staged[c] == NULL)
+			continue;
+		g = _xenon_nandfs_StageGroup(units[c]);
+		if(nand.MMC)
+		{
+			// slot k of BlockBuf is block g*groupUnits+k
+			filled = 0;
+			for(c2=c; c2<up->Alloc.Clusters; c2++)
+			{
+				if((up->Staged[c2] == NULL) || (_xenon_nandfs_StageGroup(units[c2]) != g))
+					continue;
+				sub = units[c2] % groupUnits;
+				memcpy(&up->BlockBuf[sub*nand.BlockSz], up->Staged[c2], FS_CLUSTER_SIZE);
+				filled |= 1u << sub;
+				_xenon_nandfs_UpdateUnstage(up, c2);
+			}
+			for(first=0; (first<groupUnits) && !ret; first=last)
+			{
+				for(; (first<groupUnits) && !(filled & (1u << first)); first++)
+					;
+				for(last=first; (last<groupUnits) && (filled & (1u << last)); last++)
+					;
+				if(last == first)
+					break;
+				up->Programs += last - first;
+				if(xenon_sfc_WriteBlocks(&up->BlockBuf[first*nand.BlockSz], (g*groupUnits)+first, last - first))
+					ret = FS_ERR_IO;
+			}
+			continue;
+		}
+
+		xenon_sfc_ReadBlock(up->BlockBuf, g);
+		for(c2=c; c2<up->Alloc.Clusters; c2++)
+		{
+			if((up->Staged[c2] == NULL) || (_xenon_nandfs_StageGroup(units[c2]) != g))
+				continue;
+			sub = nand.isBB ? ((units[c2] + (dumpdata.FSStartBlock<<3))&7) : 0;
+			// a claimed slot is still erased, it gets its LBA with the first data
+			meta = &((PAGEDATA*)&up->BlockBuf[sub*SMALL_BLOCK_SZ_PHYS])->Meta;
+			if(nand.isBB && (xenon_sfc_ClassifyBlock((unsigned char*)meta, NULL, sizeof(METADATA), sizeof(METADATA), 0) & BLKCLS_ERASED))
+				xenon_nandfs_SetLBA(meta, up->Alloc.Claim ? up->Alloc.Claim[c2] : dumpdata.LBAMap[c2]);
+			xenon_nandfs_BuildClusterBlock(&up->BlockBuf[sub*SMALL_BLOCK_SZ_PHYS], &up->BlockBuf[sub*SMALL_BLOCK_SZ_PHYS], up->Staged[c2], c2);
+			_xenon_nandfs_UpdateUnstage(up, c2);
+		}
+		up->Programs++;
+		if(xenon_sfc_WriteBlocks(up->BlockBuf, g, 1))
+			ret = FS_ERR_IO;
+	}
+	vfree(units);
+	return ret;
+}
+
+// erased big block slots carry no LBA, so no cluster reaches them; each one nothing else
+// points at can be claimed for the cluster of the same position, its LBA follows with the data.
+// lba gets the LBA of every claimable cluster and INVALID for the rest, returns how many there are
+unsigned int xenon_nandfs_FindErasedSlots(unsigned int* lba, unsigned int clusters)
+{
+	unsigned char page[SMALL_BLOCK_SZ_PHYS / SMALL_BLOCK_PAGES];
+	unsigned char* used = (unsigned char *)vmalloc(dumpdata.LBACount);
+	unsigned int c, u, cnt = 0;
+
+	for(c=0; c<clusters; c++)
+		lba[c] = INVALID;
+	if(used == NULL)
+		return 0;
+	memset(used, 0, dumpdata.LBACount);
+	for(c=0; c<dumpdata.LBACount; c++)
 	{
-		dumpdata.FsEnt[i] = (FS_ENT*)&dumpdata.FSRootFileBuf[i*sizeof(FS_ENT)];
-		if(dumpdata.FsEnt[i]->FileName[0] == 0)
+		u = xenon_nandfs_GetClusterBlock(c);
+		if(u < dumpdata.LBACount)
+			used[u] = 1;
+	}
+	for(c=0; (c<clusters) && (c<dumpdata.LBACount); c++)
+	{
+		if(xenon_nandfs_GetClusterBlock(c) < dumpdata.LBACount)
+			continue;
+		if(used[c])
+			continue;
+		// first page of the slot, its spare holds the LBA
+		if(xenon_sfc_ReadPagePhy(page, (c + (dumpdata.FSStartBlock<<3)) * SMALL_BLOCK_PAGES) & STATUS_BB_ER)
+			continue;
+		if(!(xenon_sfc_ClassifyBlock(&page[nand.PageSz], NULL, sizeof(METADATA), sizeof(METADATA), 0) & BLKCLS_ERASED))
+			continue;
+		lba[c] = dumpdata.FSStartBlock + (c>>3);
+		used[c] = 1;
+		cnt++;
+	}
+	vfree(used);
+	return cnt;
+}
+
+// the claims stay with the update, the LBAMap only learns them once the commit went through
+static void _xenon_nandfs_UpdateClaimErased(FS_UPDATE* up)
+{
+	up->Alloc.Claim = (unsigned int *)vmalloc(up->Alloc.Clusters * sizeof(unsigned int));
+	if(up->Alloc.Claim == NULL)
+		return;
+	if(xenon_nandfs_FindErasedSlots(up->Alloc.Claim, up->Alloc.Clusters) == 0)
+	{
+		vfree(up->Alloc.Claim);
+		up->Alloc.Claim = NULL;
+	}
+}
+
+// the working copy starts out as the active FSRoot
+int xenon_nandfs_UpdateBegin(FS_UPDATE* up)
+{
+	unsigned int c;
+
+	memset(up, 0, sizeof(FS_UPDATE));
+	for(c=0; c<FS_CHAIN_COUNT; c++)
+		up->Chain[c] = __builtin_bswap16(dumpdata.pFSRootBufShort[c]);
+	for(c=0; c<MAX_FSENT; c++)
+		memcpy(&up->Ent[c], dumpdata.FsEnt[c], sizeof(FS_ENT));
+	up->BlockBuf = (unsigned char *)vmalloc(nand.BlockSzPhys);
+	up->ClusterBuf = (unsigned char *)vmalloc(FS_CLUSTER_SIZE * 2);
+	if((up->BlockBuf == NULL) || (up->ClusterBuf == NULL) || !xenon_nandfs_AllocInit(&up->Alloc, up->Chain, xenon_nandfs_GetClusterCount()))
+	{
+		xenon_nandfs_UpdateAbort(up);
+		return FS_ERR_IO;
+	}
+	if(nand.isBB)
+		_xenon_nandfs_UpdateClaimErased(up);
+	xenon_nandfs_AllocLoadWear(&up->Alloc);
+	xenon_nandfs_AllocReserveSystem(&up->Alloc);
+	return 0;
+}
+
+void xenon_nandfs_UpdateAbort(FS_UPDATE* up)
+{
+	unsigned int c;
+
+	for(c=0; c<FS_CHAIN_COUNT; c++)
+		_xenon_nandfs_UpdateUnstage(up, c);
+	xenon_nandfs_AllocDone(&up->Alloc);
+	if(up->BlockBuf)
+		vfree(up->BlockBuf);
+	if(up->ClusterBuf)
+		vfree(up->ClusterBuf);
+	up->BlockBuf = NULL;
+	up->ClusterBuf = NULL;
+}
+
+static FS_ENT* _xenon_nandfs_UpdateFind(FS_UPDATE* up, const char* name)
+{
+	unsigned int i;
+
+	for(i=0; i<MAX_FSENT; i++)
+	{
+		if((up->Ent[i].FileName[0] == 0) || (up->Ent[i].FileName[0] == FS_ENT_ERASED))
+			continue;
+		if(!strncmp(up->Ent[i].FileName, name, sizeof(up->Ent[i].FileName)))
+			return &up->Ent[i];
+	}
+	return NULL;
+}
+
+// collects a chain into up->Old, returns its length
+static unsigned int _xenon_nandfs_UpdateWalk(FS_UPDATE* up, FS_ENT* ent)
+{
+	unsigned int c, cnt = 0;
+
+	for(c = __builtin_bswap16(ent->StartCluster); (c < up->Alloc.Clusters) && (cnt < up->Alloc.Clusters); c = up->Chain[c])
+		up->Old[cnt++] = c;
+	return cnt;
+}
+
+// released clusters still belong to the active root, they only become free once the new one is written;
+// one staged in this update never got there and can be handed out again
+static void _xenon_nandfs_UpdateRelease(FS_UPDATE* up, unsigned int cluster)
+{
+	if(up->Staged[cluster])
+	{
+		_xenon_nandfs_UpdateUnstage(up, cluster);
+		up->Alloc.Reserved[cluster>>5] &= ~(1u << (cluster&31));
+	}
+	else
+		xenon_nandfs_AllocReserve(&up->Alloc, cluster);
+	xenon_nandfs_AllocSetChain(&up->Alloc, cluster, FS_CHAIN_FREE);
+}
+
+// creates or replaces a file, clusters whose content is unchanged are kept and everything
+// else goes to clusters the active root doesn't use, so it stays valid until the commit
+int xenon_nandfs_UpdateWrite(FS_UPDATE* up, const char* name, const unsigned char* data, unsigned int len, unsigned int stamp)
+{
+	FS_ENT* ent;
+	unsigned char* want = &up->ClusterBuf[FS_CLUSTER_SIZE];
+	unsigned int i, k, c, n, need, oldCnt = 0, fresh = 0;
+	int ret;
+
+	if((strlen(name) == 0) || (strlen(name) >= sizeof(ent->FileName)))
+		return FS_ERR_NAME;
+	need = (len + FS_CLUSTER_SIZE - 1) / FS_CLUSTER_SIZE;
+	if(need > up->Alloc.Clusters)
+		return FS_ERR_NOSPACE;
+
+	ent = _xenon_nandfs_UpdateFind(up, name);
+	if(ent)
+		oldCnt = _xenon_nandfs_UpdateWalk(up, ent);
+	else
+	{
+		for(i=0; i<MAX_FSENT; i++)
+			if((up->Ent[i].FileName[0] == 0) || (up->Ent[i].FileName[0] == FS_ENT_ERASED))
+				break;
+		if(i == MAX_FSENT)
+			return FS_ERR_NAME;
+		ent = &up->Ent[i];
+	}
+
+	// an old cluster stays where its content is identical, the rest needs a fresh one
+	for(k=0; k<need; k++)
+	{
+		up->New[k] = FS_CHAIN_FREE;
+		if(k < oldCnt)
+		{
+			n = ((len - (k*FS_CLUSTER_SIZE)) > FS_CLUSTER_SIZE) ? FS_CLUSTER_SIZE : (len - (k*FS_CLUSTER_SIZE));
+			memcpy(want, &data[k*FS_CLUSTER_SIZE], n);
+			_xenon_nandfs_UpdateReadCluster(up, up->ClusterBuf, up->Old[k]);
+			// bytes past the end of the file are never read, they don't need to match
+			if(!memcmp(up->ClusterBuf, want, n))
+				up->New[k] = up->Old[k];
+		}
+		if(up->New[k] == FS_CHAIN_FREE)
+			fresh++;
+	}
+
+	c = xenon_nandfs_AllocChain(&up->Alloc, fresh);
+	if(c == (unsigned int)INVALID)
+		return FS_ERR_NOSPACE;
+	for(k=0; k<need; k++)
+	{
+		if(up->New[k] != FS_CHAIN_FREE)
+			continue;
+		up->New[k] = c;
+		c = up->Chain[c];
+		n = ((len - (k*FS_CLUSTER_SIZE)) > FS_CLUSTER_SIZE) ? FS_CLUSTER_SIZE : (len - (k*FS_CLUSTER_SIZE));
+		memcpy(want, &data[k*FS_CLUSTER_SIZE], n);
+		memset(&want[n], 0, FS_CLUSTER_SIZE - n);
+		ret = _xenon_nandfs_UpdateStage(up, up->New[k], want);
+		if(ret)
+			return ret;
+	}
+
+	for(k=0; k<oldCnt; k++)
+		if((k >= need) || (up->New[k] != up->Old[k]))
+			_xenon_nandfs_UpdateRelease(up, up->Old[k]);
+	for(k=0; k<need; k++)
+		xenon_nandfs_AllocSetChain(&up->Alloc, up->New[k], ((k+1) < need) ? up->New[k+1] : FS_CHAIN_END);
+
+	memset(ent, 0, sizeof(FS_ENT));
+	memcpy(ent->FileName, name, strlen(name));
+	ent->StartCluster = __builtin_bswap16(need ? up->New[0] : FS_CHAIN_END);
+	ent->ClusterSz = __builtin_bswap32(len);
+	ent->TypeTime = __builtin_bswap32(stamp);
+	return 0;
+}
+
+// shrinking keeps the leading clusters, growing appends zeroes
+int xenon_nandfs_UpdateTruncate(FS_UPDATE* up, const char* name, unsigned int size, unsigned int stamp)
+{
+	FS_ENT* ent = _xenon_nandfs_UpdateFind(up, name);
+	unsigned char* data;
+	unsigned int k, n, oldLen, oldCnt;
+	int ret;
+
+	if(ent == NULL)
+		return FS_ERR_NOTFOUND;
+	oldLen = __builtin_bswap32(ent->ClusterSz);
+	oldCnt = _xenon_nandfs_UpdateWalk(up, ent);
+	data = (unsigned char *)vmalloc(size ? size : 1);
+	if(data == NULL)
+		return FS_ERR_IO;
+	memset(data, 0, size);
+	for(k=0; (k<oldCnt) && ((k*FS_CLUSTER_SIZE) < size) && ((k*FS_CLUSTER_SIZE) < oldLen); k++)
+	{
+		n = size - (k*FS_CLUSTER_SIZE);
+		if(n > (oldLen - (k*FS_CLUSTER_SIZE)))
+			n = oldLen - (k*FS_CLUSTER_SIZE);
+		if(n > FS_CLUSTER_SIZE)
+			n = FS_CLUSTER_SIZE;
+		_xenon_nandfs_UpdateReadCluster(up, up->ClusterBuf, up->Old[k]);
+		memcpy(&data[k*FS_CLUSTER_SIZE], up->ClusterBuf, n);
+	}
+	ret = xenon_nandfs_UpdateWrite(up, name, data, size, stamp);
+	vfree(data);
+	return ret;
+}
+
+int xenon_nandfs_UpdateDelete(FS_UPDATE* up, const char* name)
+{
+	FS_ENT* ent = _xenon_nandfs_UpdateFind(up, name);
+	unsigned int k, cnt;
+
+	if(ent == NULL)
+		return FS_ERR_NOTFOUND;
+	cnt = _xenon_nandfs_UpdateWalk(up, ent);
+	for(k=0; k<cnt; k++)
+		_xenon_nandfs_UpdateRelease(up, up->Old[k]);
+	ent->FileName[0] = FS_ENT_ERASED;
+	return 0;
+}
+
+// programs the staged data and then the working copy as a new FSRoot with the next sequence
+// into the least worn free (Bg)Block; however many files changed there is one root write, and
+// the old root is only released in the new chain table so it stays valid until that write
+int xenon_nandfs_UpdateCommit(FS_UPDATE* up)
+{
+	unsigned int c, j, u, wear, bestWear = 0, rc = INVALID, rootUnits, fsBase, phys, seq, anchor;
+	unsigned char* root = up->ClusterBuf;
+	unsigned char* out;
+	int ret;
+
+	rootUnits = nand.isBB ? 8 : 1;
+	fsBase = nand.isBB ? (dumpdata.FSStartBlock<<3) : 0;
+	for(c=0; (c+rootUnits) <= up->Alloc.Clusters; c+=rootUnits)
+	{
+		for(j=0, wear=0; j<rootUnits; j++)
+		{
+			if(!xenon_nandfs_AllocIsFree(&up->Alloc, c+j))
+				break;
+			wear += up->Alloc.Wear[c+j];
+		}
+		if((j == rootUnits) && ((rc == (unsigned int)INVALID) || (wear < bestWear)))
+		{
+			rc = c;
+			bestWear = wear;
+		}
+	}
+	if(rc == (unsigned int)INVALID)
+	{
+		xenon_nandfs_UpdateAbort(up);
+		return FS_ERR_NOSPACE;
+	}
+	// data first, a failure here leaves the old root describing the old files
+	if(_xenon_nandfs_UpdateFlush(up))
+	{
+		xenon_nandfs_UpdateAbort(up);
+		return FS_ERR_IO;
+	}
+
+	for(c=0; c<up->Alloc.Clusters; c++)
+	{
+		u = xenon_nandfs_AllocClusterBlock(&up->Alloc, c);
+		if((u != (unsigned int)INVALID) && (((u + fsBase) / rootUnits) == dumpdata.FSRootBlock))
+			_xenon_nandfs_UpdateRelease(up, c);
+	}
+	for(j=0; j<rootUnits; j++)
+		xenon_nandfs_AllocSetChain(&up->Alloc, rc+j, FS_CHAIN_END);
+	phys = (xenon_nandfs_AllocClusterBlock(&up->Alloc, rc) + fsBase) / rootUnits;
+	seq = dumpdata.FSRootVer + 1;
+	xenon_nandfs_BuildRoot(root, up->Chain, up->Ent);
+
+	if(nand.MMC)
+	{
+		// the old anchor keeps pointing at the old root until the other slot is written
+		anchor = dumpdata.AnchorNum ^ 1;
+		if(xenon_sfc_WriteBlocks(root, phys, 1))
+		{
+			xenon_nandfs_UpdateAbort(up);
+			return FS_ERR_IO;
+		}
+		// newest anchor is copied into the other slot with the new root and version
+		xenon_sfc_ReadMapData(up->BlockBuf, (nand.ConfigBlock - MMC_ANCHOR_BLOCKS + dumpdata.AnchorNum) * nand.BlockSz, nand.BlockSz);
+		xenon_nandfs_SetMMCAnchorVer(up->BlockBuf, seq);
+		xenon_nandfs_SetMMCMobileBlock(up->BlockBuf, MOBILE_FSROOT, phys);
+		xenon_nandfs_SetMMCAnchorSha(up->BlockBuf);
+		up->Programs += 2;
+		if(xenon_sfc_WriteBlocks(up->BlockBuf, nand.ConfigBlock - MMC_ANCHOR_BLOCKS + anchor, 1))
+		{
+			xenon_nandfs_UpdateAbort(up);
+			return FS_ERR_IO;
+		}
+		dumpdata.AnchorNum = anchor;
+		dumpdata.AnchorValid[anchor] = true;
+	}
+	else
+	{
+		out = (unsigned char *)vmalloc(nand.BlockSzPhys);
+		if(out == NULL)
+		{
+			xenon_nandfs_UpdateAbort(up);
+			return FS_ERR_IO;
+		}
+		// spare of the old root is carried over, only sequence and LBA change
+		xenon_sfc_ReadBlock(up->BlockBuf, dumpdata.FSRootBlock);
+		for(j=0; j<rootUnits; j++)
+			xenon_nandfs_BuildRootBlock(&out[j*SMALL_BLOCK_SZ_PHYS], &up->BlockBuf[j*SMALL_BLOCK_SZ_PHYS], j ? NULL : root, seq, (phys*rootUnits)+j);
+		up->Programs++;
+		ret = xenon_sfc_WriteBlocks(out, phys, 1);
+		vfree(out);
+		if(ret)
+		{
+			xenon_nandfs_UpdateAbort(up);
+			return FS_ERR_IO;
+		}
+	}
+
+	// claimed slots the new root uses carry their LBA now, unused ones stay erased and unmapped
+	for(c=0; up->Alloc.Claim && (c<up->Alloc.Clusters); c++)
+		if((up->Alloc.Claim[c] != (unsigned int)INVALID) && (up->Chain[c] != FS_CHAIN_FREE))
+			dumpdata.LBAMap[c] = up->Alloc.Claim[c];
+	dumpdata.FSRootBlock = phys;
+	dumpdata.FSRootVer = seq;
+	xenon_nandfs_SplitFsRootBuf();
+	xenon_nandfs_UpdateAbort(up);
+	return 0;
+}
+
+int xenon_nandfs_WriteFile(const char* name, const unsigned char* data, unsigned int len, unsigned int stamp)
+{
+	FS_UPDATE* up = (FS_UPDATE *)vmalloc(sizeof(FS_UPDATE));
+	int ret;
+
+	if(up == NULL)
+		return FS_ERR_IO;
+	ret = xenon_nandfs_UpdateBegin(up);
+	if(!ret)
+		ret = xenon_nandfs_UpdateWrite(up, name, data, len, stamp);
+	if(!ret)
+		ret = xenon_nandfs_UpdateCommit(up);
+	else
+		xenon_nandfs_UpdateAbort(up);
+	vfree(up);
+	return ret;
+}
+
+int xenon_nandfs_TruncateFile(const char* name, unsigned int size, unsigned int stamp)
+{
+	FS_UPDATE* up = (FS_UPDATE *)vmalloc(sizeof(FS_UPDATE));
+	int ret;
+
+	if(up == NULL)
+		return FS_ERR_IO;
+	ret = xenon_nandfs_UpdateBegin(up);
+	if(!ret)
+		ret = xenon_nandfs_UpdateTruncate(up, name, size, stamp);
+	if(!ret)
+		ret = xenon_nandfs_UpdateCommit(up);
+	else
+		xenon_nandfs_UpdateAbort(up);
+	vfree(up);
+	return ret;
+}
+
+int xenon_nandfs_DeleteFile(const char* name)
+{
+	FS_UPDATE* up = (FS_UPDATE *)vmalloc(sizeof(FS_UPDATE));
+	int ret;
+
+	if(up == NULL)
+		return FS_ERR_IO;
+	ret = xenon_nandfs_UpdateBegin(up);
+	if(!ret)
+		ret = xenon_nandfs_UpdateDelete(up, name);
+	if(!ret)
+		ret = xenon_nandfs_UpdateCommit(up);
+	else
+		xenon_nandfs_UpdateAbort(up);
+	vfree(up);
+	return ret;
+}
+
+bool xenon_nandfs_HashTreeInit(HASHTREE* tree, unsigned int leaves, unsigned int blocksz)
+{
+	unsigned int base = 1;
+
+	while(base < leaves)
+		base <<= 1;
+
+	tree->LeafCount = leaves;
+	tree->LeafBase = base;
+	tree->BlockSz = blocksz;
+	tree->Node = vmalloc(base * 2 * SHA_DIGEST_LEN);
+	tree->Dirty = (unsigned char *)vmalloc(base * 2);
+	if(!tree->Node || !tree->Dirty)
+	{
+		xenon_nandfs_HashTreeFree(tree);
+		return false;
+	}
+	// padding leaves past LeafCount stay zero
+	memset(tree->Node, 0, base * 2 * SHA_DIGEST_LEN);
+	memset(tree->Dirty, 0, base * 2);
+	return true;
+}
+
+void xenon_nandfs_HashTreeFree(HASHTREE* tree)
+{
+	if(tree->Node)
+		vfree(tree->Node);
+	if(tree->Dirty)
+		vfree(tree->Dirty);
+	tree->Node = NULL;
+	tree->Dirty = NULL;
+}
+
+void xenon_nandfs_HashTreeSetLeaf(HASHTREE* tree, unsigned int block, const unsigned char* data)
+{
+	unsigned int n = tree->LeafBase + block;
+
+	if(block >= tree->LeafCount)
+		return;
+
+	xenon_nandfs_Sha(data, tree->BlockSz, tree->Node[n]);
+
+	// flag the path to the root, stop where an earlier leaf already did
+	for(n >>= 1; n && !tree->Dirty[n]; n >>= 1)
+		tree->Dirty[n] = 1;
+}
+
+static void _xenon_nandfs_HashTreeUpdateNode(HASHTREE* tree, unsigned int n)
+{
+	SHA_CTX sha;
+
+	if((n >= tree->LeafBase) || !tree->Dirty[n])
+		return;
+
+	_xenon_nandfs_HashTreeUpdateNode(tree, n*2);
+	_xenon_nandfs_HashTreeUpdateNode(tree, n*2+1);
+
+	xenon_nandfs_ShaInit(&sha);
+	xenon_nandfs_ShaUpdate(&sha, tree->Node[n*2], SHA_DIGEST_LEN);
+	xenon_nandfs_ShaUpdate(&sha, tree->Node[n*2+1], SHA_DIGEST_LEN);
+	xenon_nandfs_ShaFinal(&sha, tree->Node[n]);
+	tree->Dirty[n] = 0;
+}
+
+// only nodes flagged by SetLeaf are rehashed
+void xenon_nandfs_HashTreeUpdate(HASHTREE* tree)
+{
+	_xenon_nandfs_HashTreeUpdateNode(tree, 1);
+}
+
+static int _xenon_nandfs_HashTreeReadBlock(unsigned char* buf, unsigned int block)
+{
+	if(nand.MMC)
+	{
+		xenon_sfc_ReadMapData(buf, (block * nand.BlockSzPhys), nand.BlockSzPhys);
+		return 0;
+	}
+	return xenon_sfc_ReadBlock(buf, block);
+}
+
+int xenon_nandfs_HashTreeBuild(HASHTREE* tree)
+{
+	unsigned int blk;
+	unsigned char* blockbuf = (unsigned char *)vmalloc(tree->BlockSz);
+
+	if(!blockbuf)
+		return -1;
+
+	for(blk=0; blk < tree->LeafCount; blk++)
+	{
+		_xenon_nandfs_HashTreeReadBlock(blockbuf, blk);
+		xenon_nandfs_HashTreeSetLeaf(tree, blk, blockbuf);
+	}
+	xenon_nandfs_HashTreeUpdate(tree);
+
+	vfree(blockbuf);
+	return 0;
+}
+
+// re-reads only the given blocks and rehashes their paths
+int xenon_nandfs_HashTreeRefresh(HASHTREE* tree, const unsigned int* blocks, unsigned int cnt)
+{
+	unsigned int i;
+	unsigned char* blockbuf = (unsigned char *)vmalloc(tree->BlockSz);
+
+	if(!blockbuf)
+		return -1;
+
+	for(i=0; i < cnt; i++)
+	{
+		if(blocks[i] >= tree->LeafCount)
 			continue;
+		_xenon_nandfs_HashTreeReadBlock(blockbuf, blocks[i]);
+		xenon_nandfs_HashTreeSetLeaf(tree, blocks[i], blockbuf);
+	}
+	xenon_nandfs_HashTreeUpdate(tree);
+
+	vfree(blockbuf);
+	return 0;
+}
+
+static unsigned int _xenon_nandfs_HashTreeDiffNode(HASHTREE* a, HASHTREE* b, unsigned int n, unsigned int* blocks, unsigned int max, unsigned int found)
+{
+	if(found >= max)
+		return found;
+	if(memcmp(a->Node[n], b->Node[n], SHA_DIGEST_LEN) == 0)
+		return found;
+
+	if(n >= a->LeafBase)
+	{
+		if((n - a->LeafBase) < a->LeafCount)
+			blocks[found++] = n - a->LeafBase;
+		return found;
+	}
+
+	found = _xenon_nandfs_HashTreeDiffNode(a, b, n*2, blocks, max, found);
+	return _xenon_nandfs_HashTreeDiffNode(a, b, n*2+1, blocks, max, found);
+}
+
+// fills blocks with up to max differing block numbers, both trees must be up to date
+unsigned int xenon_nandfs_HashTreeDiff(HASHTREE* a, HASHTREE* b, unsigned int* blocks, unsigned int max)
+{
+	if((a->LeafCount != b->LeafCount) || (a->LeafBase != b->LeafBase) || (a->BlockSz != b->BlockSz))
+	{
+		printk(KERN_INFO "Hash trees cover different geometries\n");
+		return 0;
+	}
+	return _xenon_nandfs_HashTreeDiffNode(a, b, 1, blocks, max, 0);
+}
+
+// loads the config blocks once, again only after the SFC wrote to them
+static bool _xenon_nandfs_LoadConfig(void)
+{
+	CONFIG_CACHE* c = &dumpdata.Config;
+	unsigned char* buf;
+	PAGEDATA* pdata;
+	unsigned int i, j, cls;
+
+	if(c->Loaded && (c->Gen == xenon_sfc_GetConfigGen()))
+		return true;
+	if(c->Buf == NULL)
+	{
+		c->Buf = (unsigned char *)vmalloc(CONFIG_BLOCKS * nand.BlockSz);
+		if(c->Buf == NULL)
+			return false;
+	}
+	c->Gen = xenon_sfc_GetConfigGen();
+
+	if(nand.MMC)
+	{
+		xenon_sfc_ReadMapData(c->Buf, nand.ConfigBlock * nand.BlockSz, CONFIG_BLOCKS * nand.BlockSz);
+		for(i=0; i<CONFIG_BLOCKS; i++)
+			c->Valid[i] = true; // no spare, nothing to check against
+	}
+	else
+	{
+		buf = (unsigned char *)vmalloc(nand.BlockSzPhys);
+		if(buf == NULL)
+			return false;
+		for(i=0; i<CONFIG_BLOCKS; i++)
+		{
+			xenon_sfc_ReadBlock(buf, nand.ConfigBlock + i);
+			c->Valid[i] = true;
+			for(j=0; j<nand.PagesInBlock; j++)
+			{
+				pdata = (PAGEDATA*)&buf[j * nand.PageSzPhys];
+				memcpy(&c->Buf[(i * nand.BlockSz) + (j * nand.PageSz)], pdata->User, nand.PageSz);
+				// erased pages are unused config space, anything else has to carry a good EDC
+				cls = xenon_sfc_ClassifyBlock((unsigned char*)pdata, NULL, nand.PageSzPhys, nand.PageSz, nand.MetaSz);
+				if(!(cls & BLKCLS_ERASED) && xenon_nandfs_CheckECC(pdata))
+					c->Valid[i] = false;
+			}
+			if(!c->Valid[i])
+				printk(KERN_INFO "Config block 0x%x failed EDC check\n", nand.ConfigBlock + i);
+		}
+		vfree(buf);
+	}
+	c->Loaded = true;
+	return true;
+}
+
+void xenon_nandfs_FreeConfig(void)
+{
+	if(dumpdata.Config.Buf)
+		vfree(dumpdata.Config.Buf);
+	memset(&dumpdata.Config, 0, sizeof(CONFIG_CACHE));
+}
+
+bool xenon_nandfs_IsConfigBlockValid(unsigned int idx)
+{
+	if((idx >= CONFIG_BLOCKS) || !_xenon_nandfs_LoadConfig())
+		return false;
+	return dumpdata.Config.Valid[idx];
+}
+
+// off is relative to the first config block, returns 1 when out of range, 2 when a block failed validation
+int xenon_nandfs_ReadConfig(unsigned char* buf, unsigned int off, unsigned int len)
+{
+	unsigned int i;
+
+	if(((off + len) > (CONFIG_BLOCKS * nand.BlockSz)) || ((off + len) < off))
+		return 1;
+	if(!_xenon_nandfs_LoadConfig())
+		return 1;
+	for(i = off / nand.BlockSz; (len > 0) && (i <= ((off + len - 1) / nand.BlockSz)); i++)
+	{
+		if(!dumpdata.Config.Valid[i])
+			return 2;
+	}
+	memcpy(buf, &dumpdata.Config.Buf[off], len);
+	return 0;
+}
+
+bool xenon_nandfs_ReadConfigByte(unsigned int off, unsigned char* val)
+{
+	return (xenon_nandfs_ReadConfig(val, off, 1) == 0);
+}
+
+// config values are big endian like everything else on flash
+bool xenon_nandfs_ReadConfigShort(unsigned int off, unsigned short* val)
+{
+	unsigned char b[2];
 
-		printk(KERN_INFO "file: %s ", dumpdata.FsEnt[i]->FileName);
-		for(k=0; k< (22-strlen(dumpdata.FsEnt[i]->FileName)); k++)
-		{
-			printk(KERN_INFO " ");
-		}
+	if(xenon_nandfs_ReadConfig(b, off, 2) != 0)
+		return false;
+	*val = (b[0]<<8)|b[1];
+	return true;
+}
 
-		fsBlock = __builtin_bswap16(dumpdata.FsEnt[i]->StartCluster);
-		fsFileSize = __builtin_bswap32(dumpdata.FsEnt[i]->ClusterSz);
+bool xenon_nandfs_ReadConfigInt(unsigned int off, unsigned int* val)
+{
+	unsigned char b[4];
 
-		printk(KERN_INFO "start: %04x size: %08x stamp: %08x\n", fsBlock, fsFileSize, (unsigned int)__builtin_bswap32(dumpdata.FsEnt[i]->TypeTime));
+	if(xenon_nandfs_ReadConfig(b, off, 4) != 0)
+		return false;
+	*val = ((unsigned int)b[0]<<24)|(b[1]<<16)|(b[2]<<8)|b[3];
+	return true;
+}
 
-		// extract the file
-		if(dumpdata.FsEnt[i]->FileName[0] == 0x5){ // file is erased but still in the record
-			printk(KERN_INFO "   erased still has entry???");
-			continue;
-		}
-			
-		realBlock = fsBlock;
-		if(nand.isBB)
-			realBlock = ((dumpdata.LBAMap[fsBlock]<<3)-fsStartBlock);
+// user bytes of the MU are interleaved with spare, off and len are in user bytes; the MU lies
+// past the 64MB the driver maps, so it is read a block at a time through the SFC
+int xenon_nandfs_FatxRead(FATX_VOL* vol, unsigned char* buf, unsigned int off, unsigned int len)
+{
+	unsigned int page, blk, skip, i, n;
 
-		while(fsFileSize > 0x4000)
+	if((off + len) > vol->Size)
+		return 1;
+	page = off / nand.PageSz;
+	skip = off % nand.PageSz;
+	while(len > 0)
+	{
+		// the last block read is kept, directory and FAT reads are mostly small and sequential
+		blk = (vol->Start / nand.BlockSzPhys) + (page / nand.PagesInBlock);
+		if(blk != vol->Cached)
 		{
-#ifdef DEBUG
-			printk(KERN_INFO "%04x:%04x, ", fsBlock, realBlock);
-#endif
-#ifdef WRITE_OUT
-			appendBlockToFile(dumpdata.FsEnt[i]->FileName, realBlock, 0x4000);
-#endif
-			fsFileSize = fsFileSize-0x4000;
-			fsBlock = __builtin_bswap16(dumpdata.pFSRootBufShort[fsBlock]); // gets next block
-			realBlock = dumpdata.LBAMap[fsBlock];
-			if(nand.isBB)
-			{
-				realBlock = (realBlock<<3); // to SmallBlock
-				realBlock -= fsStartBlock; // relative Adress
-				realBlock += (fsBlock % 8); // smallBlock inside bigBlock
-			}
+			vol->Cached = INVALID;
+			if(xenon_sfc_ReadBlock(vol->PageBuf, blk))
+				return 1;
+			vol->Cached = blk;
 		}
-		if((fsFileSize > 0)&&(fsBlock<0x1FFE))
+		for(i=page % nand.PagesInBlock; (i<nand.PagesInBlock) && (len > 0); i++, page++)
 		{
-#ifdef DEBUG
-			printk(KERN_INFO "%04x:%04x, ", fsBlock, realBlock);
-#endif
-#ifdef WRITE_OUT
-			appendBlockToFile(dumpdata.FsEnt[i]->FileName, realBlock, fsFileSize);
-#endif
+			n = nand.PageSz - skip;
+			if(n > len)
+				n = len;
+			memcpy(buf, &vol->PageBuf[(i * nand.PageSzPhys) + skip], n);
+			buf += n;
+			len -= n;
+			skip = 0;
 		}
-		else
-			printk(KERN_INFO "** Couldn't write file tail! %04x:%04x, ", fsBlock, realBlock);
-	printk(KERN_INFO "\n\n");
-	} 
+	}
 	return 0;
 }
 
-int xenon_nandfs_ParseLBA(void)
+unsigned int xenon_nandfs_FatxClusterOffset(FATX_VOL* vol, unsigned int cluster)
 {
-	int block, spare;
-	unsigned char* userbuf = (unsigned char *)vmalloc(nand.BlockSz);
-	unsigned char* sparebuf = (unsigned char *)vmalloc(nand.MetaSz*nand.PagesInBlock);
-	int FsStart = dumpdata.FSStartBlock;
-	int FsSize = dumpdata.FSSize;
-	unsigned short lba, lba_cnt=0;
-	METADATA *meta;
-		
-	if(nand.MMC)
+	return vol->DataOffset + ((cluster - 1) * vol->ClusterSz);
+}
+
+// the MU follows the system area on big block NAND, its FAT is read once and kept
+bool xenon_nandfs_FatxOpen(FATX_VOL* vol)
+{
+	unsigned char hdr[0x10];
+	unsigned char* raw;
+	unsigned int i, entSz, fatSz;
+
+	memset(vol, 0, sizeof(FATX_VOL));
+	if(!nand.isBB || (nand.SizeData <= BB_SYSTEM_AREA))
+		return false;
+
+	vol->Start = (BB_SYSTEM_AREA / nand.BlockSz) * nand.BlockSzPhys;
+	vol->Size = nand.SizeData - BB_SYSTEM_AREA;
+	vol->Cached = INVALID;
+	vol->PageBuf = (unsigned char *)vmalloc(nand.BlockSzPhys);
+	if(vol->PageBuf == NULL)
+		return false;
+
+	if(xenon_nandfs_FatxRead(vol, hdr, 0, sizeof(hdr)) || ((((unsigned int)hdr[0]<<24)|(hdr[1]<<16)|(hdr[2]<<8)|hdr[3]) != FATX_MAGIC))
 	{
-		for(block=0;block<nand.BlocksCount;block++)
-		{
-			dumpdata.LBAMap[lba_cnt] = block; // Hail to the phison, just this one time
-			lba_cnt++;
-		}
+		printk(KERN_INFO "No FATX partition in the MU area\n");
+		xenon_nandfs_FatxClose(vol);
+		return false;
 	}
-	else
+	vol->ClusterSz = (((unsigned int)hdr[8]<<24)|(hdr[9]<<16)|(hdr[10]<<8)|hdr[11]) * nand.PageSz;
+	vol->RootCluster = ((unsigned int)hdr[12]<<24)|(hdr[13]<<16)|(hdr[14]<<8)|hdr[15];
+	if((vol->ClusterSz == 0) || (vol->ClusterSz > vol->Size))
 	{
-		for(block=FsStart;block<(FsStart+FsSize);block++)
+		printk(KERN_INFO "FATX cluster size 0x%x is invalid\n", vol->ClusterSz);
+		xenon_nandfs_FatxClose(vol);
+		return false;
+	}
+	vol->ClusterCount = vol->Size / vol->ClusterSz;
+	entSz = (vol->ClusterCount < FATX_FAT16_LIMIT) ? 2 : 4;
+	fatSz = ((vol->ClusterCount + 1) * entSz + FATX_HEADER_SIZE - 1) & ~(FATX_HEADER_SIZE - 1);
+	vol->DataOffset = FATX_HEADER_SIZE + fatSz;
+	vol->ClusterCount = (vol->Size - vol->DataOffset) / vol->ClusterSz;
+
+	raw = (unsigned char *)vmalloc(fatSz);
+	vol->Fat = (unsigned int *)vmalloc((vol->ClusterCount + 1) * sizeof(unsigned int));
+	if((raw == NULL) || (vol->Fat == NULL))
+	{
+		if(raw)
+			vfree(raw);
+		xenon_nandfs_FatxClose(vol);
+		return false;
+	}
+	if(xenon_nandfs_FatxRead(vol, raw, FATX_HEADER_SIZE, fatSz))
+	{
+		printk(KERN_INFO "FATX table couldn't be read\n");
+		vfree(raw);
+		xenon_nandfs_FatxClose(vol);
+		return false;
+	}
+	for(i=0; i<=vol->ClusterCount; i++)
+	{
+		if(entSz == 2)
 		{
-			xenon_sfc_ReadBlockSeparate(userbuf, sparebuf, block);
-			if(nand.isBB)
-			{
-				for(spare=0;spare<(nand.MetaSz*nand.PagesInBlock);spare+=(nand.MetaSz*32))
-				{
-					meta = (METADATA*)&sparebuf[spare]; // 8 SmBlocks inside BgBlock for LBA
-					lba = xenon_nandfs_GetLBA(meta);
-					dumpdata.LBAMap[lba_cnt] = lba;
-					lba_cnt++;
-				}	
-			}
-			else
-			{
-				meta = (METADATA*)sparebuf;
-				lba = xenon_nandfs_GetLBA(meta);
-				dumpdata.LBAMap[lba_cnt] = lba;
-				lba_cnt++;
-			}
+			vol->Fat[i] = (raw[i*2]<<8)|raw[(i*2)+1];
+			if(vol->Fat[i] >= FATX_FAT16_LIMIT)
+				vol->Fat[i] |= 0xFFFF0000;
 		}
+		else
+			vol->Fat[i] = ((unsigned int)raw[i*4]<<24)|(raw[(i*4)+1]<<16)|(raw[(i*4)+2]<<8)|raw[(i*4)+3];
 	}
-	printk(KERN_INFO "Read 0x%x LBA entries\n",lba_cnt);
-	vfree(userbuf);
-	vfree(sparebuf);
-	return 0;
+	vfree(raw);
+	return true;
 }
 
-int xenon_nandfs_SplitFsRootBuf()
+void xenon_nandfs_FatxClose(FATX_VOL* vol)
 {
-	int block = dumpdata.FSRootBlock;
-	unsigned int i, j, root_off, file_off, ttl_off;
-	unsigned char* data = (unsigned char *)vmalloc(nand.BlockSz);
-	
-	if(nand.MMC)
-		xenon_sfc_ReadMapData(data, (block*nand.BlockSz), nand.BlockSz);
-	else
-		xenon_sfc_ReadBlockUser(data, block);
-	
-	root_off = 0;
-	file_off = 0;
-	ttl_off = 0;
-	for(i=0; i<16; i++) // copy alternating 512 bytes into each buf
+	if(vol->Fat)
+		vfree(vol->Fat);
+	if(vol->PageBuf)
+		vfree(vol->PageBuf);
+	memset(vol, 0, sizeof(FATX_VOL));
+}
+
+// collapses a cluster chain into runs of consecutive clusters, returns the number of runs
+unsigned int xenon_nandfs_FatxExtents(FATX_VOL* vol, unsigned int cluster, FATX_EXTENT* ext, unsigned int max)
+{
+	unsigned int cnt = 0, steps = 0;
+
+	while((cluster != 0) && (cluster <= vol->ClusterCount) && (steps++ <= vol->ClusterCount))
 	{
-		for(j=0; j<nand.PageSz; j++)
+		if((cnt > 0) && (cluster == ext[cnt-1].Cluster + ext[cnt-1].Count))
+			ext[cnt-1].Count++;
+		else
 		{
-			dumpdata.FSRootBuf[root_off+j] = data[ttl_off+j];
-			dumpdata.FSRootFileBuf[file_off+j] = data[ttl_off+j+512];
+			if(cnt == max)
+				break;
+			ext[cnt].Cluster = cluster;
+			ext[cnt].Count = 1;
+			cnt++;
 		}
-		root_off += nand.PageSz;
-		file_off += nand.PageSz;
-		ttl_off  += (nand.PageSz*2);
+		cluster = vol->Fat[cluster];
+		if(cluster >= FATX_CHAIN_END)
+			break;
+	}
+	return cnt;
+}
+
+static void _xenon_nandfs_AddMobileInst(unsigned char mobi, unsigned short blk, unsigned char page, unsigned int seq, unsigned int size)
+{
+	MOBILE_INST* inst;
+
+	if(dumpdata.MobileHistCount >= MAX_MOBILE_HIST)
+	{
+		printk(KERN_INFO "Mobile history full, instance at block 0x%x page %d dropped\n", blk, page);
+		return;
 	}
+	inst = &dumpdata.MobileHist[dumpdata.MobileHistCount++];
+	inst->Mobile = mobi;
+	inst->Page = page;
+	inst->Block = blk;
+	inst->Sequence = seq;
+	inst->Size = size;
+}
 
-#ifdef FSROOT_WRITE_OUT
-	writeToFile("fsrootbuf.bin", dumpdata.FSRootBuf, FSROOT_SIZE);
-	writeToFile("fsrootfilebuf.bin", dumpdata.FSRootFileBuf, FSROOT_SIZE);
+// number of newer instances of the same slot, equal sequences are ordered by scan position
+unsigned int xenon_nandfs_GetMobileInstAge(unsigned int idx)
+{
+	unsigned int i, age = 0;
+	MOBILE_INST* inst = &dumpdata.MobileHist[idx];
+
+	for(i=0; i<dumpdata.MobileHistCount; i++)
+	{
+		if((i == idx) || (dumpdata.MobileHist[i].Mobile != inst->Mobile))
+			continue;
+		if((dumpdata.MobileHist[i].Sequence > inst->Sequence) || ((dumpdata.MobileHist[i].Sequence == inst->Sequence) && (i > idx)))
+			age++;
+	}
+	return age;
+}
+
+// index into dumpdata.MobileHist of the instance back versions behind the newest, -1 if there is none
+int xenon_nandfs_FindMobileInst(unsigned char mobi, unsigned int back)
+{
+	unsigned int i;
+
+	for(i=0; i<dumpdata.MobileHistCount; i++)
+	{
+		if((dumpdata.MobileHist[i].Mobile == mobi) && (xenon_nandfs_GetMobileInstAge(i) == back))
+			return i;
+	}
+	return -1;
+}
+
+#ifdef DEBUG
+// the tool maps the whole dump, NAND pages carry their spare inline so every page is its own piece
+static unsigned int _xenon_nandfs_MapMobilePages(MOBILE_INST* inst, MOBILE_SEG* seg, unsigned int max)
+{
+	unsigned int i, pages, len, left = inst->Size;
+
+	pages = (left + nand.PageSz - 1) / nand.PageSz;
+	if(pages > (nand.PagesInBlock - inst->Page))
+		pages = nand.PagesInBlock - inst->Page;
+	if(pages > max)
+		return 0;
+	for(i=0; i<pages; i++)
+	{
+		len = (left > nand.PageSz) ? nand.PageSz : left;
+		seg[i].Len = len;
+		seg[i].Data = xenon_sfc_MapData((inst->Block * nand.BlockSzPhys) + ((inst->Page + i) * nand.PageSzPhys), len);
+		if(seg[i].Data == NULL)
+			return 0;
+		left -= len;
+	}
+	return pages;
+}
 #endif
-	vfree(data);
+
+// describes the instance as pieces of the flash window, nothing is read or copied. The driver
+// only maps MMC that way, NAND returns 0 there and is read with xenon_nandfs_ReadMobileInst
+unsigned int xenon_nandfs_MapMobileInst(MOBILE_INST* inst, MOBILE_SEG* seg, unsigned int max)
+{
+	if(nand.MMC)
+	{
+		if(max < 1)
+			return 0;
+		seg[0].Len = inst->Size;
+		seg[0].Data = xenon_sfc_MapData(inst->Block * nand.BlockSz, inst->Size);
+		return (seg[0].Data != NULL) ? 1 : 0;
+	}
+#ifdef DEBUG
+	return _xenon_nandfs_MapMobilePages(inst, seg, max);
+#else
 	return 0;
+#endif
+}
+
+// copies the instance into buf, inst->Size bytes; NAND goes through the SFC
+int xenon_nandfs_ReadMobileInst(MOBILE_INST* inst, unsigned char* buf)
+{
+	unsigned char* user;
+	unsigned char* spare;
+	unsigned int len = inst->Size;
+	int ret;
+
+	if(nand.MMC)
+	{
+		if(((inst->Block * nand.BlockSz) + len) > nand.SizeData)
+			return 1;
+		xenon_sfc_ReadMapData(buf, inst->Block * nand.BlockSz, len);
+		return 0;
+	}
+
+	if(len > ((nand.PagesInBlock - inst->Page) * nand.PageSz))
+		len = (nand.PagesInBlock - inst->Page) * nand.PageSz;
+	user = (unsigned char *)vmalloc(nand.BlockSz);
+	spare = (unsigned char *)vmalloc(nand.MetaSz * nand.PagesInBlock);
+	ret = ((user == NULL) || (spare == NULL) || (inst->Block >= nand.BlocksCount));
+	if(!ret)
+		ret = xenon_sfc_ReadBlockSeparate(user, spare, inst->Block) ? 1 : 0;
+	if(!ret)
+		memcpy(buf, &user[inst->Page * nand.PageSz], len);
+	if(user)
+		vfree(user);
+	if(spare)
+		vfree(spare);
+	return ret;
 }
 
 bool xenon_nandfs_init(void)
@@ -649,32 +4877,65 @@ bool xenon_nandfs_init(void)
 	unsigned char anchor_num = 0;
 	char mobileName[] = {"MobileA"};
 	METADATA* meta;
+	SHA_CTX sha;
 
+	dumpdata.MobileHistCount = 0;
 	if(nand.MMC)
 	{
 		unsigned char* blockbuf = (unsigned char *)vmalloc(nand.BlockSz * 2);
+		unsigned char* mobibuf = (unsigned char *)vmalloc(nand.BlockSz);
 		mmc_anchor_blk = nand.ConfigBlock - MMC_ANCHOR_BLOCKS;
 		prev_mobi_ver = 0;
 		
 		xenon_sfc_ReadMapData(blockbuf, (mmc_anchor_blk * nand.BlockSz), (nand.BlockSz * 2));
-		
+
+		// hash each anchor while it is still hot from the read, prefer verified ones
 		for(i=0; i < MMC_ANCHOR_BLOCKS; i++)
 		{
+			dumpdata.AnchorValid[i] = xenon_nandfs_CheckMMCAnchorSha(&blockbuf[i*nand.BlockSz]);
+			if(!dumpdata.AnchorValid[i])
+				printk(KERN_INFO "MMC Anchor %d failed SHA check\n", i);
+
 			tmp_ver = xenon_nandfs_GetMMCAnchorVer(&blockbuf[i*nand.BlockSz]);
-			if(tmp_ver >= prev_mobi_ver) 
+			if((anchor_num != i) && (dumpdata.AnchorValid[i] != dumpdata.AnchorValid[anchor_num]))
+			{
+				// a verified anchor always beats an unverified one
+				if(!dumpdata.AnchorValid[i])
+					continue;
+				prev_mobi_ver = 0;
+			}
+			if(tmp_ver >= prev_mobi_ver)
 			{
 				prev_mobi_ver = tmp_ver;
 				anchor_num = i;
 			}
 		}
-		
+		dumpdata.AnchorNum = anchor_num;
+
 		if(prev_mobi_ver == 0)
 		{
 			printk(KERN_INFO "MMC Anchor block wasn't found!");
+			vfree(mobibuf);
 			vfree(blockbuf);
 			return false;
 		}
 
+		if(!dumpdata.AnchorValid[anchor_num])
+			printk(KERN_INFO "No MMC Anchor passed SHA check, using unverified anchor %d\n", anchor_num);
+
+		// the other anchor still points at the previous generation, index it as history
+		i = (anchor_num + 1) % MMC_ANCHOR_BLOCKS;
+		tmp_ver = xenon_nandfs_GetMMCAnchorVer(&blockbuf[i*nand.BlockSz]);
+		if(dumpdata.AnchorValid[i] && (tmp_ver != 0) && (tmp_ver != prev_mobi_ver))
+		{
+			for(mobi = MOBILE_BASE+1; mobi < MOBILE_END; mobi++)
+			{
+				blk = xenon_nandfs_GetMMCMobileBlock(&blockbuf[i*nand.BlockSz], mobi);
+				size = xenon_nandfs_GetMMCMobileSize(&blockbuf[i*nand.BlockSz], mobi);
+				if((blk != 0) && ((blk + size) <= nand.BlocksCount))
+					_xenon_nandfs_AddMobileInst(mobi, blk, 0, tmp_ver, size * nand.BlockSz);
+			}
+		}
 
 		for(mobi = 0x30; mobi < 0x3F; mobi++)
 		{
@@ -683,6 +4944,11 @@ bool xenon_nandfs_init(void)
 
 			if(blk == 0)
 				continue;
+			if((blk + size) > nand.BlocksCount)
+			{
+				printk(KERN_INFO "MMC Anchor entry 0x%x points past the flash (block 0x%x)\n", mobi, blk);
+				continue;
+			}
 
 			if(mobi == MOBILE_FSROOT)
 			{
@@ -698,8 +4964,19 @@ bool xenon_nandfs_init(void)
 				dumpdata.Mobile[mobi-MOBILE_BASE].Version = prev_mobi_ver;
 				dumpdata.Mobile[mobi-MOBILE_BASE].Block = blk;
 				dumpdata.Mobile[mobi-MOBILE_BASE].Size = size * nand.BlockSz;
+				_xenon_nandfs_AddMobileInst(mobi, blk, 0, prev_mobi_ver, size * nand.BlockSz);
+
+				// payload is only ever read here, so hash it block by block as it comes in
+				xenon_nandfs_ShaInit(&sha);
+				for(i=0; i < size; i++)
+				{
+					xenon_sfc_ReadMapData(mobibuf, ((blk+i) * nand.BlockSz), nand.BlockSz);
+					xenon_nandfs_ShaUpdate(&sha, mobibuf, nand.BlockSz);
+				}
+				xenon_nandfs_ShaFinal(&sha, dumpdata.Mobile[mobi-MOBILE_BASE].Sha);
 			}
 		}
+		vfree(mobibuf);
 		vfree(blockbuf);
 	}
 	else
@@ -712,7 +4989,7 @@ bool xenon_nandfs_init(void)
 		else
 			fsroot_ident = MOBILE_FSROOT;
 		
-		for(blk=0; blk < nand.BlocksCount; blk++)
+		for(blk=0; blk < xenon_nandfs_GetSystemBlocks(); blk++)
 		{
 			xenon_sfc_ReadBlockSeparate(userbuf, sparebuf, blk);
 			meta = (METADATA*)sparebuf;
@@ -750,31 +5027,42 @@ bool xenon_nandfs_init(void)
 			}
 			else if((mobi >= MOBILE_BASE) && (mobi < MOBILE_END)) //Mobile*.dat
 			{	
-				prev_mobi_ver = dumpdata.Mobile[mobi-MOBILE_BASE].Version;
-				if(tmp_ver >= prev_mobi_ver)
-					dumpdata.Mobile[mobi-MOBILE_BASE].Version = tmp_ver;
-				else
-					continue;
-
 				page_each = nand.PagesInBlock - xenon_nandfs_GetFsFreepages(meta);
+				if(page_each == 0)
+					page_each = nand.PagesInBlock;
 				//printk(KERN_INFO "pageEach: %x\n", pageEach);
-				// find the most recent instance in the block and dump it
+				// index every instance, stale blocks included, the last one is the most recent
 				j = 0;
 				for(i=0; i < nand.PagesInBlock; i += page_each)
 				{
 					meta = (METADATA*)&sparebuf[nand.MetaSz*i];
 					//printk(KERN_INFO "i: %d type: %x\n", i, meta->FsBlockType);
 					if(xenon_nandfs_GetBlockType(meta) == (mobi))
+					{
 						j = i;
+						_xenon_nandfs_AddMobileInst(mobi, blk, i, xenon_nandfs_GetFsSequence(meta), xenon_nandfs_GetFsSize(meta));
+					}
 					if(xenon_nandfs_GetBlockType(meta) == 0x3F)
 						i = nand.PagesInBlock;
 				}
+
+				prev_mobi_ver = dumpdata.Mobile[mobi-MOBILE_BASE].Version;
+				if(tmp_ver >= prev_mobi_ver)
+					dumpdata.Mobile[mobi-MOBILE_BASE].Version = tmp_ver;
+				else
+					continue;
 			
 				meta = (METADATA*)&sparebuf[j*nand.MetaSz];
 				size = xenon_nandfs_GetFsSize(meta);
 				
 				dumpdata.Mobile[mobi-MOBILE_BASE].Size = size;
 				dumpdata.Mobile[mobi-MOBILE_BASE].Block = blk;
+
+				// the instance is already in userbuf, hash it before the next block replaces it
+				if(size > (nand.BlockSz - (j*nand.PageSz)))
+					size = nand.BlockSz - (j*nand.PageSz);
+				xenon_nandfs_Sha(&userbuf[j*nand.PageSz], size, dumpdata.Mobile[mobi-MOBILE_BASE].Sha);
+				size = dumpdata.Mobile[mobi-MOBILE_BASE].Size;
 				
 				mobileName[6] = mobi+0x31;
 				printk(KERN_INFO "%s found at block 0x%x (off: 0x%x), page %d, v %i, size %d (0x%x) bytes\n", mobileName, blk, (blk*nand.BlockSzPhys), j, tmp_ver, size, size);
@@ -790,6 +5078,19 @@ bool xenon_nandfs_init_one(void)
 {
 	int ret;
 	
+#ifndef DEBUG
+	if(sha_tfm == NULL)
+	{
+		sha_tfm = crypto_alloc_shash("sha1", 0, 0);
+		if(IS_ERR(sha_tfm))
+		{
+			printk(KERN_INFO "Failed to allocate sha1\n");
+			sha_tfm = NULL;
+			return false;
+		}
+	}
+#endif
+
 	ret = xenon_sfc_GetNandStruct(&nand);
 	if(!ret)
 	{
@@ -797,6 +5098,7 @@ bool xenon_nandfs_init_one(void)
 		goto err_out;
 	}
 	
+	STAT_PHASE(PHASE_INIT);
 	ret = xenon_nandfs_init();
 	if(!ret)
 	{
@@ -804,13 +5106,165 @@ bool xenon_nandfs_init_one(void)
 		goto err_out;
 	}
 	
+	STAT_PHASE(PHASE_PARSELBA);
 	xenon_nandfs_ParseLBA();
+	STAT_PHASE(PHASE_SPLITROOT);
 	xenon_nandfs_SplitFsRootBuf();
+	STAT_PHASE(PHASE_EXTRACT);
 	xenon_nandfs_ExtractFsEntry();
+	STAT_PHASE(PHASE_NONE);
 	return true;
 	
 	err_out:
-		memset (&nand, 0, sizeof(DUMPDATA));
-		memset (&dumpdata, 0, sizeof(xenon_nand));
+		xenon_nandfs_remove_one();
 		return false;
 }
+
+// undoes xenon_nandfs_init_one, the sha1 transform included
+void xenon_nandfs_remove_one(void)
+{
+	if(dumpdata.LBAMap)
+		vfree(dumpdata.LBAMap);
+	xenon_nandfs_FreeConfig();
+	memset (&nand, 0, sizeof(xenon_nand));
+	memset (&dumpdata, 0, sizeof(DUMPDATA));
+#ifndef DEBUG
+	if(sha_tfm)
+		crypto_free_shash(sha_tfm);
+	sha_tfm = NULL;
+#endif
+}
+
+#ifdef DEBUG
+
+int main(int argc, char *argv[])
+{
+	int ret = 0;
+
+	// --stats may go anywhere, drop it so the positional arguments stay put
+	for(ret=1; ret<argc; ret++)
+	{
+		if(!strcmp(argv[ret], "--stats"))
+		{
+			stats_on = true;
+			memmove(&argv[ret], &argv[ret+1], (argc-ret) * sizeof(char*));
+			argc--;
+			break;
+		}
+	}
+	ret = 0;
+
+	if(argc < 3)
+	{
+		printf("Usage: %s [--stats] nandtype dump_filename.bin [command]\n", argv[0]);
+		printf("Valid nandtypes:\n\n");
+		printf("sm - Small Block (Xenon, Zephyr, Falcon, some Jasper 16MB)\n");
+		printf("bos - Big on Small Block (some Jasper 16MB)\n");
+		printf("bg - Big Block (Jasper 256/512MB\n");
+		printf("mmc - eMMC NAND (Corona)\n");
+		printf("\nCommands (default lists the filesystem):\n\n");
+		printf("gen [files] [frag%%] [bad] [stale] [seed] - write a synthetic dump to dump_filename.bin\n");
+		printf("bench baseline.txt [runs] - time scan, lba, list, extract and verify against a baseline\n");
+		printf("fsck - check every chain in the cluster table for consistency\n");
+		printf("pack dir out.bin - build a new image from a directory, using the dump as template\n");
+		printf("transcode sm|bos|bg out.bin - re-lay the spare data for another nandtype (sm and bos only)\n");
+		printf("export dir - extract new or changed files, tracked in dir/.manifest\n");
+		printf("compare other.bin - classify every block against another dump\n");
+		printf("stream out.bin [user|raw] [KB] - check EDC and copy through a bounded ring of buffers\n");
+		printf("mu [dir] - list the FATX Memory Unit of a BG dump, extract into dir if given\n");
+		printf("genmu [refdir] - write a test FATX Memory Unit into a BG dump, refdir gets its files\n");
+		printf("mobile [B-O [versions back] out.bin] - list every Mobile instance or extract one\n");
+		printf("config [offset [len]] - check the config blocks and dump a range of them\n");
+		printf("put name file - create or replace a file in place, only changed clusters are written\n");
+		printf("truncate name size - cut or zero extend a file in place\n");
+		printf("rm name - delete a file in place\n");
+		printf("batch script - apply put/truncate/rm lines from script with a single FSRoot write\n");
+		printf("hashtree - build the block hash tree, stored as dump_filename.bin.htree\n");
+		printf("rehash block [block ...] - re-read the given blocks and update the stored tree\n");
+		printf("hashdiff other.htree - list blocks that differ from another tree\n");
+		return 1;
+	}
+	
+	if(!strcmp(argv[1],"sm"))
+		fixed_type = META_TYPE_SM;
+	else if(!strcmp(argv[1],"bos"))
+		fixed_type = META_TYPE_BOS;
+	else if(!strcmp(argv[1],"bg"))
+		fixed_type = META_TYPE_BG;
+	else if(!strcmp(argv[1],"mmc"))
+		fixed_type = META_TYPE_NONE;
+	else
+	{
+		printf("Unsupported meta-type: %s\n", argv[1]);
+		return 2;
+	}
+	
+	// gen creates the dump instead of reading it
+	if((argc > 3) && !strcmp(argv[3],"gen"))
+		pFile = fopen(argv[2],"wb+");
+	else if((argc > 3) && (!strcmp(argv[3],"put") || !strcmp(argv[3],"truncate") || !strcmp(argv[3],"rm") || !strcmp(argv[3],"batch") || !strcmp(argv[3],"genmu")))
+		pFile = fopen(argv[2],"rb+");
+	else
+		pFile = fopen(argv[2],"rb");
+	if (pFile==NULL)
+	{
+		printf("Failed opening \'%s\'!!!\n", argv[2]);
+		return 4;
+	}
+	
+	STAT_PHASE(PHASE_COMMAND);
+	if(argc == 3)
+		xenon_nandfs_init_one();
+	else if(!xenon_sfc_GetNandStruct(&nand))
+		ret = 5;
+	else if(!strcmp(argv[3],"gen"))
+		ret = cmdGen(argc-4, &argv[4]);
+	else if(!strcmp(argv[3],"bench") && (argc >= 5))
+		ret = cmdBench(argv[4], (argc > 5) ? argv[5] : NULL);
+	else if(!strcmp(argv[3],"fsck"))
+		ret = cmdFsck();
+	else if(!strcmp(argv[3],"pack") && (argc == 6))
+		ret = cmdPack(argv[4], argv[5]);
+	else if(!strcmp(argv[3],"transcode") && (argc == 6))
+		ret = cmdTranscode(argv[4], argv[5]);
+	else if(!strcmp(argv[3],"export") && (argc == 5))
+		ret = cmdExport(argv[4]);
+	else if(!strcmp(argv[3],"compare") && (argc == 5))
+		ret = cmdCompare(argv[4]);
+	else if(!strcmp(argv[3],"stream") && (argc >= 5) && (argc <= 7))
+		ret = cmdStream(argv[4], (argc > 5) ? argv[5] : NULL, (argc > 6) ? argv[6] : NULL);
+	else if(!strcmp(argv[3],"genmu") && (argc <= 5))
+		ret = cmdGenMu((argc > 4) ? argv[4] : NULL);
+	else if(!strcmp(argv[3],"mu"))
+		ret = cmdMu((argc > 4) ? argv[4] : NULL);
+	else if(!strcmp(argv[3],"mobile"))
+		ret = cmdMobile(argc-4, &argv[4]);
+	else if(!strcmp(argv[3],"config") && (argc <= 6))
+		ret = cmdConfig(argc-4, &argv[4]);
+	else if((!strcmp(argv[3],"put") || !strcmp(argv[3],"truncate")) && (argc == 6))
+		ret = cmdUpdate(argv[3], 2, &argv[4]);
+	else if(!strcmp(argv[3],"rm") && (argc == 5))
+		ret = cmdUpdate(argv[3], 1, &argv[4]);
+	else if(!strcmp(argv[3],"batch") && (argc == 5))
+		ret = cmdBatch(argv[4]);
+	else if(!strcmp(argv[3],"hashtree"))
+		ret = cmdHashTree(argv[2]);
+	else if(!strcmp(argv[3],"rehash"))
+		ret = cmdRehash(argv[2], argc-4, &argv[4]);
+	else if(!strcmp(argv[3],"hashdiff") && (argc == 5))
+		ret = cmdHashDiff(argv[2], argv[4]);
+	else
+	{
+		printf("Unknown command: %s\n", argv[3]);
+		ret = 3;
+	}
+	if(mapView)
+		munmap(mapView, mapLen);
+	fclose (pFile);
+	if(stats_on)
+		statReport();
+	
+	return ret;
+}
+
+#endif
@@ -1,13 +1,22 @@
 #ifndef _XENON_NANDFS_H
 #define _XENON_NANDFS_H
 
+#ifndef DEBUG
+#include <crypto/hash.h>
+#endif
+
 #define MMC_ANCHOR_BLOCKS 		2
 #define MMC_ANCHOR_HASH_LEN		0x14
 #define MMC_ANCHOR_VERSION_POS	0x1A
 #define MMC_ANCHOR_MOBI_START	0x1C
 #define MMC_ANCHOR_MOBI_SIZE	0x4
+#define MMC_ANCHOR_SIZE			0x200
+
+#define SHA_DIGEST_LEN			0x14
+#define SHA_BLOCK_LEN			0x40
 
 #define MAX_MOBILE				0xF
+#define MAX_MOBILE_HIST			0x100 // Mobile instances indexed across all slots
 #define MOBILE_BASE				0x30
 #define MOBILE_END				0x3F
 
@@ -16,13 +25,46 @@
 
 #define FSROOT_SIZE				0x2000
 
+#define SMALL_BLOCK_SZ			0x4000
+#define SMALL_BLOCK_SZ_PHYS		0x4200
+#define SMALL_BLOCK_PAGES		32
+
+#define FS_CLUSTER_SIZE			0x4000
+#define FS_CHAIN_COUNT			(FSROOT_SIZE/2)
+#define FS_CHAIN_SPECIAL		0x1FF0 // chain values at or above are markers, not clusters
+#define FS_CHAIN_FREE			0x1FFE
+#define FS_CHAIN_END			0x1FFF
+#define FS_CHAIN_RESERVED		0x1FFD // system or bad blocks, never allocated
+#define FS_ENT_ERASED			0x05
+
+#define FSCK_CROSSLINKED		0x01
+#define FSCK_CYCLIC				0x02
+#define FSCK_TRUNCATED			0x04
+#define FSCK_BADLENGTH			0x08
+
+#define HASHTREE_MAGIC			0x48545245 // "HTRE"
+#define EXPORT_MAGIC			0x4D414E32 // "MAN2", the chain digest follows the cluster count
+
+#define FATX_MAGIC				0x58544146 // "XTAF"
+#define FATX_HEADER_SIZE		0x1000
+#define FATX_NAME_LEN			42
+#define FATX_DIRENT_DELETED		0xE5
+#define FATX_DIRENT_END			0xFF
+#define FATX_ATTR_DIR			0x10
+#define FATX_FAT16_LIMIT		0xFFF0 // cluster counts below use 16 bit FAT entries
+#define FATX_CHAIN_END			0xFFFFFFF0 // entries at or above end a chain (16 bit entries are widened)
+
 #define MOBILE_PB			32				// pages counting towards FsPageCount
 #define MOBILE_MULTI		1				// small block multiplier for (MOBILE_PB-FsPageCount)
 #define BB_MOBILE_PB		(MOBILE_PB*2)	// pages counting towards FsPageCount
 #define BB_MOBILE_MULTI		4				// small block multiplier for (BB_MOBILE_PB-FsPageCount)
 
-#define MAX_LBA				0x1000
-#define MAX_FSENT			256
+#define BB_SYSTEM_BLOCKS	0x1E0			// SizeUsableFs of big block NAND
+
+#define BB_SYSTEM_AREA		0x4000000		// system area of big block NAND, the MU follows
+
+#define MAX_LBA				0x1000			// BlockID is 12 bits wide
+#define MAX_FSENT			(FSROOT_SIZE/0x20) // FS_ENT slots in the FSRoot
 
 typedef struct _METADATA_SMALLBLOCK{
 	unsigned char BlockID1; // lba/id = (((BlockID0&0xF)<<8)+(BlockID1))
@@ -93,6 +135,17 @@ typedef struct _METADATA{
 	};
 } METADATA, *PMETADATA;
 
+typedef struct _META_FIELDS{
+	unsigned short LBA;
+	unsigned int Sequence;
+	unsigned char Sequence3; // small block only
+	unsigned char BadBlock;
+	unsigned char FsSize0;
+	unsigned char FsSize1;
+	unsigned char FsPageCount; // raw, units of 4 pages on big block
+	unsigned char BlockType;
+} META_FIELDS, *PMETA_FIELDS;
+
 typedef struct _PAGEDATA{
 	unsigned char User[512];
 	METADATA Meta;
@@ -118,38 +171,222 @@ typedef struct _MOBILE_ENT{
 	unsigned char Version;
 	unsigned short Block;
 	unsigned int Size;
+	unsigned char Sha[SHA_DIGEST_LEN]; // digest of the payload, taken during the scan
 } MOBILE_ENT, *PMOBILE_ENT;
 
+typedef struct _MOBILE_INST{
+	unsigned char Mobile; // block type, MOBILE_BASE+1 - MOBILE_END-1
+	unsigned char Page; // first page of the instance in its block, 0 on MMC
+	unsigned short Block;
+	unsigned int Sequence;
+	unsigned int Size;
+} MOBILE_INST, *PMOBILE_INST;
+
+typedef struct _MOBILE_SEG{
+	unsigned char* Data; // points into the flash window
+	unsigned int Len;
+} MOBILE_SEG, *PMOBILE_SEG;
+
+#ifdef DEBUG
+typedef struct _SHA_CTX{
+	unsigned int State[5];
+	unsigned long long Count;
+	unsigned char Buf[SHA_BLOCK_LEN];
+} SHA_CTX, *PSHA_CTX;
+#else
+typedef struct _SHA_CTX{
+	unsigned char Desc[sizeof(struct shash_desc) + HASH_MAX_DESCSIZE] CRYPTO_MINALIGN_ATTR; // shash_desc of the kernel's sha1
+} SHA_CTX, *PSHA_CTX;
+#endif
+
+typedef struct _HASHTREE{
+	unsigned int LeafCount; // physical blocks covered
+	unsigned int LeafBase; // index of the first leaf in Node, power of two
+	unsigned int BlockSz; // BlockSzPhys the leaves were hashed over
+	unsigned char (*Node)[SHA_DIGEST_LEN]; // Node[1] is the root, children of n are 2n and 2n+1
+	unsigned char* Dirty;
+} HASHTREE, *PHASHTREE;
+
+typedef struct _FSCK_RESULT{
+	unsigned int Clusters;
+	unsigned int Used;
+	unsigned int Free;
+	unsigned int Orphaned;
+	unsigned int Files;
+	unsigned int CrossLinked;
+	unsigned int Cyclic;
+	unsigned int Truncated;
+	unsigned int BadLength;
+	unsigned char EntFlags[MAX_FSENT];
+} FSCK_RESULT, *PFSCK_RESULT;
+
+typedef struct _FS_ALLOC{
+	unsigned int Clusters;
+	unsigned int FreeCount;
+	unsigned short* Chain; // host order chain table the allocator edits, owned by the caller
+	unsigned int* Free; // one bit per cluster, set when it can be handed out
+	unsigned int* Reserved; // one bit per cluster, never handed out whatever the chain says
+	unsigned int* Wear; // erase estimate per cluster, see xenon_nandfs_AllocLoadWear
+	unsigned int* Claim; // LBA of each erased slot claimed for its cluster, INVALID elsewhere, NULL without claims
+} FS_ALLOC, *PFS_ALLOC;
+
+// results of the FS update calls besides 0
+#define FS_ERR_NOTFOUND			1
+#define FS_ERR_NOSPACE			2
+#define FS_ERR_NAME				3 // name too long or no FS_ENT slot left
+#define FS_ERR_IO				4
+
+typedef struct _FS_UPDATE{
+	unsigned short Chain[FS_CHAIN_COUNT]; // working chain table, host order
+	FS_ENT Ent[MAX_FSENT]; // working FS_ENT table
+	unsigned short Old[FS_CHAIN_COUNT]; // scratch, the chain being replaced
+	unsigned short New[FS_CHAIN_COUNT]; // scratch, the chain replacing it
+	FS_ALLOC Alloc;
+	unsigned char* Staged[FS_CHAIN_COUNT]; // cluster data held back until the commit, NULL when on flash
+	unsigned int StagedCount;
+	unsigned char* BlockBuf;
+	unsigned char* ClusterBuf;
+	unsigned int Programs; // blocks programmed so far
+} FS_UPDATE, *PFS_UPDATE;
+
+typedef struct _FATX_DIRENT{
+	unsigned char NameLen;
+	unsigned char Attributes;
+	char Name[FATX_NAME_LEN];
+	unsigned int FirstCluster; // BE
+	unsigned int FileSize; // BE
+	unsigned int CreationTime;
+	unsigned int LastWriteTime;
+	unsigned int LastAccessTime;
+} FATX_DIRENT, *PFATX_DIRENT;
+
+typedef struct _FATX_EXTENT{
+	unsigned int Cluster;
+	unsigned int Count;
+} FATX_EXTENT, *PFATX_EXTENT;
+
+typedef struct _FATX_VOL{
+	unsigned int Start; // dump offset of the partition, spare included
+	unsigned int Size; // user bytes
+	unsigned int ClusterSz;
+	unsigned int ClusterCount;
+	unsigned int RootCluster;
+	unsigned int DataOffset;
+	unsigned int* Fat; // whole table, widened to 32 bit host order
+	unsigned char* PageBuf; // one block as read from the SFC
+	unsigned int Cached; // block held in PageBuf, INVALID when none
+} FATX_VOL, *PFATX_VOL;
+
+typedef struct _CONFIG_CACHE{
+	unsigned char* Buf; // CONFIG_BLOCKS user blocks
+	unsigned int Gen; // xenon_sfc_GetConfigGen() at load time
+	bool Loaded;
+	bool Valid[CONFIG_BLOCKS];
+} CONFIG_CACHE, *PCONFIG_CACHE;
+
 typedef struct _DUMPDATA{
 	unsigned short MUStart;
 	unsigned short FSSize;
 	unsigned short FSStartBlock;
 	unsigned short FSRootBlock;
 	unsigned short FSRootVer;
-	unsigned short LBAMap[MAX_LBA];
+	unsigned short* LBAMap;
+	unsigned int LBACount;
 	unsigned char FSRootBuf[FSROOT_SIZE];
 	unsigned short* pFSRootBufShort;
 	unsigned char FSRootFileBuf[FSROOT_SIZE];
 	MOBILE_ENT Mobile[MAX_MOBILE];
+	MOBILE_INST MobileHist[MAX_MOBILE_HIST];
+	unsigned int MobileHistCount;
+	CONFIG_CACHE Config;
+	bool AnchorValid[MMC_ANCHOR_BLOCKS];
+	unsigned char AnchorNum;
 	FS_ENT *FsEnt[MAX_FSENT];
 } DUMPDATA, *PDUMPDATA;
 
+void xenon_nandfs_ShaInit(SHA_CTX* ctx);
+void xenon_nandfs_ShaUpdate(SHA_CTX* ctx, const unsigned char* data, unsigned int len);
+void xenon_nandfs_ShaFinal(SHA_CTX* ctx, unsigned char* digest);
+void xenon_nandfs_Sha(const unsigned char* data, unsigned int len, unsigned char* digest);
 void xenon_nandfs_CalcECC(unsigned int* data, unsigned char* edc);
 unsigned short xenon_nandfs_GetLBA(METADATA* meta);
 unsigned char xenon_nandfs_GetBlockType(METADATA* meta);
-unsigned char xenon_nandfs_GetBadblockMark(METADATA* meta);
+unsigned char xenon_nandfs_GetBadBlockMark(METADATA* meta);
 unsigned int xenon_nandfs_GetFsSize(METADATA* meta);
 unsigned int xenon_nandfs_GetFsFreepages(METADATA* meta);
 unsigned int xenon_nandfs_GetFsSequence(METADATA* meta);
+void xenon_nandfs_SetLBA(METADATA* meta, unsigned short lba);
+void xenon_nandfs_SetBlockType(METADATA* meta, unsigned char type);
+void xenon_nandfs_SetFsSequence(METADATA* meta, unsigned int seq);
+void xenon_nandfs_SetBadBlockMark(METADATA* meta, unsigned char mark);
+void xenon_nandfs_UnpackMeta(METADATA* meta, unsigned char type, META_FIELDS* f);
+void xenon_nandfs_PackMeta(META_FIELDS* f, unsigned char type, METADATA* meta);
+bool xenon_nandfs_TranscodeMeta(METADATA* src, unsigned char srcType, METADATA* dst, unsigned char dstType, unsigned int sub);
 bool xenon_nandfs_CheckMMCAnchorSha(unsigned char* buf);
+void xenon_nandfs_SetMMCAnchorSha(unsigned char* buf);
 unsigned short xenon_nandfs_GetMMCAnchorVer(unsigned char* buf);
+void xenon_nandfs_SetMMCAnchorVer(unsigned char* buf, unsigned short ver);
 unsigned short xenon_nandfs_GetMMCMobileBlock(unsigned char* buf, unsigned char mobi);
+void xenon_nandfs_SetMMCMobileBlock(unsigned char* buf, unsigned char mobi, unsigned short block);
+void xenon_nandfs_SetMMCMobileSize(unsigned char* buf, unsigned char mobi, unsigned short size);
 unsigned short xenon_nandfs_GetMMCMobileSize(unsigned char* buf, unsigned char mobi);
+int xenon_nandfs_FindMobileInst(unsigned char mobi, unsigned int back);
+unsigned int xenon_nandfs_GetMobileInstAge(unsigned int idx);
+unsigned int xenon_nandfs_MapMobileInst(MOBILE_INST* inst, MOBILE_SEG* seg, unsigned int max);
+int xenon_nandfs_ReadMobileInst(MOBILE_INST* inst, unsigned char* buf);
 bool xenon_nandfs_CheckECC(PAGEDATA* pdata);
+void xenon_nandfs_SetECC(PAGEDATA* pdata);
+unsigned int xenon_nandfs_GetClusterBlock(unsigned int cluster);
+int xenon_nandfs_ReadCluster(unsigned char* buf, unsigned int cluster);
+int xenon_nandfs_ReadConfig(unsigned char* buf, unsigned int off, unsigned int len);
+bool xenon_nandfs_ReadConfigByte(unsigned int off, unsigned char* val);
+bool xenon_nandfs_ReadConfigShort(unsigned int off, unsigned short* val);
+bool xenon_nandfs_ReadConfigInt(unsigned int off, unsigned int* val);
+bool xenon_nandfs_IsConfigBlockValid(unsigned int idx);
+void xenon_nandfs_FreeConfig(void);
 int xenon_nandfs_ExtractFsEntry(void);
+unsigned int xenon_nandfs_GetSystemBlocks(void);
 int xenon_nandfs_ParseLBA(void);
 int xenon_nandfs_SplitFsRootBuf(void);
+unsigned int xenon_nandfs_GetClusterCount(void);
+int xenon_nandfs_CheckFs(FSCK_RESULT* res);
+bool xenon_nandfs_AllocInit(FS_ALLOC* a, unsigned short* chain, unsigned int clusters);
+void xenon_nandfs_AllocDone(FS_ALLOC* a);
+void xenon_nandfs_AllocLoadWear(FS_ALLOC* a);
+unsigned int xenon_nandfs_AllocClusterBlock(FS_ALLOC* a, unsigned int cluster);
+bool xenon_nandfs_AllocIsFree(FS_ALLOC* a, unsigned int cluster);
+void xenon_nandfs_AllocReserve(FS_ALLOC* a, unsigned int cluster);
+void xenon_nandfs_AllocSetChain(FS_ALLOC* a, unsigned int cluster, unsigned short next);
+unsigned int xenon_nandfs_AllocChain(FS_ALLOC* a, unsigned int need);
+void xenon_nandfs_AllocReserveSystem(FS_ALLOC* a);
+unsigned int xenon_nandfs_AllocFreeChain(FS_ALLOC* a, unsigned int cluster);
+void xenon_nandfs_BuildClusterBlock(unsigned char* out, unsigned char* tmpl, unsigned char* data, unsigned int cluster);
+void xenon_nandfs_BuildRootBlock(unsigned char* out, unsigned char* tmpl, unsigned char* root, unsigned int seq, unsigned int block);
+void xenon_nandfs_BuildRoot(unsigned char* root, unsigned short* chain, FS_ENT* ents);
+unsigned int xenon_nandfs_FindErasedSlots(unsigned int* lba, unsigned int clusters);
+int xenon_nandfs_UpdateBegin(FS_UPDATE* up);
+int xenon_nandfs_UpdateWrite(FS_UPDATE* up, const char* name, const unsigned char* data, unsigned int len, unsigned int stamp);
+int xenon_nandfs_UpdateTruncate(FS_UPDATE* up, const char* name, unsigned int size, unsigned int stamp);
+int xenon_nandfs_UpdateDelete(FS_UPDATE* up, const char* name);
+int xenon_nandfs_UpdateCommit(FS_UPDATE* up);
+void xenon_nandfs_UpdateAbort(FS_UPDATE* up);
+int xenon_nandfs_WriteFile(const char* name, const unsigned char* data, unsigned int len, unsigned int stamp);
+int xenon_nandfs_TruncateFile(const char* name, unsigned int size, unsigned int stamp);
+int xenon_nandfs_DeleteFile(const char* name);
+bool xenon_nandfs_HashTreeInit(HASHTREE* tree, unsigned int leaves, unsigned int blocksz);
+void xenon_nandfs_HashTreeFree(HASHTREE* tree);
+void xenon_nandfs_HashTreeSetLeaf(HASHTREE* tree, unsigned int block, const unsigned char* data);
+void xenon_nandfs_HashTreeUpdate(HASHTREE* tree);
+int xenon_nandfs_HashTreeBuild(HASHTREE* tree);
+int xenon_nandfs_HashTreeRefresh(HASHTREE* tree, const unsigned int* blocks, unsigned int cnt);
+unsigned int xenon_nandfs_HashTreeDiff(HASHTREE* a, HASHTREE* b, unsigned int* blocks, unsigned int max);
+bool xenon_nandfs_FatxOpen(FATX_VOL* vol);
+void xenon_nandfs_FatxClose(FATX_VOL* vol);
+int xenon_nandfs_FatxRead(FATX_VOL* vol, unsigned char* buf, unsigned int off, unsigned int len);
+unsigned int xenon_nandfs_FatxExtents(FATX_VOL* vol, unsigned int cluster, FATX_EXTENT* ext, unsigned int max);
+unsigned int xenon_nandfs_FatxClusterOffset(FATX_VOL* vol, unsigned int cluster);
 bool xenon_nandfs_init(void);
 bool xenon_nandfs_init_one(void);
+void xenon_nandfs_remove_one(void);
 
 #endif
@@ -17,6 +17,9 @@
  *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
  */
 
+#ifdef SFC_MODEL
+#include "xenon_sfc_model.h" // userspace build against the register model, see xenon_sfc_model.c
+#else
 #include <linux/kernel.h>
 #include <linux/module.h>
 #include <linux/pci.h>
@@ -26,6 +29,9 @@
 #include <linux/dma-mapping.h>
 #include <linux/types.h>
 #include <linux/vmalloc.h>
+#include <linux/delay.h>
+#include <linux/ktime.h>
+#endif
 
 #include "xenon_sfc.h"
 
@@ -35,21 +41,66 @@
 #define SFC_SIZE 0x400
 #define DMA_SIZE 0x10000
 
+// sfc.dmabuf is used as two halves, one is being transferred while the other is copied;
+// a half holds sfc.DmaChunk bytes of data followed by their spare
+#define DMA_HALF (DMA_SIZE/2)
+#define DMA_MAX_UNITS 16 // CONFIG_DMA_LEN limit
+#define DMA_LEGACY_CHUNK 0x2000 // what every command used to move, kept to measure against
+#define SFC_POOL_BUFS 4 // block sized scratch buffers kept per device, nesting goes 2 deep
+#define DIRECT_MAX_PAGES (MAX_BLOCK_SZ/PAGE_SIZE) // caller pages mapped at once by a zero copy read
+
 #define MAP_ADDR 0x80000200C8000000ULL
 #define MAP_SIZE 0x4000000
 
 #define DEBUG_OUT 1
+//#define MEASURE_DMA_CHUNK // time the DMA chunk against the legacy one at probe
+
+// busy wait policy per command class: spin for SpinUs, then sleep starting at SleepMinUs and
+// doubling up to SleepMaxUs; after TimeoutUs the command is given up on
+typedef struct _xenon_sfc_waitpolicy
+{
+	unsigned int SpinUs;
+	unsigned int SleepMinUs;
+	unsigned int SleepMaxUs;
+	unsigned int TimeoutUs;
+} xenon_sfc_waitpolicy;
+
+static const xenon_sfc_waitpolicy _xenon_sfc_waitpolicies[SFC_WAIT_TYPES] = {
+	{ 100,  20,   50,   20000 }, // SFC_WAIT_READ, ~25us page reads rarely get past the spin
+	{  20, 100,  200,  100000 }, // SFC_WAIT_PROGRAM, ~200-700us
+	{   0, 500, 2000, 1000000 }, // SFC_WAIT_ERASE, ~2-3ms, never worth spinning
+	{  50, 100,  500,  200000 }, // SFC_WAIT_DMA_READ, 16 pages
+	{  20, 200, 1000, 1000000 }, // SFC_WAIT_DMA_WRITE, 16 page programs
+	{  50,  20,   50,   20000 }, // SFC_WAIT_MISC
+};
 
 typedef struct _xenon_sfc
 {
 	void __iomem *base;
 	void __iomem *mappedflash;
+	struct device *dev;
 	wait_queue_head_t wait_q;
 	spinlock_t fifo_lock;
 	
 	dma_addr_t dmaaddr;
 	unsigned char *dmabuf;
 	xenon_nand nand;
+	unsigned int ConfigGen; // bumped by every write that touches the config blocks
+
+	int irq; // -1 while commands are polled
+	unsigned long IntEn; // CONFIG_INT_EN once the handler is installed, kept in every CONFIG written
+	xenon_sfc_cmpl cmpl; // guarded by fifo_lock
+	unsigned int IrqTimeouts;
+	xenon_sfc_waitstat WaitStats[SFC_WAIT_TYPES];
+	bool ZeroCopy; // separated reads DMA straight into the caller's buffer
+	unsigned long Config; // shadow of SFCX_CONFIG, which is only written through _xenon_sfc_WriteConfig
+	unsigned int DmaUnit; // what CONFIG_DMA_LEN counts in, a page or 4 small pages on big block
+	unsigned int DmaChunk; // user bytes per DMA command, see _xenon_sfc_SetupDMAChunk
+
+	spinlock_t pool_lock;
+	unsigned char* Pool[SFC_POOL_BUFS]; // BlockSzPhys each, from probe to remove
+	unsigned int PoolFree; // one bit per free Pool entry
+	unsigned int PoolMisses; // gets served by vmalloc because the pool was empty
 } xenon_sfc, *pxenon_sfc;
 
 static xenon_sfc sfc;
@@ -70,13 +121,254 @@ inline void xenon_sfc_WriteReg(unsigned int addr, unsigned long data)
 	writel(__builtin_bswap32(data), (sfc.base + addr));
 }
 
+// skips the MMIO when CONFIG already holds the value
+static void _xenon_sfc_WriteConfig(unsigned long config)
+{
+	if(config == sfc.Config)
+		return;
+	sfc.Config = config;
+	xenon_sfc_WriteReg(SFCX_CONFIG, config);
+}
+
+// sets up CONFIG once for a run of block commands: DMA length for one chunk and write enable
+// when writing; returns the CONFIG to hand back to xenon_sfc_EndSession
+unsigned long xenon_sfc_BeginSession(bool write)
+{
+	unsigned long prev = sfc.Config;
+	unsigned long config = (prev&~(CONFIG_DMA_LEN|CONFIG_INT_EN|CONFIG_WP_EN))|sfc.IntEn;
+
+	config |= CONFIG_DMA_PAGES(sfc.DmaChunk/sfc.DmaUnit);
+	if(write)
+		config |= CONFIG_WP_EN;
+	_xenon_sfc_WriteConfig(config);
+	return prev;
+}
+
+void xenon_sfc_EndSession(unsigned long config)
+{
+	_xenon_sfc_WriteConfig(config);
+}
+
+// true when CONFIG already holds what BeginSession would set up, a write session serves reads too
+static bool _xenon_sfc_InSession(bool write)
+{
+	if((sfc.Config & CONFIG_DMA_LEN) != CONFIG_DMA_PAGES(sfc.DmaChunk/sfc.DmaUnit))
+		return false;
+	if((sfc.Config & CONFIG_INT_EN) != sfc.IntEn)
+		return false;
+	return !write || (sfc.Config & CONFIG_WP_EN);
+}
+
+// a BlockSzPhys scratch buffer, from the pool unless every entry is in use
+static unsigned char* _xenon_sfc_GetBuf(void)
+{
+	unsigned long flags;
+	unsigned int i;
+
+	spin_lock_irqsave(&sfc.pool_lock, flags);
+	for(i = 0; i < SFC_POOL_BUFS; i++)
+	{
+		if(sfc.PoolFree & (1 << i))
+		{
+			sfc.PoolFree &= ~(1 << i);
+			spin_unlock_irqrestore(&sfc.pool_lock, flags);
+			return sfc.Pool[i];
+		}
+	}
+	sfc.PoolMisses++;
+	spin_unlock_irqrestore(&sfc.pool_lock, flags);
+	return (unsigned char *)vmalloc(sfc.nand.BlockSzPhys);
+}
+
+static void _xenon_sfc_PutBuf(unsigned char* buf)
+{
+	unsigned long flags;
+	unsigned int i;
+
+	if(buf == NULL)
+		return;
+	for(i = 0; i < SFC_POOL_BUFS; i++)
+	{
+		if(buf == sfc.Pool[i])
+		{
+			spin_lock_irqsave(&sfc.pool_lock, flags);
+			sfc.PoolFree |= 1 << i;
+			spin_unlock_irqrestore(&sfc.pool_lock, flags);
+			return;
+		}
+	}
+	vfree(buf);
+}
+
+static bool _xenon_sfc_PoolInit(void)
+{
+	unsigned int i;
+
+	spin_lock_init(&sfc.pool_lock);
+	sfc.PoolFree = 0;
+	for(i = 0; i < SFC_POOL_BUFS; i++)
+	{
+		sfc.Pool[i] = (unsigned char *)vmalloc(sfc.nand.BlockSzPhys);
+		if(sfc.Pool[i] == NULL)
+			return false;
+		sfc.PoolFree |= 1 << i;
+	}
+	return true;
+}
+
+static void _xenon_sfc_PoolFree(void)
+{
+	unsigned int i;
+
+	for(i = 0; i < SFC_POOL_BUFS; i++)
+	{
+		if(sfc.Pool[i])
+			vfree(sfc.Pool[i]);
+		sfc.Pool[i] = NULL;
+	}
+	sfc.PoolFree = 0;
+}
+
+static inline void _xenon_sfc_NoteWrite(unsigned int block)
+{
+	if((block >= sfc.nand.ConfigBlock) && (block < (sfc.nand.ConfigBlock + CONFIG_BLOCKS)))
+		sfc.ConfigGen++;
+}
+
+unsigned int xenon_sfc_GetConfigGen(void)
+{
+	return sfc.ConfigGen;
+}
+
+static irqreturn_t _xenon_sfc_irq(int irq, void* dev_id)
+{
+	unsigned long status;
+	bool ours;
+
+	spin_lock(&sfc.fifo_lock);
+	status = xenon_sfc_ReadReg(SFCX_STATUS);
+	ours = xenon_sfc_CmplIrq(&sfc.cmpl, status);
+	if(ours)
+		xenon_sfc_WriteReg(SFCX_STATUS, STATUS_INT_CP); // ack only, the error bits stay for the waiter
+	spin_unlock(&sfc.fifo_lock);
+
+	if(!ours)
+		return IRQ_NONE;
+	if(xenon_sfc_CmplReady(&sfc.cmpl))
+		wake_up(&sfc.wait_q);
+	return IRQ_HANDLED;
+}
+
+static void _xenon_sfc_NoteWait(unsigned int type, s64 us, unsigned int sleeps, int status)
+{
+	xenon_sfc_waitstat* st = &sfc.WaitStats[type];
+
+	st->Count++;
+	st->Sleeps += sleeps;
+	st->TotalUs += us;
+	if(us > st->MaxUs)
+		st->MaxUs = us;
+	if(status & STATUS_SW_TIMEOUT)
+		st->Timeouts++;
+}
+
+// polls STATUS until the controller is idle, spinning first and then backing off to sleeps
+// as the command class allows; returns STATUS, with STATUS_SW_TIMEOUT when it never got idle
+static int _xenon_sfc_WaitReady(unsigned int type)
+{
+	const xenon_sfc_waitpolicy* pol = &_xenon_sfc_waitpolicies[type];
+	ktime_t start = ktime_get();
+	unsigned int sleep = pol->SleepMinUs, sleeps = 0;
+	s64 us;
+	int status;
+
+	while((status = xenon_sfc_ReadReg(SFCX_STATUS)) & STATUS_BUSY)
+	{
+		us = ktime_us_delta(ktime_get(), start);
+		if(us >= pol->TimeoutUs)
+		{
+			printk(KERN_INFO " ! SFCX: timeout after %lldus waiting on command class %d, status %08X\n", us, type, status);
+			status |= STATUS_SW_TIMEOUT;
+			break;
+		}
+		if(us < pol->SpinUs)
+		{
+			cpu_relax();
+			continue;
+		}
+		usleep_range(sleep, sleep*2);
+		sleeps++;
+		if((sleep*2) <= pol->SleepMaxUs)
+			sleep *= 2;
+	}
+	_xenon_sfc_NoteWait(type, ktime_us_delta(ktime_get(), start), sleeps, status);
+	return status;
+}
+
+// starts a long running command (erase, program, DMA), _xenon_sfc_Finish waits for it
+static void _xenon_sfc_Issue(unsigned int cmd)
+{
+	unsigned long flags;
+
+	if(sfc.irq >= 0)
+	{
+		spin_lock_irqsave(&sfc.fifo_lock, flags);
+		xenon_sfc_CmplArm(&sfc.cmpl);
+		spin_unlock_irqrestore(&sfc.fifo_lock, flags);
+	}
+	xenon_sfc_WriteReg(SFCX_COMMAND, cmd);
+}
+
+// returns STATUS once the controller is idle, sleeping on the interrupt when there is one
+static int _xenon_sfc_Finish(unsigned int type)
+{
+	unsigned long flags;
+	ktime_t start;
+
+	if(sfc.irq < 0)
+		return _xenon_sfc_WaitReady(type);
+
+	start = ktime_get();
+	if(!wait_event_timeout(sfc.wait_q, xenon_sfc_CmplReady(&sfc.cmpl), usecs_to_jiffies(_xenon_sfc_waitpolicies[type].TimeoutUs)))
+	{
+		spin_lock_irqsave(&sfc.fifo_lock, flags);
+		sfc.cmpl.Armed = false;
+		spin_unlock_irqrestore(&sfc.fifo_lock, flags);
+		sfc.IrqTimeouts++;
+		// lost interrupt, whatever is left is polled
+		return _xenon_sfc_WaitReady(type);
+	}
+	_xenon_sfc_NoteWait(type, ktime_us_delta(ktime_get(), start), 1, 0);
+	return xenon_sfc_ReadReg(SFCX_STATUS);
+}
+
+static int _xenon_sfc_Command(unsigned int cmd, unsigned int type)
+{
+	_xenon_sfc_Issue(cmd);
+	return _xenon_sfc_Finish(type);
+}
+
+void xenon_sfc_GetWaitStats(xenon_sfc_waitstat* stats)
+{
+	memcpy(stats, sfc.WaitStats, sizeof(sfc.WaitStats));
+}
+
+void xenon_sfc_ResetWaitStats(void)
+{
+	memset(sfc.WaitStats, 0, sizeof(sfc.WaitStats));
+}
+
 int xenon_sfc_EraseBlock(unsigned int block)
 {
 	int status;
+	unsigned long config;
 	int addr = block * sfc.nand.BlockSz;
 	
-	// Enable Writes
-	xenon_sfc_WriteReg(SFCX_CONFIG, xenon_sfc_ReadReg(SFCX_CONFIG) | CONFIG_WP_EN);
+	_xenon_sfc_NoteWrite(block);
+
+	// Enable Writes, already on inside a write session; the steps up to the erase are polled
+	config = sfc.Config;
+	_xenon_sfc_WriteConfig((config | CONFIG_WP_EN) & ~CONFIG_INT_EN);
 	xenon_sfc_WriteReg(SFCX_STATUS, 0xFF);
 
 	// Set flash address (logical)
@@ -84,28 +376,24 @@ int xenon_sfc_EraseBlock(unsigned int block)
 	xenon_sfc_WriteReg(SFCX_ADDRESS, addr);
 
 	// Wait Busy
-	while (xenon_sfc_ReadReg(SFCX_STATUS) & STATUS_BUSY);
+	_xenon_sfc_WaitReady(SFC_WAIT_MISC);
 
 	// Unlock sequence (for erase)
 	xenon_sfc_WriteReg(SFCX_COMMAND, UNLOCK_CMD_1);
 	xenon_sfc_WriteReg(SFCX_COMMAND, UNLOCK_CMD_0);
 
 	// Wait Busy
-	while (xenon_sfc_ReadReg(SFCX_STATUS) & STATUS_BUSY);
-
-	// Command the block erase
-	xenon_sfc_WriteReg(SFCX_COMMAND, BLOCK_ERASE);
-
-	// Wait Busy
-	while (xenon_sfc_ReadReg(SFCX_STATUS) & STATUS_BUSY);
+	_xenon_sfc_WaitReady(SFC_WAIT_MISC);
 
-	status = xenon_sfc_ReadReg(SFCX_STATUS);
+	// Command the block erase and wait, on the interrupt when there is one
+	_xenon_sfc_WriteConfig(config | CONFIG_WP_EN);
+	status = _xenon_sfc_Command(BLOCK_ERASE, SFC_WAIT_ERASE);
 	//if (!SFCX_SUCCESS(status))
 	//	printf(" ! SFCX: Unexpected sfc.erase_block status %08X\n", status);
 	xenon_sfc_WriteReg(SFCX_STATUS, 0xFF);
 
-	// Disable Writes
-	xenon_sfc_WriteReg(SFCX_CONFIG, xenon_sfc_ReadReg(SFCX_CONFIG) & ~CONFIG_WP_EN);
+	// Disable Writes, unless a write session had them on
+	_xenon_sfc_WriteConfig(config);
 
 	return status;
 }
@@ -113,9 +401,12 @@ int xenon_sfc_EraseBlock(unsigned int block)
 int _xenon_sfc_ReadPage(unsigned char* buf, unsigned int page, bool raw)
 {
 	int status, i, PageSz;
+	unsigned long config = sfc.Config;
 	int addr = page * sfc.nand.PageSz;
 	unsigned char* data = buf;
 
+	// polled, a completion interrupt would find nobody waiting for it
+	_xenon_sfc_WriteConfig(config & ~CONFIG_INT_EN);
 	xenon_sfc_WriteReg(SFCX_STATUS, xenon_sfc_ReadReg(SFCX_STATUS));
 
 	// Set flash address (logical)
@@ -128,7 +419,7 @@ int _xenon_sfc_ReadPage(unsigned char* buf, unsigned int page, bool raw)
 	xenon_sfc_WriteReg(SFCX_COMMAND, raw ? PHY_PAGE_TO_BUF : LOG_PAGE_TO_BUF);
 
 	// Wait Busy
-	while ((status = xenon_sfc_ReadReg(SFCX_STATUS)) & STATUS_BUSY);
+	status = _xenon_sfc_WaitReady(SFC_WAIT_READ);
 
 	if (!SFCX_SUCCESS(status))
 	{
@@ -157,6 +448,7 @@ int _xenon_sfc_ReadPage(unsigned char* buf, unsigned int page, bool raw)
 		*(int*)(data + i) = __builtin_bswap32(xenon_sfc_ReadReg(SFCX_DATA));
 	}
 
+	_xenon_sfc_WriteConfig(config);
 	return status;
 }
 
@@ -173,13 +465,16 @@ int xenon_sfc_ReadPageLog(unsigned char* buf, unsigned int page)
 int xenon_sfc_WritePage(unsigned char* buf, unsigned int page)
 {
 	int i, status;
+	unsigned long config;
 	int addr = page * sfc.nand.PageSz;
 	unsigned char* data = buf;
 	
+	_xenon_sfc_NoteWrite(page / sfc.nand.PagesInBlock);
 	xenon_sfc_WriteReg(SFCX_STATUS, 0xFF);
 
-	// Enable Writes
-	xenon_sfc_WriteReg(SFCX_CONFIG, xenon_sfc_ReadReg(SFCX_CONFIG) | CONFIG_WP_EN);
+	// Enable Writes, already on inside a write session; the steps up to the program are polled
+	config = sfc.Config;
+	_xenon_sfc_WriteConfig((config | CONFIG_WP_EN) & ~CONFIG_INT_EN);
 
 	// Set internal page buffer pointer to 0
 	xenon_sfc_WriteReg(SFCX_ADDRESS, 0);
@@ -202,48 +497,52 @@ int xenon_sfc_WritePage(unsigned char* buf, unsigned int page)
 	xenon_sfc_WriteReg(SFCX_COMMAND, UNLOCK_CMD_1);
 
 	// Wait Busy
-	while (xenon_sfc_ReadReg(SFCX_STATUS) & STATUS_BUSY);
-
-	// Command the write
-	xenon_sfc_WriteReg(SFCX_COMMAND, WRITE_PAGE_TO_PHY);
+	_xenon_sfc_WaitReady(SFC_WAIT_MISC);
 
-	// Wait Busy
-	while (xenon_sfc_ReadReg(SFCX_STATUS) & STATUS_BUSY);
-
-	status = xenon_sfc_ReadReg(SFCX_STATUS);
+	// Command the write and wait, on the interrupt when there is one
+	_xenon_sfc_WriteConfig(config | CONFIG_WP_EN);
+	status = _xenon_sfc_Command(WRITE_PAGE_TO_PHY, SFC_WAIT_PROGRAM);
 	if (!SFCX_SUCCESS(status))
 		printk(KERN_INFO " ! SFCX: Unexpected sfc.writepage status %08X\n", status);
 
-	// Disable Writes
-	xenon_sfc_WriteReg(SFCX_CONFIG, xenon_sfc_ReadReg(SFCX_CONFIG) & ~CONFIG_WP_EN);
+	// Disable Writes, unless a write session had them on
+	_xenon_sfc_WriteConfig(config);
 
 	return status;
 }
 
+// points the controller at one half of sfc.dmabuf and starts a DMA command on addr
+static void _xenon_sfc_StartDMA(unsigned int cmd, unsigned int half, unsigned int addr)
+{
+	xenon_sfc_WriteReg(SFCX_STATUS, xenon_sfc_ReadReg(SFCX_STATUS));
+	if(cmd == DMA_RAM_TO_PHY)
+	{
+		xenon_sfc_WriteReg(SFCX_COMMAND, UNLOCK_CMD_0);
+		xenon_sfc_WriteReg(SFCX_COMMAND, UNLOCK_CMD_1);
+	}
+	xenon_sfc_WriteReg(SFCX_DATAPHYADDR, sfc.dmaaddr+half);
+	xenon_sfc_WriteReg(SFCX_SPAREPHYADDR, sfc.dmaaddr+half+sfc.DmaChunk);
+	xenon_sfc_WriteReg(SFCX_ADDRESS, addr);
+	_xenon_sfc_Issue(cmd);
+}
+
+// reads blockSz user bytes at addr with their spare, chunk k+1 is transferred into one half
+// of the DMA buffer while chunk k is de-interleaved out of the other
 // returns 1 on bad block, 2 on unrecoverable ECC
-// data NULL to skip keeping data
-int xenon_sfc_ReadBlock(unsigned char* buf, unsigned int block)
+static int _xenon_sfc_ReadBlockDMA(unsigned char* buf, unsigned int addr, unsigned int blockSz, unsigned int block)
 {
-	int i, status, block_read;
-	int addr = block * sfc.nand.BlockSz;
-	
+	unsigned int k, i, half, chunks = blockSz / sfc.DmaChunk;
 	unsigned char* data = buf;
-	unsigned int cur_addr = addr;
-	
+	int status;
+
 	if(buf != NULL)
-		memset(data, 0, (sfc.nand.PagesInBlock*sfc.nand.PageSzPhys));
+		memset(data, 0, (blockSz/sfc.nand.PageSz)*sfc.nand.PageSzPhys);
 
-	for(block_read = 0; block_read < sfc.nand.BlockSzPhys; block_read += 0x2000, cur_addr += 0x2000)
+	_xenon_sfc_StartDMA(DMA_PHY_TO_RAM, 0, addr);
+	for(k = 0; k < chunks; k++)
 	{
-		xenon_sfc_WriteReg(SFCX_STATUS, xenon_sfc_ReadReg(SFCX_STATUS));
-		xenon_sfc_WriteReg(SFCX_DATAPHYADDR, sfc.dmaaddr);
-		xenon_sfc_WriteReg(SFCX_SPAREPHYADDR, sfc.dmaaddr+0xC000);
-		xenon_sfc_WriteReg(SFCX_ADDRESS, cur_addr);
-		xenon_sfc_WriteReg(SFCX_COMMAND, DMA_PHY_TO_RAM);
-		
-		while(xenon_sfc_ReadReg(SFCX_STATUS) & STATUS_BUSY);
-		
-		status = xenon_sfc_ReadReg(SFCX_STATUS);
+		half = (k&1) ? DMA_HALF : 0;
+		status = _xenon_sfc_Finish(SFC_WAIT_DMA_READ);
 		if(status&STATUS_ERROR)
 		{
 			printk(KERN_INFO "error in status, %08x\n", status);
@@ -258,12 +557,15 @@ int xenon_sfc_ReadBlock(unsigned char* buf, unsigned int block)
 				return 2;
 			}
 		}
+		// next chunk goes into the other half while this one is copied
+		if((k+1) < chunks)
+			_xenon_sfc_StartDMA(DMA_PHY_TO_RAM, half ^ DMA_HALF, addr + ((k+1)*sfc.DmaChunk));
 		if(buf != NULL)
 		{
-			for(i = 0; i < 16; i++)
+			for(i = 0; i < (sfc.DmaChunk/sfc.nand.PageSz); i++)
 			{
-				memcpy(data, &sfc.dmabuf[i*sfc.nand.PageSz], sfc.nand.PageSz);
-				memcpy(&data[sfc.nand.PageSz], &sfc.dmabuf[0xC000+(i*sfc.nand.MetaSz)], sfc.nand.MetaSz);
+				memcpy(data, &sfc.dmabuf[half+(i*sfc.nand.PageSz)], sfc.nand.PageSz);
+				memcpy(&data[sfc.nand.PageSz], &sfc.dmabuf[half+sfc.DmaChunk+(i*sfc.nand.MetaSz)], sfc.nand.MetaSz);
 				data += sfc.nand.PageSzPhys;
 			}
 		}
@@ -271,215 +573,261 @@ int xenon_sfc_ReadBlock(unsigned char* buf, unsigned int block)
 	return 0;
 }
 
+// _xenon_sfc_ReadBlockDMA inside the caller's session, or in one of its own when called outside
+static int _xenon_sfc_ReadBlockSession(unsigned char* buf, unsigned int addr, unsigned int blockSz, unsigned int block)
+{
+	unsigned long config;
+	int ret;
+
+	if(_xenon_sfc_InSession(false))
+		return _xenon_sfc_ReadBlockDMA(buf, addr, blockSz, block);
+	config = xenon_sfc_BeginSession(false);
+	ret = _xenon_sfc_ReadBlockDMA(buf, addr, blockSz, block);
+	xenon_sfc_EndSession(config);
+	return ret;
+}
+
+// returns 1 on bad block, 2 on unrecoverable ECC
+// data NULL to skip keeping data
+int xenon_sfc_ReadBlock(unsigned char* buf, unsigned int block)
+{
+	return _xenon_sfc_ReadBlockSession(buf, block * sfc.nand.BlockSz, sfc.nand.BlockSz, block);
+}
+
 int xenon_sfc_ReadSmallBlock(unsigned char* buf, unsigned int block)
 {
-	int i, status, block_read;
 	// hardcoding these for big block nand-type
 	unsigned int BlockSz = 0x4000;
-	unsigned int BlockSzPhys = 0x4200;
-	unsigned short PageSz = 0x200;
-	unsigned short PageSzPhys = 0x210;
-	unsigned char MetaSz = 0x10;
-	unsigned char PagesInBlock = 32;
-	int addr = block * BlockSz;
-	unsigned char* data = buf;
-	unsigned int cur_addr = addr;
-	
-	if(buf != NULL)
-		memset(data, 0, (PagesInBlock*PageSzPhys));
 
-	for(block_read = 0; block_read < BlockSzPhys; block_read += 0x2000, cur_addr += 0x2000)
+	return _xenon_sfc_ReadBlockSession(buf, block * BlockSz, BlockSz, block);
+}
+
+// bus address of byte off of a buffer mapped page by page
+#define DIRECT_ADDR(map, off) ((map)[(off)/PAGE_SIZE] + ((off)%PAGE_SIZE))
+
+// zero copy read: user is mapped with the streaming DMA API page by page and each command
+// lands a full chunk in it directly; the spare goes to the spare area of the DMA buffer and is
+// copied out in one go. A chunk split over pages that aren't physically contiguous would take
+// more commands than the bounce path, so then the block is left to the DMA buffer
+// returns -1 when user can't be mapped that way, 1 on bad block, 2 on unrecoverable ECC
+static int _xenon_sfc_ReadUserDirect(unsigned char* user, unsigned char* spare, unsigned int addr, unsigned int blockSz, unsigned int block)
+{
+	dma_addr_t map[DIRECT_MAX_PAGES];
+	unsigned int i, off, len, pages = blockSz / PAGE_SIZE;
+	int config, status, ret = 0;
+	struct page* pg;
+
+	if(!sfc.ZeroCopy || offset_in_page(user) || (blockSz % PAGE_SIZE) || (pages > DIRECT_MAX_PAGES) || (PAGE_SIZE % sfc.DmaUnit))
+		return -1;
+	for(i = 0; i < pages; i++)
 	{
+		pg = is_vmalloc_addr(user) ? vmalloc_to_page(&user[i*PAGE_SIZE]) : virt_to_page(&user[i*PAGE_SIZE]);
+		map[i] = dma_map_page(sfc.dev, pg, 0, PAGE_SIZE, DMA_FROM_DEVICE);
+		if(dma_mapping_error(sfc.dev, map[i]))
+		{
+			while(i--)
+				dma_unmap_page(sfc.dev, map[i], PAGE_SIZE, DMA_FROM_DEVICE);
+			return -1;
+		}
+	}
+	for(i = 1; i < pages; i++)
+	{
+		if(((i*PAGE_SIZE) % sfc.DmaChunk) && (map[i] != (map[i-1] + PAGE_SIZE)))
+		{
+			for(i = 0; i < pages; i++)
+				dma_unmap_page(sfc.dev, map[i], PAGE_SIZE, DMA_FROM_DEVICE);
+			return -1;
+		}
+	}
+
+	config = sfc.Config;
+	for(off = 0; off < blockSz; off += len)
+	{
+		len = ((blockSz - off) < sfc.DmaChunk) ? (blockSz - off) : sfc.DmaChunk;
+		_xenon_sfc_WriteConfig(((config&~(CONFIG_DMA_LEN|CONFIG_WP_EN))|sfc.IntEn)|CONFIG_DMA_PAGES(len/sfc.DmaUnit));
 		xenon_sfc_WriteReg(SFCX_STATUS, xenon_sfc_ReadReg(SFCX_STATUS));
-		xenon_sfc_WriteReg(SFCX_DATAPHYADDR, sfc.dmaaddr);
-		xenon_sfc_WriteReg(SFCX_SPAREPHYADDR, sfc.dmaaddr+0xC000);
-		xenon_sfc_WriteReg(SFCX_ADDRESS, cur_addr);
-		xenon_sfc_WriteReg(SFCX_COMMAND, DMA_PHY_TO_RAM);
-		
-		while(xenon_sfc_ReadReg(SFCX_STATUS) & STATUS_BUSY);
-		
-		status = xenon_sfc_ReadReg(SFCX_STATUS);
+		xenon_sfc_WriteReg(SFCX_DATAPHYADDR, DIRECT_ADDR(map, off));
+		xenon_sfc_WriteReg(SFCX_SPAREPHYADDR, sfc.dmaaddr+sfc.DmaChunk+((off/sfc.nand.PageSz)*sfc.nand.MetaSz));
+		xenon_sfc_WriteReg(SFCX_ADDRESS, addr+off);
+		status = _xenon_sfc_Command(DMA_PHY_TO_RAM, SFC_WAIT_DMA_READ);
 		if(status&STATUS_ERROR)
 		{
 			printk(KERN_INFO "error in status, %08x\n", status);
 			if(status&STATUS_BB_ER)
 			{
 				printk(KERN_INFO "Bad block error block 0x%x\n", block);
-				return 1;
+				ret = 1;
+				break;
 			}
 			if(STSCHK_ECC_ERR(status))
 			{
 				printk(KERN_INFO "unrecoverable ECC error block 0x%x\n", block);
-				return 2;
-			}
-		}
-		if(buf != NULL)
-		{
-			for(i = 0; i < 16; i++)
-			{
-				memcpy(data, &sfc.dmabuf[i*PageSz], PageSz);
-				memcpy(&data[PageSz], &sfc.dmabuf[0xC000+(i*MetaSz)], MetaSz);
-				data += PageSzPhys;
+				ret = 2;
+				break;
 			}
 		}
 	}
-	return 0;
+	_xenon_sfc_WriteConfig(config);
+
+	for(i = 0; i < pages; i++)
+		dma_unmap_page(sfc.dev, map[i], PAGE_SIZE, DMA_FROM_DEVICE);
+	if(spare && !ret)
+		memcpy(spare, &sfc.dmabuf[sfc.DmaChunk], (blockSz/sfc.nand.PageSz)*sfc.nand.MetaSz);
+	return ret;
 }
 
-int xenon_sfc_ReadBlockSeparate(unsigned char* user, unsigned char* spare, unsigned int block)
+// reads blockSz user bytes at addr into user and the spare into spare, zero copy when user
+// allows it, otherwise through the DMA buffer and a temporary interleaved block
+static int _xenon_sfc_ReadSeparate(unsigned char* user, unsigned char* spare, unsigned int addr, unsigned int blockSz, unsigned int block)
 {
-	int config, wconfig, i;
-	unsigned char* data = (unsigned char *)vmalloc(sfc.nand.BlockSzPhys);
-	
-	if(user && spare)
-	{
-		config = xenon_sfc_ReadReg(SFCX_CONFIG);
-		wconfig = (config&~(CONFIG_DMA_LEN|CONFIG_INT_EN|CONFIG_WP_EN));
-		if(sfc.nand.isBB)
-			wconfig = wconfig|CONFIG_DMA_PAGES(4); // change to 4 pages, bb 4 pages = 16 small pages
-		else
-			wconfig = wconfig|CONFIG_DMA_PAGES(16); // change to 16 pages
-		xenon_sfc_WriteReg(SFCX_CONFIG, wconfig);
-
-// 		printk(KERN_INFO "Reading block %x of %x at block %x (%x)\n", blk, block_cnt, blk+block, (blk+block)*sfc.nand.BlockSzPhys);
-		xenon_sfc_ReadSmallBlock(data, block);
+	int config, i, ret;
+	unsigned char* data;
 
-		xenon_sfc_WriteReg(SFCX_CONFIG, config);
-	}
-	else
+	if(!user || !spare)
+	{
 		printk(KERN_INFO "supplied buffers weren't allocated for readblock_separate\n");
-	
-	for(i = 0; i < sfc.nand.PagesInBlock; i++)
+		return 0;
+	}
+	ret = _xenon_sfc_ReadUserDirect(user, spare, addr, blockSz, block);
+	if(ret >= 0)
+		return ret;
+
+	data = _xenon_sfc_GetBuf();
+	if(data == NULL)
+		return -ENOMEM;
+	config = xenon_sfc_BeginSession(false);
+	ret = _xenon_sfc_ReadBlockDMA(data, addr, blockSz, block);
+	xenon_sfc_EndSession(config);
+
+	for(i = 0; i < (blockSz/sfc.nand.PageSz); i++)
 	{
 		memcpy(user, &data[i*sfc.nand.PageSzPhys], sfc.nand.PageSz);
 		memcpy(spare, &data[(i*sfc.nand.PageSzPhys)+sfc.nand.PageSz], sfc.nand.MetaSz); 
 		user += sfc.nand.PageSz;
 		spare += sfc.nand.MetaSz;
 	}
-	vfree(data);
-	
-	return 0;	
+	_xenon_sfc_PutBuf(data);
+	return ret;
+}
+
+int xenon_sfc_ReadBlockSeparate(unsigned char* user, unsigned char* spare, unsigned int block)
+{
+	return _xenon_sfc_ReadSeparate(user, spare, block * sfc.nand.BlockSz, sfc.nand.BlockSz, block);
 }
 
 int xenon_sfc_ReadSmallBlockSeparate(unsigned char* user, unsigned char* spare, unsigned int block)
 {
-	int config, wconfig, i;
-	unsigned int BlockSzPhys = 0x4200;
-	unsigned short PageSz = 0x200;
-	unsigned short PageSzPhys = 0x210;
-	unsigned char MetaSz = 0x10;
-	unsigned char PagesInBlock = 32;
-	unsigned char* data = (unsigned char *)vmalloc(BlockSzPhys);
-	
-	if(user && spare)
-	{
-		config = xenon_sfc_ReadReg(SFCX_CONFIG);
-		wconfig = (config&~(CONFIG_DMA_LEN|CONFIG_INT_EN|CONFIG_WP_EN));
-		if(sfc.nand.isBB)
-			wconfig = wconfig|CONFIG_DMA_PAGES(4); // change to 4 pages, bb 4 pages = 16 small pages
-		else
-			wconfig = wconfig|CONFIG_DMA_PAGES(16); // change to 16 pages
-		xenon_sfc_WriteReg(SFCX_CONFIG, wconfig);
+	unsigned int BlockSz = 0x4000;
 
-// 		printk(KERN_INFO "Reading block %x of %x at block %x (%x)\n", blk, block_cnt, blk+block, (blk+block)*sfc.nand.BlockSzPhys);
-		xenon_sfc_ReadBlock(data, block);
+	return _xenon_sfc_ReadSeparate(user, spare, block * BlockSz, BlockSz, block);
+}
 
-		xenon_sfc_WriteReg(SFCX_CONFIG, config);
-	}
-	else
-		printk(KERN_INFO "supplied buffers weren't allocated for readblock_separate\n");
-	
-	for(i = 0; i < PagesInBlock; i++)
-	{
-		memcpy(user, &data[i*PageSzPhys], PageSz);
-		memcpy(spare, &data[(i*PageSzPhys)+PageSz], MetaSz); 
-		user += PageSz;
-		spare += MetaSz;
-	}
-	vfree(data);
-	
-	return 0;	
+void xenon_sfc_SetZeroCopy(bool on)
+{
+	sfc.ZeroCopy = on;
 }
 
 int xenon_sfc_ReadBlockUser(unsigned char* buf, unsigned int block)
 {
-	unsigned char* tmp = (unsigned char *)vmalloc(sfc.nand.MetaSz*sfc.nand.PagesInBlock);
+	unsigned char* tmp = _xenon_sfc_GetBuf();
 	xenon_sfc_ReadBlockSeparate(buf, tmp, block);
-	vfree(tmp);
+	_xenon_sfc_PutBuf(tmp);
 	return 0;
 }
 
 int xenon_sfc_ReadBlockSpare(unsigned char* buf, unsigned int block)
 {
-	unsigned char* tmp = (unsigned char *)vmalloc(sfc.nand.BlockSz);
+	unsigned char* tmp = _xenon_sfc_GetBuf();
 	xenon_sfc_ReadBlockSeparate(tmp, buf, block);
-	vfree(tmp);
+	_xenon_sfc_PutBuf(tmp);
 	return 0;
 }
 
 int xenon_sfc_ReadSmallBlockUser(unsigned char* buf, unsigned int block)
 {
-	unsigned char PagesInBlock = 32;
-	unsigned char MetaSz = 0x10;
-	unsigned char* tmp = (unsigned char *)vmalloc(MetaSz*PagesInBlock);
+	unsigned char* tmp = _xenon_sfc_GetBuf();
 	xenon_sfc_ReadSmallBlockSeparate(buf, tmp, block);
-	vfree(tmp);
+	_xenon_sfc_PutBuf(tmp);
 	return 0;
 }
 
 int xenon_sfc_ReadSmallBlockSpare(unsigned char* buf, unsigned int block)
 {
-	unsigned short BlockSz = 0x4000;
-	unsigned char* tmp = (unsigned char *)vmalloc(BlockSz);
+	unsigned char* tmp = _xenon_sfc_GetBuf();
 	xenon_sfc_ReadSmallBlockSeparate(tmp, buf, block);
-	vfree(tmp);
+	_xenon_sfc_PutBuf(tmp);
 	return 0;
 }
 
-int xenon_sfc_WriteBlock(unsigned char* buf, unsigned int block)
+// returns the error bits of the erase or of the programs, 0 when the block made it
+static int _xenon_sfc_WriteBlockDMA(unsigned char* buf, unsigned int block)
 {
-	int status, i, block_wrote;
+	int status, ret;
+	unsigned int k, i, half, chunks = sfc.nand.BlockSz / sfc.DmaChunk;
 	int addr = block * sfc.nand.BlockSz;
 	
 	unsigned char* data = buf;
-	unsigned int cur_addr = addr;
 	
+	_xenon_sfc_NoteWrite(block);
+
 	// one erase per block
-	status = xenon_sfc_EraseBlock(addr);
+	status = xenon_sfc_EraseBlock(block);
 	if(status&STATUS_ERROR)
+	{
 		printk(KERN_INFO "error in erase status, %08x\n", status);
+		return status&STATUS_ERROR; // nothing gets programmed into a block that didn't erase
+	}
+	ret = 0;
 
 	if(buf != NULL)
 	{
-		for(block_wrote = 0; block_wrote < sfc.nand.BlockSzPhys; block_wrote += 0x2000, cur_addr += 0x2000)
+		for(k = 0; k < chunks; k++)
 		{
-			for(i = 0; i < 16; i++)
+			// chunk k is interleaved into one half while chunk k-1 is programmed from the other
+			half = (k&1) ? DMA_HALF : 0;
+			for(i = 0; i < (sfc.DmaChunk/sfc.nand.PageSz); i++)
 			{
-				memcpy(&sfc.dmabuf[i*sfc.nand.PageSz], data, sfc.nand.PageSz);
-				memcpy(&sfc.dmabuf[0xC000+(i*sfc.nand.MetaSz)], &data[sfc.nand.PageSz], sfc.nand.MetaSz);
+				memcpy(&sfc.dmabuf[half+(i*sfc.nand.PageSz)], data, sfc.nand.PageSz);
+				memcpy(&sfc.dmabuf[half+sfc.DmaChunk+(i*sfc.nand.MetaSz)], &data[sfc.nand.PageSz], sfc.nand.MetaSz);
 				data += sfc.nand.PageSzPhys;
 			}
-			xenon_sfc_WriteReg(SFCX_STATUS, xenon_sfc_ReadReg(SFCX_STATUS));
-			xenon_sfc_WriteReg(SFCX_COMMAND, UNLOCK_CMD_0);
-			xenon_sfc_WriteReg(SFCX_COMMAND, UNLOCK_CMD_1);
-			xenon_sfc_WriteReg(SFCX_DATAPHYADDR, sfc.dmaaddr);
-			xenon_sfc_WriteReg(SFCX_SPAREPHYADDR, sfc.dmaaddr+0xC000);
-			xenon_sfc_WriteReg(SFCX_ADDRESS, cur_addr);
-			xenon_sfc_WriteReg(SFCX_COMMAND, DMA_RAM_TO_PHY);
-			
-			while(xenon_sfc_ReadReg(SFCX_STATUS) & STATUS_BUSY);
-			
-			status = xenon_sfc_ReadReg(SFCX_STATUS);
+			if(k)
+			{
+				status = _xenon_sfc_Finish(SFC_WAIT_DMA_WRITE);
+				if(status&STATUS_ERROR)
+					printk(KERN_INFO "error in status, %08x\n", status);
+				ret |= status&STATUS_ERROR;
+			}
+			_xenon_sfc_StartDMA(DMA_RAM_TO_PHY, half, addr + (k*sfc.DmaChunk));
+		}
+		if(chunks)
+		{
+			status = _xenon_sfc_Finish(SFC_WAIT_DMA_WRITE);
 			if(status&STATUS_ERROR)
 				printk(KERN_INFO "error in status, %08x\n", status);
+			ret |= status&STATUS_ERROR;
 		}
 	}
-	return 0;
+	return ret;
+}
+
+// opens a write session of its own when called outside of one
+int xenon_sfc_WriteBlock(unsigned char* buf, unsigned int block)
+{
+	unsigned long config;
+	int ret;
+
+	if(_xenon_sfc_InSession(true))
+		return _xenon_sfc_WriteBlockDMA(buf, block);
+	config = xenon_sfc_BeginSession(true);
+	ret = _xenon_sfc_WriteBlockDMA(buf, block);
+	xenon_sfc_EndSession(config);
+	return ret;
 }
 
 int xenon_sfc_ReadBlocks(unsigned char* buf, unsigned int block, unsigned int block_cnt)
 {
-	int cur_blk, config, wconfig;
+	int cur_blk, config;
 	//int sz = (block_cnt*sfc.nand.BlockSzPhys);
 	//unsigned char *buf = (unsigned char *)vmalloc(block_cnt*sfc.nand.BlockSzPhys);
 	//unsigned char *buf = (unsigned char *)VirtualAlloc(0, (block_cnt*sfc.nand.BlockSzPhys), MEM_COMMIT|MEM_LARGE_PAGES, PAGE_READWRITE);
@@ -502,20 +850,14 @@ int xenon_sfc_ReadBlocks(unsigned char* buf, unsigned int block, unsigned int bl
 		}
 		else
 		{
-			config = xenon_sfc_ReadReg(SFCX_CONFIG);
-			wconfig = (config&~(CONFIG_DMA_LEN|CONFIG_INT_EN|CONFIG_WP_EN));
-			if(sfc.nand.isBB)
-				wconfig = wconfig|CONFIG_DMA_PAGES(4); // change to 4 pages, bb 4 pages = 16 small pages
-			else
-				wconfig = wconfig|CONFIG_DMA_PAGES(16); // change to 16 pages
-			xenon_sfc_WriteReg(SFCX_CONFIG, wconfig);
+			config = xenon_sfc_BeginSession(false);
 			
 			for(cur_blk = 0; cur_blk < block_cnt; cur_blk++)
 			{
 // 				printk(KERN_INFO "Reading block %x of %x at block %x (%x)\n", blk, block_cnt, blk+block, (blk+block)*sfc.nand.BlockSzPhys);
 				xenon_sfc_ReadBlock(&buf[cur_blk*sfc.nand.BlockSzPhys], cur_blk+block);
 			}
-			xenon_sfc_WriteReg(SFCX_CONFIG, config);
+			xenon_sfc_EndSession(config);
 		}
 // 		printk(KERN_INFO "flash read complete\n");
 	}
@@ -527,29 +869,28 @@ int xenon_sfc_ReadBlocks(unsigned char* buf, unsigned int block, unsigned int bl
 
 int xenon_sfc_BlockHasData(unsigned char* buf)
 {
-	int i;
-	unsigned char *data = buf;
-	
-	for(i = 0; i < sfc.nand.BlockSzPhys; i++)
-		if((data[i]&0xFF) != 0xFF)
-			return 1;
-	return 0;
+	return !(xenon_sfc_ClassifyBlock(buf, NULL, sfc.nand.BlockSzPhys, sfc.nand.PageSz, sfc.nand.MetaSz) & BLKCLS_ERASED);
 }
 
+// 0 when every block made it, -EIO after a bad block or a failed erase or program, the remaining blocks are still written
 int xenon_sfc_WriteBlocks(unsigned char *buf, unsigned int block, unsigned int block_cnt)
 {
-	int cur_blk, config, wconfig;
+	int cur_blk, config, ret = 0;
+	unsigned int cls;
 	
 	unsigned char* blk_data;
 	unsigned char* data = buf;
 	//int sz = (block_cnt*sfc.nand.BlockSzPhys);
-	unsigned char* blockbuf = (unsigned char *)vmalloc(sfc.nand.BlockSzPhys);
+	unsigned char* blockbuf;
 	
 	if(((block+block_cnt)*sfc.nand.BlockSzPhys) > sfc.nand.SizeDump)
 	{
 		printk(KERN_INFO "error, write exceeds system area!\n");
-		return 0;
+		return -EINVAL;
 	}
+	blockbuf = _xenon_sfc_GetBuf();
+	if(blockbuf == NULL)
+		return -ENOMEM;
 	
 	if(sfc.nand.MMC)
 	{
@@ -563,16 +904,11 @@ int xenon_sfc_WriteBlocks(unsigned char *buf, unsigned int block, unsigned int b
 		}
 */
 		printk(KERN_INFO "MMC not yet implemented!\n");
+		ret = -EOPNOTSUPP; // nothing was written
 	}
 	else
 	{
-		config = xenon_sfc_ReadReg(SFCX_CONFIG);
-		wconfig = (config &~(CONFIG_DMA_LEN|CONFIG_INT_EN))|CONFIG_WP_EN; // for the write
-		if(sfc.nand.isBB)
-			wconfig = wconfig|CONFIG_DMA_PAGES(4); // change to 4 pages, bb 4 pages = 16 small pages
-		else
-			wconfig = wconfig|CONFIG_DMA_PAGES(16); // change to 16 pages
-		xenon_sfc_WriteReg(SFCX_CONFIG, (wconfig));
+		config = xenon_sfc_BeginSession(true);
 		
 		for(cur_blk = 0; cur_blk < block_cnt; cur_blk++)
 		{
@@ -580,36 +916,43 @@ int xenon_sfc_WriteBlocks(unsigned char *buf, unsigned int block, unsigned int b
 			// check for bad block, do NOT modify bad blocks!!!
 			if(xenon_sfc_ReadBlock(blockbuf, cur_blk+block) == 0)
 			{
+				cls = xenon_sfc_ClassifyBlock(blk_data, blockbuf, sfc.nand.BlockSzPhys, sfc.nand.PageSz, sfc.nand.MetaSz);
 				// check if data needs to be written
-				if(memcmp(blockbuf, blk_data, sfc.nand.BlockSzPhys) != 0)
+				if(cls & BLKCLS_CHANGED)
 				{
 					// check if block has data to write, or if it's only an erase
-					if(xenon_sfc_BlockHasData(blk_data))
+					if(!(cls & BLKCLS_ERASED))
 					{
 						//printk(KERN_INFO "Writing block %x of %x at %x (%x)\n", cur_blk, block_cnt, cur_blk+block, (cur_blk+block)*sfc.nand.BlockSzPhys);
-						xenon_sfc_WriteBlock(blk_data, cur_blk+block);
+						if(xenon_sfc_WriteBlock(blk_data, cur_blk+block))
+							ret = -EIO;
 					}
 					else
 					{
 						//printk(KERN_INFO "Erase only block %x of %x at %x (%x)\n", cur_blk, block_cnt, cur_blk+block, (cur_blk+block)*sfc.nand.BlockSzPhys);
-						xenon_sfc_WriteBlock(NULL, cur_blk+block);
+						if(xenon_sfc_WriteBlock(NULL, cur_blk+block))
+							ret = -EIO;
 					}
 				}
 				//else
 				//	printk(KERN_INFO "skipping write block %x at %x of %x, data identical\n", cur_blk, cur_blk*sfc.nand.BlockSzPhys, sfc.nand.SizeData/sfc.nand.BlockSzPhys);
 			}
 			else
+			{
 				printk(KERN_INFO "not writing to block %x, it is bad!\n", cur_blk+block);
+				ret = -EIO;
+			}
 		}
-		xenon_sfc_WriteReg(SFCX_CONFIG, config);
+		xenon_sfc_EndSession(config);
 	}
+	_xenon_sfc_PutBuf(blockbuf);
 // 	printk(KERN_INFO "flash write complete\n");
-	return 0;
+	return ret;
 }
 
 int xenon_sfc_EraseBlocks(unsigned int block, unsigned int block_cnt)
 {
-	int cur_blk, config, wconfig, status;
+	int cur_blk, config, status;
 	
 	//int sz = (block_cnt*sfc.nand.BlockSzPhys);
 	if(sfc.nand.MMC)
@@ -631,13 +974,7 @@ int xenon_sfc_EraseBlocks(unsigned int block, unsigned int block_cnt)
 	}
 	else
 	{
-		config = xenon_sfc_ReadReg(SFCX_CONFIG);
-		wconfig = (config &~(CONFIG_DMA_LEN|CONFIG_INT_EN))|CONFIG_WP_EN; // for the write
-		if(sfc.nand.isBB)
-			wconfig = wconfig|CONFIG_DMA_PAGES(4); // change to 4 pages, bb 4 pages = 16 small pages
-		else
-			wconfig = wconfig|CONFIG_DMA_PAGES(16); // change to 16 pages
-		xenon_sfc_WriteReg(SFCX_CONFIG, (wconfig));
+		config = xenon_sfc_BeginSession(true);
 		
 		for(cur_blk = 0; cur_blk < block_cnt; cur_blk++)
 		{
@@ -645,7 +982,7 @@ int xenon_sfc_EraseBlocks(unsigned int block, unsigned int block_cnt)
 			if(status&STATUS_ERROR)
 				printk(KERN_INFO "error in erase status, %08x\n", status);
 		}
-		xenon_sfc_WriteReg(SFCX_CONFIG, config);
+		xenon_sfc_EndSession(config);
 	}
 	return 0;
 }
@@ -655,11 +992,20 @@ void xenon_sfc_ReadMapData(unsigned char* buf, unsigned int startaddr, unsigned
 	memcpy(buf, (sfc.mappedflash + startaddr), total_len);
 } 
 
+// direct pointer into the flash window, NULL when the range isn't mapped
+unsigned char* xenon_sfc_MapData(unsigned int startaddr, unsigned int total_len)
+{
+	if((startaddr + total_len) > MAP_SIZE)
+		return NULL;
+	return (unsigned char*)sfc.mappedflash + startaddr;
+}
+
 int xenon_sfc_WriteFullFlash(unsigned char* buf)
 {
-	int cur_blk, config, wconfig;
+	int cur_blk, config;
+	unsigned int cls;
 	unsigned char* data;
-	unsigned char* blockbuf = (unsigned char *)vmalloc(sfc.nand.BlockSzPhys);
+	unsigned char* blockbuf = _xenon_sfc_GetBuf();
 // 	printk(KERN_INFO "writing flash\n");
 
 	if(sfc.nand.MMC)
@@ -676,25 +1022,20 @@ int xenon_sfc_WriteFullFlash(unsigned char* buf)
 	}
 	else
 	{
-		config = xenon_sfc_ReadReg(SFCX_CONFIG);
-		wconfig = (config&~(CONFIG_DMA_LEN|CONFIG_INT_EN))|CONFIG_WP_EN; // for the write
-		if(sfc.nand.isBB)
-			wconfig = wconfig|CONFIG_DMA_PAGES(4); // change to 4 pages, bb 4 pages = 16 small pages
-		else
-			wconfig = wconfig|CONFIG_DMA_PAGES(16); // change to 16 pages
-		xenon_sfc_WriteReg(SFCX_CONFIG, (wconfig));
-		for(cur_blk = 0; cur_blk < (sfc.nand.SizeData/sfc.nand.BlockSzPhys); cur_blk++)
+		config = xenon_sfc_BeginSession(true);
+		for(cur_blk = 0; cur_blk < sfc.nand.BlocksCount; cur_blk++)
 		{
 			data = &buf[cur_blk*sfc.nand.BlockSzPhys];
 
 			// check for bad block, do NOT modify bad blocks!!!
 			if(xenon_sfc_ReadBlock(blockbuf, cur_blk) == 0)
 			{
+				cls = xenon_sfc_ClassifyBlock(data, blockbuf, sfc.nand.BlockSzPhys, sfc.nand.PageSz, sfc.nand.MetaSz);
 				// check if data needs to be written
-				if(memcmp(blockbuf, data, sfc.nand.BlockSzPhys) != 0)
+				if(cls & BLKCLS_CHANGED)
 				{
 					// check if block has data to write, or if it's only an erase
-					if(xenon_sfc_BlockHasData(data))
+					if(!(cls & BLKCLS_ERASED))
 					{
  						//printk(KERN_INFO "Writing block %x at %x of %x\n", cur_blk, cur_blk*sfc.nand.BlockSzPhys, sfc.nand.SizeData/sfc.nand.BlockSzPhys);
 						xenon_sfc_WriteBlock(data, cur_blk);
@@ -726,16 +1067,16 @@ int xenon_sfc_WriteFullFlash(unsigned char* buf)
 			else
 				printk(KERN_INFO "not writing to block %x, it is bad!\n", cur_blk);
 		}
-		xenon_sfc_WriteReg(SFCX_CONFIG, config);
+		xenon_sfc_EndSession(config);
 	}
-	vfree(blockbuf);
+	_xenon_sfc_PutBuf(blockbuf);
 // 	printk(KERN_INFO "flash write complete\n");
 	return 0;
 }
 
 int xenon_sfc_ReadFullFlash(unsigned char* buf)
 {
-	int cur_blk, config, wconfig;
+	int cur_blk, config;
 	unsigned char* data = buf;
 	
 	if(sfc.nand.MMC)
@@ -751,32 +1092,97 @@ int xenon_sfc_ReadFullFlash(unsigned char* buf)
 	}
 	else
 	{
- 		config = xenon_sfc_ReadReg(SFCX_CONFIG);
-   		wconfig = (config&~(CONFIG_DMA_LEN|CONFIG_INT_EN|CONFIG_WP_EN));
-   		if(sfc.nand.isBB)
-   			wconfig = wconfig|CONFIG_DMA_PAGES(4); // change to 4 pages, bb 4 pages = 16 small pages
-   		else
-   			wconfig = wconfig|CONFIG_DMA_PAGES(16); // change to 16 pages
- 		xenon_sfc_WriteReg(SFCX_CONFIG, wconfig);
+		config = xenon_sfc_BeginSession(false);
  		
- 		for(cur_blk = 0; cur_blk < (sfc.nand.SizeData/sfc.nand.BlockSzPhys); cur_blk++)
+ 		for(cur_blk = 0; cur_blk < sfc.nand.BlocksCount; cur_blk++)
  		{
   			//printk(KERN_INFO "Reading block %x at %x of %x\n", cur_blk, cur_blk*sfc.nand.BlockSzPhys, sfc.nand.SizeData/sfc.nand.BlockSzPhys);
  			xenon_sfc_ReadBlock(&data[cur_blk*sfc.nand.BlockSzPhys], cur_blk);
  		}
- 		xenon_sfc_WriteReg(SFCX_CONFIG, config);
+		xenon_sfc_EndSession(config);
 	}
 // 	printk(KERN_INFO "flash read complete\n");
 	return 0;
 }
 
+// same as ReadFullFlash, but only one block is held at a time and handed to sink
+int xenon_sfc_ReadFullFlashStream(xenon_sfc_sink sink, void* ctx)
+{
+	int cur_blk, config, ret = 0;
+	unsigned char* blockbuf;
+
+	if(sfc.nand.MMC)
+		return 0;
+
+	blockbuf = _xenon_sfc_GetBuf();
+	if(blockbuf == NULL)
+		return -ENOMEM;
+
+	config = xenon_sfc_BeginSession(false);
+
+	// every block of the chip, SizeData/BlockSzPhys would stop short of the last ones
+	for(cur_blk = 0; cur_blk < sfc.nand.BlocksCount; cur_blk++)
+	{
+		// bad blocks are passed on zeroed, the sink gets the read status
+		ret = sink(blockbuf, cur_blk, xenon_sfc_ReadBlock(blockbuf, cur_blk), ctx);
+		if(ret)
+			break;
+	}
+	xenon_sfc_EndSession(config);
+	_xenon_sfc_PutBuf(blockbuf);
+	return ret;
+}
+
 bool xenon_sfc_GetNandStruct(xenon_nand* xe_nand)
 {
-	xe_nand = &sfc.nand;
+	memcpy(xe_nand, &sfc.nand, sizeof(xenon_nand));
 	return xe_nand->init;
 }
 
 
+// largest transfer per DMA command: up to DMA_MAX_UNITS units, data and spare have to fit
+// one half of the DMA buffer and a small block has to be a whole number of chunks.
+// Small block NAND stays at 16 pages (0x2000), big block goes from 4 to 8 pages (0x4000)
+static void _xenon_sfc_SetupDMAChunk(void)
+{
+	unsigned int units;
+
+	sfc.DmaUnit = sfc.nand.isBB ? 0x800 : sfc.nand.PageSz;
+	for(units = DMA_MAX_UNITS; units > 1; units--)
+	{
+		sfc.DmaChunk = units * sfc.DmaUnit;
+		if(((sfc.DmaChunk + ((sfc.DmaChunk/sfc.nand.PageSz)*sfc.nand.MetaSz)) <= DMA_HALF) && !(0x4000 % sfc.DmaChunk))
+			break;
+	}
+}
+
+#ifdef MEASURE_DMA_CHUNK
+// reads block 0 a few times with the legacy chunk and with the computed one, the difference
+// is the command/status overhead the larger transfers save
+static void _xenon_sfc_MeasureDMAChunk(void)
+{
+	unsigned int chunk = sfc.DmaChunk, i, k;
+	unsigned long config;
+	ktime_t start;
+	s64 us[2];
+
+	for(k = 0; k < 2; k++)
+	{
+		sfc.DmaChunk = k ? chunk : DMA_LEGACY_CHUNK;
+		config = xenon_sfc_BeginSession(false);
+		start = ktime_get();
+		for(i = 0; i < 8; i++)
+			xenon_sfc_ReadBlock(NULL, 0);
+		us[k] = ktime_us_delta(ktime_get(), start) / 8;
+		xenon_sfc_EndSession(config);
+	}
+	sfc.DmaChunk = chunk;
+	printk(KERN_INFO "DMA chunk 0x%x: %u commands per block instead of %u, %lldus per block instead of %lldus (%lldus per command saved)\n",
+		chunk, sfc.nand.BlockSz / chunk, sfc.nand.BlockSz / DMA_LEGACY_CHUNK, us[1], us[0],
+		(chunk == DMA_LEGACY_CHUNK) ? 0 : (us[0] - us[1]) / ((sfc.nand.BlockSz / DMA_LEGACY_CHUNK) - (sfc.nand.BlockSz / chunk)));
+}
+#endif
+
 static bool _xenon_sfc_enum_nand(void)
 {
 	int config;
@@ -876,10 +1282,11 @@ static bool _xenon_sfc_enum_nand(void)
 						sfc.nand.MetaType = META_TYPE_BG;
 						sfc.nand.isBBCont = true;
 						sfc.nand.isBB = true;
-						sfc.nand.SizeDump = 0x4200000;
+						// whole chip, the 64MB system area is followed by the MU
+						sfc.nand.SizeData = 1 << (((config >> 19) & 0x3) + ((config >> 21) & 0xF) + 23);
+						sfc.nand.SizeSpare = sfc.nand.SizeData >> 5;
+						sfc.nand.SizeDump = sfc.nand.SizeData + sfc.nand.SizeSpare;
 						sfc.nand.BlockSzPhys = 0x21000;
-						sfc.nand.SizeData = 0x4000000;
-						sfc.nand.SizeSpare = 0x200000;
 						sfc.nand.PagesInBlock = 256;
 						sfc.nand.BlockSz = 0x20000;
 						sfc.nand.SizeUsableFs = 0x1E0;
@@ -914,10 +1321,11 @@ static bool _xenon_sfc_enum_nand(void)
 						sfc.nand.MetaType = META_TYPE_BG;
 						sfc.nand.isBBCont = 1;
 						sfc.nand.isBB = 1;
-						sfc.nand.SizeDump = 0x4200000;
+						// whole chip, the 64MB system area is followed by the MU
+						sfc.nand.SizeData = 1 << (((config >> 19) & 0x3) + ((config >> 21) & 0xF) + 23);
+						sfc.nand.SizeSpare = sfc.nand.SizeData >> 5;
+						sfc.nand.SizeDump = sfc.nand.SizeData + sfc.nand.SizeSpare;
 						sfc.nand.BlockSzPhys = 0x21000;
-						sfc.nand.SizeData = 0x4000000;
-						sfc.nand.SizeSpare = 0x200000;
 						sfc.nand.PagesInBlock = 256;
 						sfc.nand.BlockSz = 0x20000;
 						sfc.nand.SizeUsableFs = 0x1E0;
@@ -996,9 +1404,39 @@ static int _xenon_sfc_init_one (struct pci_dev *pdev, const struct pci_device_id
 	if (!sfc.dmabuf) {
 		goto err_out_ioremap_map;
 	}
+	sfc.dev = &pdev->dev;
+	sfc.ZeroCopy = true;
+	sfc.Config = xenon_sfc_ReadReg(SFCX_CONFIG);
+	_xenon_sfc_SetupDMAChunk();
+
+	if(!_xenon_sfc_PoolInit())
+	{
+		rc = -ENOMEM;
+		goto err_out_pool;
+	}
+
+	// without the interrupt every command is polled as before
+	sfc.irq = -1;
+	if (request_irq(pdev->irq, _xenon_sfc_irq, IRQF_SHARED, DRV_NAME, &sfc) == 0)
+	{
+		sfc.irq = pdev->irq;
+		sfc.IntEn = CONFIG_INT_EN;
+		xenon_sfc_WriteReg(SFCX_STATUS, STATUS_INT_CP);
+		_xenon_sfc_WriteConfig(sfc.Config | CONFIG_INT_EN);
+	}
+	else
+		printk(KERN_INFO "no interrupt, polling the SFC\n");
 
+#ifdef MEASURE_DMA_CHUNK
+	if(!sfc.nand.MMC)
+		_xenon_sfc_MeasureDMAChunk();
+#endif
 	return 0;
 
+err_out_pool:
+	_xenon_sfc_PoolFree();
+	dma_free_coherent(&pdev->dev, DMA_SIZE, sfc.dmabuf, sfc.dmaaddr);
+
 err_out_ioremap_map:
 	iounmap(sfc.mappedflash);
 	
@@ -1016,6 +1454,14 @@ err_out:
 
 static void _xenon_sfc_remove(struct pci_dev *pdev)
 {
+	if (sfc.irq >= 0)
+	{
+		_xenon_sfc_WriteConfig(sfc.Config & ~CONFIG_INT_EN);
+		free_irq(sfc.irq, &sfc);
+		sfc.irq = -1;
+		sfc.IntEn = 0;
+	}
+	_xenon_sfc_PoolFree();
 	dma_free_coherent(&pdev->dev, DMA_SIZE, sfc.dmabuf, sfc.dmaaddr);
 	iounmap(sfc.base);
 
@@ -11,6 +11,10 @@
 #include <stdbool.h>
 #endif
 
+#if defined(__SSE2__) && !defined(__KERNEL__)
+#include <emmintrin.h>
+#endif
+
 //Registers
 #define SFCX_CONFIG				(0x00)
 #define SFCX_STATUS 			(0x04)
@@ -66,7 +70,8 @@
 #define STATUS_BUSY         	(0x1)			//Busy
 #define STATUS_ECC_ERROR		(0x10)			// controller signals unrecoverable ECC error when (!((stat&0x1c) < 0x10))
 #define STATUS_DMA_ERROR		(STATUS_MASTER_ABOR|STATUS_TARGET_ABOR)
-#define STATUS_ERROR			(STATUS_ILL_LOG|STATUS_ADDR_ER|STATUS_BB_ER|STATUS_RNP_ER|STATUS_ECC_ERROR|STATUS_WR_ER|STATUS_MASTER_ABOR|STATUS_TARGET_ABOR)
+#define STATUS_SW_TIMEOUT		(0x10000)		// not a register bit, set by the driver when the controller stayed busy too long
+#define STATUS_ERROR			(STATUS_ILL_LOG|STATUS_ADDR_ER|STATUS_BB_ER|STATUS_RNP_ER|STATUS_ECC_ERROR|STATUS_WR_ER|STATUS_MASTER_ABOR|STATUS_TARGET_ABOR|STATUS_SW_TIMEOUT)
 #define STSCHK_WRIERA_ERR(sta)	((sta & STATUS_WR_ER) != 0)
 #define STSCHK_ECC_ERR(sta)		(!((sta & STATUS_ECC_ER) < 0x10))
 #define STSCHK_DMA_ERR(sta)		((sta & (STATUS_DMA_ERROR) != 0)
@@ -127,6 +132,142 @@ typedef struct _xenon_nand
 	unsigned short ConfigBlock;
 } xenon_nand, *pxenon_nand;
 
+//Block classification, identical to the reference when none of the CHANGED bits is set
+#define BLKCLS_ERASED			(0x1)			//All bytes 0xFF
+#define BLKCLS_USER_CHANGED		(0x2)			//User data differs from the reference
+#define BLKCLS_SPARE_CHANGED	(0x4)			//Spare data differs from the reference
+#define BLKCLS_CHANGED			(BLKCLS_USER_CHANGED|BLKCLS_SPARE_CHANGED)
+
+// and-folds data into ones and or-folds data^ref into diff, len must be a multiple of 16
+static inline void _xenon_sfc_ClassifyRun(const unsigned char* data, const unsigned char* ref, unsigned int len, unsigned long* ones, unsigned long* diff)
+{
+	unsigned int i;
+#if defined(__SSE2__) && !defined(__KERNEL__)
+	__m128i a = _mm_set1_epi8(-1), d = _mm_setzero_si128(), v;
+	unsigned long fold[2 * sizeof(__m128i) / sizeof(unsigned long)];
+
+	for(i = 0; i < len; i += sizeof(__m128i))
+	{
+		v = _mm_loadu_si128((const __m128i*)&data[i]);
+		a = _mm_and_si128(a, v);
+		if(ref)
+			d = _mm_or_si128(d, _mm_xor_si128(v, _mm_loadu_si128((const __m128i*)&ref[i])));
+	}
+	_mm_storeu_si128((__m128i*)&fold[0], a);
+	_mm_storeu_si128((__m128i*)&fold[sizeof(__m128i) / sizeof(unsigned long)], d);
+	for(i = 0; i < sizeof(__m128i) / sizeof(unsigned long); i++)
+	{
+		*ones &= fold[i];
+		*diff |= fold[i + sizeof(__m128i) / sizeof(unsigned long)];
+	}
+#else
+	const unsigned long* d = (const unsigned long*)data;
+	const unsigned long* r = (const unsigned long*)ref;
+	unsigned long a = ~0UL, x = 0;
+
+	len /= sizeof(unsigned long);
+	if(ref)
+	{
+		for(i = 0; i < len; i++)
+		{
+			a &= d[i];
+			x |= d[i] ^ r[i];
+		}
+	}
+	else
+	{
+		for(i = 0; i < len; i++)
+			a &= d[i];
+	}
+	*ones &= a;
+	*diff |= x;
+#endif
+}
+
+// single pass over a block laid out as pages of user+spare, ref may be NULL
+static inline unsigned int xenon_sfc_ClassifyBlock(const unsigned char* data, const unsigned char* ref, unsigned int len, unsigned int pageSz, unsigned int metaSz)
+{
+	unsigned long ones = ~0UL, user = 0, spare = 0;
+	unsigned int off, ret = 0;
+
+	for(off = 0; off < len; off += pageSz + metaSz)
+	{
+		_xenon_sfc_ClassifyRun(&data[off], ref ? &ref[off] : ref, pageSz, &ones, &user);
+		if(metaSz)
+			_xenon_sfc_ClassifyRun(&data[off + pageSz], ref ? &ref[off + pageSz] : ref, metaSz, &ones, &spare);
+	}
+	if(ones == ~0UL)
+		ret |= BLKCLS_ERASED;
+	if(user)
+		ret |= BLKCLS_USER_CHANGED;
+	if(spare)
+		ret |= BLKCLS_SPARE_CHANGED;
+	return ret;
+}
+
+// command completion shared by the interrupt handler and the waiter, free of kernel calls
+// so it can be driven by a register model as well
+typedef struct _xenon_sfc_cmpl
+{
+	bool Armed; // a command is outstanding
+	bool Done;
+	unsigned long Status; // STATUS seen by the handler, INT_CP stripped
+	unsigned int Irqs; // interrupts taken
+	unsigned int Spurious; // interrupts that completed nothing
+} xenon_sfc_cmpl, *pxenon_sfc_cmpl;
+
+// call before the command register is written, an interrupt racing the write then still counts
+static inline void xenon_sfc_CmplArm(xenon_sfc_cmpl* c)
+{
+	c->Armed = true;
+	c->Done = false;
+	c->Status = 0;
+}
+
+// feeds one STATUS read by the interrupt handler, false when the interrupt wasn't raised by the SFC
+static inline bool xenon_sfc_CmplIrq(xenon_sfc_cmpl* c, unsigned long status)
+{
+	if(!(status & STATUS_INT_CP))
+		return false;
+	c->Irqs++;
+	// still busy or nobody waiting, e.g. a polled PIO command
+	if(!c->Armed || (status & STATUS_BUSY))
+	{
+		c->Spurious++;
+		return true;
+	}
+	c->Armed = false;
+	c->Done = true;
+	c->Status = status & ~STATUS_INT_CP;
+	return true;
+}
+
+static inline bool xenon_sfc_CmplReady(const xenon_sfc_cmpl* c)
+{
+	return c->Done;
+}
+
+//Command classes for the busy wait, each with its own spin/sleep policy and statistics
+#define SFC_WAIT_READ			0				//PIO page read into the page buffer
+#define SFC_WAIT_PROGRAM		1				//PIO page program
+#define SFC_WAIT_ERASE			2				//Block erase
+#define SFC_WAIT_DMA_READ		3
+#define SFC_WAIT_DMA_WRITE		4
+#define SFC_WAIT_MISC			5				//Address setup and unlock sequences
+#define SFC_WAIT_TYPES			6
+
+typedef struct _xenon_sfc_waitstat
+{
+	unsigned int Count;
+	unsigned int Sleeps; // times the waiter gave up the CPU
+	unsigned int Timeouts;
+	unsigned int MaxUs;
+	unsigned long long TotalUs;
+} xenon_sfc_waitstat, *pxenon_sfc_waitstat;
+
+// receives each block of a streamed read with its read status, non-zero return stops the stream
+typedef int (*xenon_sfc_sink)(unsigned char* buf, unsigned int block, int status, void* ctx);
+
 unsigned long xenon_sfc_ReadReg(unsigned int addr);
 void xenon_sfc_WriteReg(unsigned int addr, unsigned long data);
 
@@ -141,15 +282,23 @@ int xenon_sfc_ReadBlockUser(unsigned char* buf, unsigned int block);
 int xenon_sfc_ReadBlockSpare(unsigned char* buf, unsigned int block);
 int xenon_sfc_ReadSmallBlockUser(unsigned char* buf, unsigned int block);
 int xenon_sfc_ReadSmallBlockSpare(unsigned char* buf, unsigned int block);
+void xenon_sfc_SetZeroCopy(bool on); // separated reads DMA into the caller's buffer, on by default
 int xenon_sfc_WriteBlock(unsigned char* buf, unsigned int block);
+unsigned long xenon_sfc_BeginSession(bool write); // returns the CONFIG for EndSession
+void xenon_sfc_EndSession(unsigned long config);
 int xenon_sfc_ReadBlocks(unsigned char* buf, unsigned int block, unsigned int block_cnt);
 int xenon_sfc_WriteBlocks(unsigned char* buf, unsigned int block, unsigned int block_cnt);
 int xenon_sfc_ReadFullFlash(unsigned char* buf);
+int xenon_sfc_ReadFullFlashStream(xenon_sfc_sink sink, void* ctx);
 int xenon_sfc_WriteFullFlash(unsigned char* buf);
 int xenon_sfc_EraseBlock(unsigned int block);
 int xenon_sfc_EraseBlocks(unsigned int block, unsigned int block_cnt);
 
 void xenon_sfc_ReadMapData(unsigned char* buf, unsigned int startaddr, unsigned int total_len);
+unsigned char* xenon_sfc_MapData(unsigned int startaddr, unsigned int total_len);
+unsigned int xenon_sfc_GetConfigGen(void);
+void xenon_sfc_GetWaitStats(xenon_sfc_waitstat* stats); // SFC_WAIT_TYPES entries
+void xenon_sfc_ResetWaitStats(void);
 
 bool xenon_sfc_GetNandStruct(xenon_nand* xe_nand);
 
@@ -0,0 +1,944 @@
+/*
+ *  Xenon System Flash Controller register model
+ *
+ *  Copyright (C) 2014 tuxuser
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; version 2 of the License.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/*
+ * Software SFC backed by a NAND dump: CONFIG/STATUS/COMMAND/ADDRESS/DATA and the DMA
+ * address registers, the unlock sequences, the PIO page buffer and the DMA commands,
+ * with per command latencies, bad blocks and ECC errors. xenon_sfc.c is compiled in
+ * unchanged on top of xenon_sfc_model.h and driven through its normal probe:
+ *
+ *   gcc -O2 -o sfc_model xenon_sfc_model.c
+ *   ./sfc_model [options] sm|bos|bg dump.bin verify|bench|flash ...
+ */
+
+#define SFC_MODEL
+#include "xenon_sfc.c"
+
+#define MODEL_BUS_BASE			0x10000000
+#define MODEL_BUS_END			0xF0000000
+
+xenon_sfc_model model;
+
+static unsigned char* ref; // the dump as loaded, what every read is checked against
+static bool fragmented; // leave a hole after every mapping so nothing is bus contiguous
+static bool in_irq;
+
+static const char* _xenon_sfc_model_cmdnames[0x10] = {
+	"buf2reg", "reg2buf", "logread", "phyread", "program", "erase", "dmalog", "dmaread",
+	"dmawrite", "?9", "?a", "?b", "?c", "?d", "?e", "unlock"
+};
+
+ktime_t ktime_get(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((s64)ts.tv_sec * 1000000000LL) + ts.tv_nsec;
+}
+
+void* vmalloc(unsigned long size)
+{
+	return aligned_alloc(PAGE_SIZE, (size + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1));
+}
+
+/* bus side */
+
+static dma_addr_t _xenon_sfc_model_Map(unsigned char* host, unsigned int len)
+{
+	unsigned int i, span = (len + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+	pxenon_sfc_model_map free = NULL;
+
+	if(fragmented)
+		span += PAGE_SIZE;
+	// wrap behind whatever is still mapped, the coherent buffer stays put
+	if((model.NextBus + span) > MODEL_BUS_END)
+	{
+		model.NextBus = MODEL_BUS_BASE;
+		for(i = 0; i < SFC_MODEL_MAX_MAPS; i++)
+			if(model.Maps[i].Len && ((model.Maps[i].Bus + model.Maps[i].Len) > model.NextBus))
+				model.NextBus = (model.Maps[i].Bus + model.Maps[i].Len + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+	}
+	for(i = 0; i < SFC_MODEL_MAX_MAPS; i++)
+	{
+		if(!model.Maps[i].Len)
+		{
+			free = &model.Maps[i];
+			break;
+		}
+	}
+	if(!free)
+		return 0;
+	free->Bus = model.NextBus;
+	free->Host = host;
+	free->Len = len;
+	model.NextBus += span;
+	return free->Bus;
+}
+
+static void _xenon_sfc_model_Unmap(dma_addr_t bus)
+{
+	unsigned int i;
+
+	for(i = 0; i < SFC_MODEL_MAX_MAPS; i++)
+	{
+		if(model.Maps[i].Len && (model.Maps[i].Bus == bus))
+		{
+			model.Maps[i].Len = 0;
+			return;
+		}
+	}
+	printf(" ! MODEL: unmap of unknown bus address %08x\n", bus);
+}
+
+// host address of a bus range, NULL when it isn't inside one mapping
+static unsigned char* _xenon_sfc_model_Bus(dma_addr_t bus, unsigned int len)
+{
+	unsigned int i;
+
+	for(i = 0; i < SFC_MODEL_MAX_MAPS; i++)
+	{
+		if(model.Maps[i].Len && (bus >= model.Maps[i].Bus) && ((bus + len) <= (model.Maps[i].Bus + model.Maps[i].Len)))
+			return model.Maps[i].Host + (bus - model.Maps[i].Bus);
+	}
+	return NULL;
+}
+
+void* dma_alloc_coherent(struct device* dev, size_t size, dma_addr_t* handle, int gfp)
+{
+	unsigned char* buf = vmalloc(size);
+
+	if(!buf)
+		return NULL;
+	*handle = _xenon_sfc_model_Map(buf, size);
+	if(!*handle)
+	{
+		free(buf);
+		return NULL;
+	}
+	return buf;
+}
+
+void dma_free_coherent(struct device* dev, size_t size, void* cpu, dma_addr_t handle)
+{
+	_xenon_sfc_model_Unmap(handle);
+	free(cpu);
+}
+
+dma_addr_t dma_map_page(struct device* dev, struct page* page, unsigned long offset, size_t size, int dir)
+{
+	return _xenon_sfc_model_Map((unsigned char*)page + offset, size);
+}
+
+void dma_unmap_page(struct device* dev, dma_addr_t addr, size_t size, int dir)
+{
+	_xenon_sfc_model_Unmap(addr);
+}
+
+void* ioremap(u64 addr, unsigned long size)
+{
+	// the flash window shows the raw dump, as the DEBUG build of xenon_nandfs.c reads it
+	if(addr == MAP_ADDR)
+		return model.Flash;
+	return model.Regs;
+}
+
+int request_irq(unsigned int irq, irq_handler_t handler, unsigned long flags, const char* name, void* dev)
+{
+	if(!model.IrqLine)
+		return -ENODEV;
+	model.Handler = handler;
+	model.HandlerDev = dev;
+	return 0;
+}
+
+void free_irq(unsigned int irq, void* dev)
+{
+	model.Handler = NULL;
+}
+
+/* controller */
+
+static bool _xenon_sfc_model_IsBad(unsigned int page)
+{
+	unsigned int i, block = (page * 0x200) / model.BlockSz;
+
+	for(i = 0; i < model.BadBlockCount; i++)
+		if(model.BadBlocks[i] == block)
+			return true;
+	return false;
+}
+
+// ECC bits a read of page raises
+static unsigned int _xenon_sfc_model_Ecc(unsigned int page)
+{
+	unsigned int i;
+
+	for(i = 0; i < model.EccPageCount; i++)
+		if(model.EccPages[i] == page)
+			return STATUS_ECC_ERROR;
+	for(i = 0; i < model.FixedPageCount; i++)
+		if(model.FixedPages[i] == page)
+			return 0x4;
+	return 0;
+}
+
+static unsigned int _xenon_sfc_model_Pages(void)
+{
+	return model.FlashSz / 0x210;
+}
+
+// busy clears once its time is up, completion raises INT_CP and, with a handler
+// installed, takes the interrupt between two register accesses like the real line would
+static void _xenon_sfc_model_Update(void)
+{
+	if((model.Status & STATUS_BUSY) && (ktime_get() >= model.BusyUntil))
+	{
+		model.Status = (model.Status & ~STATUS_BUSY) | model.Pending;
+		model.Pending = 0;
+		if(model.Config & CONFIG_INT_EN)
+			model.Status |= STATUS_INT_CP;
+	}
+	if(!in_irq && model.Handler && (model.Status & STATUS_INT_CP) && (model.Config & CONFIG_INT_EN))
+	{
+		in_irq = true;
+		model.Stats.Irqs++;
+		model.Handler(0, model.HandlerDev);
+		in_irq = false;
+	}
+}
+
+static void _xenon_sfc_model_Busy(unsigned int us, unsigned int status)
+{
+	s64 now = ktime_get();
+
+	if(model.Status & STATUS_BUSY)
+	{
+		model.Stats.CmdWhileBusy++;
+		now = model.BusyUntil;
+	}
+	model.Status |= STATUS_BUSY;
+	model.Pending |= status;
+	model.BusyUntil = now + ((s64)us * 1000);
+}
+
+static unsigned int _xenon_sfc_model_ReadPages(unsigned int page, unsigned int count, bool dma)
+{
+	unsigned int i, ecc, status = 0;
+	unsigned char* dst;
+
+	for(i = 0; i < count; i++, page++)
+	{
+		if((page >= _xenon_sfc_model_Pages()) || (model.Address & 0x1FF))
+			return status | STATUS_ADDR_ER;
+		if(_xenon_sfc_model_IsBad(page))
+			return status | STATUS_BB_ER;
+		ecc = _xenon_sfc_model_Ecc(page);
+		if(ecc > (status & STATUS_ECC_ER))
+			status = (status & ~STATUS_ECC_ER) | ecc;
+		model.Stats.PagesRead++;
+		if(!dma)
+		{
+			memcpy(model.PageBuf, &model.Flash[page*0x210], 0x210);
+			continue;
+		}
+		dst = _xenon_sfc_model_Bus(model.DataPhy + (i*0x200), 0x200);
+		if(!dst)
+			return status | STATUS_MASTER_ABOR;
+		memcpy(dst, &model.Flash[page*0x210], 0x200);
+		dst = _xenon_sfc_model_Bus(model.SparePhy + (i*0x10), 0x10);
+		if(!dst)
+			return status | STATUS_MASTER_ABOR;
+		memcpy(dst, &model.Flash[(page*0x210)+0x200], 0x10);
+	}
+	return status;
+}
+
+// programming can only clear bits, like the array does
+static unsigned int _xenon_sfc_model_ProgramPages(unsigned int page, unsigned int count, bool dma)
+{
+	unsigned int i, j, status = 0;
+	unsigned char *user, *spare, *dst;
+
+	for(i = 0; i < count; i++, page++)
+	{
+		if((page >= _xenon_sfc_model_Pages()) || (model.Address & 0x1FF))
+			return STATUS_ADDR_ER;
+		if(_xenon_sfc_model_IsBad(page))
+			return STATUS_WR_ER;
+		user = model.PageBuf;
+		spare = &model.PageBuf[0x200];
+		if(dma)
+		{
+			user = _xenon_sfc_model_Bus(model.DataPhy + (i*0x200), 0x200);
+			spare = _xenon_sfc_model_Bus(model.SparePhy + (i*0x10), 0x10);
+			if(!user || !spare)
+				return STATUS_TARGET_ABOR;
+		}
+		dst = &model.Flash[page*0x210];
+		for(j = 0; j < 0x200; j++)
+			dst[j] &= user[j];
+		for(j = 0; j < 0x10; j++)
+			dst[0x200+j] &= spare[j];
+		model.Stats.PagesProgrammed++;
+	}
+	return status;
+}
+
+// consumes the unlock sequence, program wants 55 AA and erase AA 55, each with WP_EN set
+static bool _xenon_sfc_model_Unlocked(unsigned int seq)
+{
+	bool ok = (model.Unlock == seq) && (model.Config & CONFIG_WP_EN);
+
+	model.Unlock = 0;
+	if(!ok)
+		model.Stats.Rejected++;
+	return ok;
+}
+
+static void _xenon_sfc_model_Command(unsigned int cmd)
+{
+	unsigned int page = model.Address / 0x200, dmaPages, status;
+
+	model.Stats.Commands[(cmd == UNLOCK_CMD_0 || cmd == UNLOCK_CMD_1) ? 0xF : (cmd & 0xF)]++;
+	dmaPages = ((((model.Config & CONFIG_DMA_LEN) >> 6) + 1) * (model.isBB ? 0x800 : 0x200)) / 0x200;
+
+	switch(cmd)
+	{
+		case PAGE_BUF_TO_REG:
+		case REG_TO_PAGE_BUF:
+			if(model.BufPtr >= sizeof(model.PageBuf))
+			{
+				model.Status |= STATUS_ADDR_ER;
+				break;
+			}
+			if(cmd == PAGE_BUF_TO_REG)
+				model.Data = (model.PageBuf[model.BufPtr] << 24) | (model.PageBuf[model.BufPtr+1] << 16) | (model.PageBuf[model.BufPtr+2] << 8) | model.PageBuf[model.BufPtr+3];
+			else
+			{
+				model.PageBuf[model.BufPtr] = model.Data >> 24;
+				model.PageBuf[model.BufPtr+1] = model.Data >> 16;
+				model.PageBuf[model.BufPtr+2] = model.Data >> 8;
+				model.PageBuf[model.BufPtr+3] = model.Data;
+			}
+			model.BufPtr += 4;
+			break;
+		case UNLOCK_CMD_0:
+		case UNLOCK_CMD_1:
+			model.Unlock = ((model.Unlock << 8) | cmd) & 0xFFFF;
+			break;
+		case LOG_PAGE_TO_BUF: // no remapping in the model, logical is physical
+		case PHY_PAGE_TO_BUF:
+			model.Unlock = 0;
+			_xenon_sfc_model_Busy(model.Lat[SFC_MODEL_LAT_READ], _xenon_sfc_model_ReadPages(page, 1, false));
+			break;
+		case WRITE_PAGE_TO_PHY:
+			status = _xenon_sfc_model_Unlocked((UNLOCK_CMD_0 << 8) | UNLOCK_CMD_1) ? _xenon_sfc_model_ProgramPages(page, 1, false) : STATUS_WR_ER;
+			_xenon_sfc_model_Busy(model.Lat[SFC_MODEL_LAT_PROGRAM], status);
+			break;
+		case BLOCK_ERASE:
+			status = 0;
+			if(!_xenon_sfc_model_Unlocked((UNLOCK_CMD_1 << 8) | UNLOCK_CMD_0))
+				status = STATUS_WR_ER;
+			else if((model.Address % model.BlockSz) || (page >= _xenon_sfc_model_Pages()))
+				status = STATUS_ADDR_ER;
+			else if(_xenon_sfc_model_IsBad(page))
+				status = STATUS_WR_ER;
+			else
+			{
+				memset(&model.Flash[page*0x210], 0xFF, (model.BlockSz / 0x200) * 0x210);
+				model.Stats.BlocksErased++;
+			}
+			_xenon_sfc_model_Busy(model.Lat[SFC_MODEL_LAT_ERASE], status);
+			break;
+		case DMA_LOG_TO_RAM:
+		case DMA_PHY_TO_RAM:
+			model.Unlock = 0;
+			_xenon_sfc_model_Busy(model.Lat[SFC_MODEL_LAT_DMA] + (dmaPages * model.Lat[SFC_MODEL_LAT_READ]), _xenon_sfc_model_ReadPages(page, dmaPages, true));
+			break;
+		case DMA_RAM_TO_PHY:
+			status = _xenon_sfc_model_Unlocked((UNLOCK_CMD_0 << 8) | UNLOCK_CMD_1) ? _xenon_sfc_model_ProgramPages(page, dmaPages, true) : STATUS_WR_ER;
+			_xenon_sfc_model_Busy(model.Lat[SFC_MODEL_LAT_DMA] + (dmaPages * model.Lat[SFC_MODEL_LAT_PROGRAM]), status);
+			break;
+		default:
+			printf(" ! MODEL: unknown command %02x\n", cmd);
+			model.Status |= STATUS_ILL_LOG;
+	}
+}
+
+// registers hold the value the driver sees after its byte swap
+unsigned int readl(const volatile void* addr)
+{
+	unsigned int reg = (const volatile unsigned char*)addr - model.Regs, val = 0;
+
+	model.Stats.RegReads++;
+	_xenon_sfc_model_Update();
+	switch(reg)
+	{
+		case SFCX_CONFIG: val = model.Config; break;
+		case SFCX_STATUS:
+			val = model.Status;
+			if(val & STATUS_BUSY)
+				model.Stats.StatusPolls++;
+			break;
+		case SFCX_ADDRESS: val = model.Address; break;
+		case SFCX_DATA: val = model.Data; break;
+		case SFCX_DATAPHYADDR: val = model.DataPhy; break;
+		case SFCX_SPAREPHYADDR: val = model.SparePhy; break;
+	}
+	return __builtin_bswap32(val);
+}
+
+void writel(unsigned int value, volatile void* addr)
+{
+	unsigned int reg = (volatile unsigned char*)addr - model.Regs;
+
+	value = __builtin_bswap32(value);
+	model.Stats.RegWrites++;
+	_xenon_sfc_model_Update();
+	switch(reg)
+	{
+		case SFCX_CONFIG: model.Config = value & ~CONFIG_SW_RST; break;
+		case SFCX_STATUS: model.Status &= ~(value & ~STATUS_BUSY); break; // write one to clear
+		case SFCX_COMMAND: _xenon_sfc_model_Command(value); break;
+		case SFCX_ADDRESS:
+			model.Address = value;
+			model.BufPtr = value & ~3;
+			break;
+		case SFCX_DATA: model.Data = value; break;
+		case SFCX_DATAPHYADDR: model.DataPhy = value; break;
+		case SFCX_SPAREPHYADDR: model.SparePhy = value; break;
+		default:
+			printf(" ! MODEL: write of %08x to read only register %02x\n", value, reg);
+	}
+}
+
+// sleeps the waiter until the running command is done, returns the jiffies left
+long xenon_sfc_model_Idle(long us)
+{
+	s64 start = ktime_get(), left;
+	struct timespec ts;
+
+	_xenon_sfc_model_Update();
+	if(!(model.Status & STATUS_BUSY))
+		return 0; // nothing will ever raise the interrupt
+	left = model.BusyUntil - start;
+	if(left > ((s64)us * 1000))
+		left = (s64)us * 1000;
+	if(left > 0)
+	{
+		ts.tv_sec = left / 1000000000LL;
+		ts.tv_nsec = left % 1000000000LL;
+		nanosleep(&ts, NULL);
+	}
+	_xenon_sfc_model_Update();
+	return us - ((ktime_get() - start) / 1000) - 1;
+}
+
+static bool _xenon_sfc_model_Load(unsigned char type, const char* name)
+{
+	FILE* f = fopen(name, "rb");
+	long size;
+	unsigned int bits;
+
+	if(!f)
+	{
+		printf("Failed opening \'%s\'!!!\n", name);
+		return false;
+	}
+	fseek(f, 0, SEEK_END);
+	size = ftell(f);
+	fseek(f, 0, SEEK_SET);
+
+	model.isBB = (type == META_TYPE_BG);
+	model.BlockSz = model.isBB ? 0x20000 : 0x4000;
+	if((size <= 0) || (size % ((model.BlockSz / 0x200) * 0x210)))
+	{
+		printf("%s isn't a whole number of 0x%x byte blocks\n", name, (model.BlockSz / 0x200) * 0x210);
+		fclose(f);
+		return false;
+	}
+	model.FlashSz = size;
+	// the flash window is ioremapped at full size, keep it backed
+	model.Flash = malloc((size > MAP_SIZE) ? size : MAP_SIZE);
+	ref = malloc(size);
+	if(!model.Flash || !ref || (fread(model.Flash, 1, size, f) != size))
+	{
+		printf("Failed reading \'%s\'\n", name);
+		fclose(f);
+		return false;
+	}
+	fclose(f);
+	if(size < MAP_SIZE)
+		memset(&model.Flash[size], 0xFF, MAP_SIZE - size);
+	memcpy(ref, model.Flash, size);
+
+	// CONFIG as the controller reports it for this part
+	switch(type)
+	{
+		case META_TYPE_SM:
+			if(size == 0x1080000)
+				model.Config = 1 << 4;
+			else if(size == 0x4200000)
+				model.Config = 3 << 4;
+			else
+			{
+				printf("small block dumps are 16 or 64MB\n");
+				return false;
+			}
+			break;
+		case META_TYPE_BOS:
+			if(size != 0x1080000)
+			{
+				printf("big on small dumps are 16MB\n");
+				return false;
+			}
+			model.Config = (1 << 17) | (1 << 4);
+			break;
+		case META_TYPE_BG:
+			for(bits = 0; (0x800000U << bits) < ((size / 0x210) * 0x200); bits++)
+				;
+			if((0x800000U << bits) != ((size / 0x210) * 0x200))
+			{
+				printf("big block dumps are a power of two of data\n");
+				return false;
+			}
+			model.Config = (1 << 17) | (2 << 4) | (bits << 21);
+			break;
+	}
+	model.NextBus = MODEL_BUS_BASE;
+	return true;
+}
+
+static bool _xenon_sfc_model_Save(const char* name)
+{
+	FILE* f = fopen(name, "wb");
+	bool ok;
+
+	if(!f)
+	{
+		printf("Failed opening \'%s\'!!!\n", name);
+		return false;
+	}
+	ok = fwrite(model.Flash, 1, model.FlashSz, f) == model.FlashSz;
+	fclose(f);
+	return ok;
+}
+
+/* harness */
+
+static struct pci_dev pdev;
+
+static unsigned int _xenon_sfc_model_Blocks(void)
+{
+	// every block of the chip, what ReadFullFlash and WriteFullFlash cover
+	return sfc.nand.BlocksCount;
+}
+
+// what a read of blockSz user bytes at addr has to return, see _xenon_sfc_ReadBlockDMA
+static int _xenon_sfc_model_Expect(unsigned int addr, unsigned int blockSz)
+{
+	unsigned int page;
+	int ret = 0;
+
+	for(page = addr / 0x200; page < ((addr + blockSz) / 0x200); page++)
+	{
+		if(_xenon_sfc_model_IsBad(page))
+			return 1;
+		if(!ret && (_xenon_sfc_model_Ecc(page) == STATUS_ECC_ERROR))
+			ret = 2;
+	}
+	return ret;
+}
+
+// compares an interleaved or separated read against the dump, returns the number of bad blocks
+static unsigned int _xenon_sfc_model_Check(const char* what, unsigned int block, int ret, unsigned int blockSz, unsigned char* data, unsigned char* user, unsigned char* spare)
+{
+	unsigned int i, page = (block * blockSz) / 0x200, expect = _xenon_sfc_model_Expect(block * blockSz, blockSz);
+
+	if(ret != expect)
+	{
+		printf("%s block 0x%x: returned %d, expected %d\n", what, block, ret, expect);
+		return 1;
+	}
+	if(ret)
+		return 0;
+	for(i = 0; i < (blockSz / 0x200); i++, page++)
+	{
+		if(data && memcmp(&data[i*0x210], &ref[page*0x210], 0x210))
+			break;
+		if(user && memcmp(&user[i*0x200], &ref[page*0x210], 0x200))
+			break;
+		if(spare && memcmp(&spare[i*0x10], &ref[(page*0x210)+0x200], 0x10))
+			break;
+	}
+	if(i == (blockSz / 0x200))
+		return 0;
+	printf("%s block 0x%x: page 0x%x differs from the dump\n", what, block, page);
+	return 1;
+}
+
+static int cmdVerify(void)
+{
+	unsigned int i, k, blocks = _xenon_sfc_model_Blocks(), bad = 0, pages = sfc.nand.PagesInBlock, spurious;
+	unsigned char* data = vmalloc(sfc.nand.BlockSzPhys);
+	unsigned char* user = vmalloc(sfc.nand.BlockSz);
+	unsigned char* spare = vmalloc(sfc.nand.BlockSz / 0x20);
+	unsigned long config;
+	int ret, status;
+
+	config = xenon_sfc_BeginSession(false);
+	for(i = 0; i < blocks; i++)
+		bad += _xenon_sfc_model_Check("ReadBlock", i, xenon_sfc_ReadBlock(data, i), sfc.nand.BlockSz, data, NULL, NULL);
+	xenon_sfc_EndSession(config);
+	printf("ReadBlock: %u blocks\n", blocks);
+
+	// outside any session, with a DMA length left behind that doesn't match the chunk
+	_xenon_sfc_WriteConfig(sfc.Config & ~CONFIG_DMA_LEN);
+	config = sfc.Config;
+	for(i = 0; i < blocks; i++)
+		bad += _xenon_sfc_model_Check("ReadBlock (no session)", i, xenon_sfc_ReadBlock(data, i), sfc.nand.BlockSz, data, NULL, NULL);
+	if(sfc.nand.isBB)
+		for(i = 0; i < ((blocks * sfc.nand.BlockSz) / 0x4000); i++)
+			bad += _xenon_sfc_model_Check("ReadSmallBlock (no session)", i, xenon_sfc_ReadSmallBlock(data, i), 0x4000, data, NULL, NULL);
+	if(sfc.Config != config)
+	{
+		printf("CONFIG %08lx after reads outside a session, was %08lx\n", sfc.Config, config);
+		bad++;
+	}
+	printf("ReadBlock/ReadSmallBlock outside a session\n");
+
+	for(k = 0; k < 2; k++)
+	{
+		xenon_sfc_SetZeroCopy(!k);
+		for(i = 0; i < blocks; i++)
+			bad += _xenon_sfc_model_Check(k ? "ReadBlockSeparate (bounce)" : "ReadBlockSeparate (zero copy)", i, xenon_sfc_ReadBlockSeparate(user, spare, i), sfc.nand.BlockSz, NULL, user, spare);
+		// the spare alone goes through the pool
+		for(i = 0; i < blocks; i++)
+		{
+			ret = _xenon_sfc_model_Expect(i * sfc.nand.BlockSz, sfc.nand.BlockSz);
+			xenon_sfc_ReadBlockSpare(spare, i);
+			if(!ret)
+				bad += _xenon_sfc_model_Check("ReadBlockSpare", i, 0, sfc.nand.BlockSz, NULL, NULL, spare);
+		}
+	}
+	xenon_sfc_SetZeroCopy(true);
+	printf("ReadBlockSeparate: %u blocks, zero copy and bounced\n", blocks);
+
+	if(sfc.nand.isBB)
+	{
+		config = xenon_sfc_BeginSession(false);
+		for(i = 0; i < ((blocks * sfc.nand.BlockSz) / 0x4000); i++)
+			bad += _xenon_sfc_model_Check("ReadSmallBlock", i, xenon_sfc_ReadSmallBlock(data, i), 0x4000, data, NULL, NULL);
+		xenon_sfc_EndSession(config);
+		printf("ReadSmallBlock: %u blocks\n", (blocks * sfc.nand.BlockSz) / 0x4000);
+	}
+
+	// PIO, first page of every block; polled, so it takes no interrupts
+	spurious = sfc.cmpl.Spurious;
+	for(i = 0; i < blocks; i++)
+	{
+		status = xenon_sfc_ReadPagePhy(data, i * pages);
+		ret = (status & STATUS_BB_ER) ? 1 : STSCHK_ECC_ERR(status) ? 2 : 0;
+		if(ret != _xenon_sfc_model_Expect(i * sfc.nand.BlockSz, 0x200))
+		{
+			printf("ReadPagePhy page 0x%x: status %08x\n", i * pages, status);
+			bad++;
+		}
+		else if(!ret && memcmp(data, &ref[i*pages*0x210], 0x210))
+		{
+			printf("ReadPagePhy page 0x%x differs from the dump\n", i * pages);
+			bad++;
+		}
+	}
+	if(sfc.cmpl.Spurious != spurious)
+	{
+		printf("ReadPagePhy raised %u interrupts\n", sfc.cmpl.Spurious - spurious);
+		bad++;
+	}
+	printf("ReadPagePhy: %u pages\n", blocks);
+
+	vfree(data);
+	vfree(user);
+	vfree(spare);
+	printf("%s, %u mismatches\n", bad ? "FAILED" : "OK", bad);
+	return bad ? 1 : 0;
+}
+
+// writes image through WriteFullFlash and checks the flash holds it afterwards
+static int cmdFlash(const char* name)
+{
+	FILE* f = fopen(name, "rb");
+	unsigned char* image;
+	unsigned int i, blocks = _xenon_sfc_model_Blocks(), bad = 0;
+
+	if(!f)
+	{
+		printf("Failed opening \'%s\'!!!\n", name);
+		return 4;
+	}
+	image = vmalloc(blocks * sfc.nand.BlockSzPhys);
+	if(fread(image, 1, blocks * sfc.nand.BlockSzPhys, f) != (blocks * sfc.nand.BlockSzPhys))
+	{
+		printf("%s is shorter than 0x%x\n", name, blocks * sfc.nand.BlockSzPhys);
+		fclose(f);
+		vfree(image);
+		return 4;
+	}
+	fclose(f);
+
+	xenon_sfc_WriteFullFlash(image);
+	for(i = 0; i < blocks; i++)
+	{
+		// bad blocks are left alone
+		if(_xenon_sfc_model_Expect(i * sfc.nand.BlockSz, sfc.nand.BlockSz))
+			continue;
+		if(memcmp(&model.Flash[i*sfc.nand.BlockSzPhys], &image[i*sfc.nand.BlockSzPhys], sfc.nand.BlockSzPhys))
+		{
+			printf("block 0x%x wasn't written\n", i);
+			bad++;
+		}
+	}
+	printf("%s: %u programmed pages, %u erased blocks, %u blocks wrong\n", bad ? "FAILED" : "OK",
+		(unsigned int)model.Stats.PagesProgrammed, model.Stats.BlocksErased, bad);
+	vfree(image);
+	return bad ? 1 : 0;
+}
+
+static s64 bench_start;
+
+static void _xenon_sfc_model_BenchStart(void)
+{
+	memset(&model.Stats, 0, sizeof(model.Stats));
+	xenon_sfc_ResetWaitStats();
+	bench_start = ktime_get();
+}
+
+static void _xenon_sfc_model_BenchEnd(const char* what, unsigned long long bytes)
+{
+	s64 us = ktime_us_delta(ktime_get(), bench_start);
+	unsigned int i, cmds = 0;
+
+	for(i = 0; i < 0x10; i++)
+		cmds += model.Stats.Commands[i];
+	printf("%-18s %9llu KB %9lldus %8.1f MB/s  cmds %7u  mmio %9llu/%-9llu busy polls %9llu  irqs %6u\n",
+		what, bytes / 1024, us, us ? ((double)bytes / us) : 0.0, cmds,
+		model.Stats.RegReads, model.Stats.RegWrites, model.Stats.StatusPolls, model.Stats.Irqs);
+	if(model.Stats.CmdWhileBusy || model.Stats.Rejected)
+		printf("%-18s ! %u commands issued while busy, %u rejected for a missing unlock\n", "", model.Stats.CmdWhileBusy, model.Stats.Rejected);
+}
+
+static int cmdBench(int argc, char* argv[])
+{
+	static const char* waitnames[SFC_WAIT_TYPES] = { "read", "program", "erase", "dma read", "dma write", "misc" };
+	unsigned int i, k, blocks = _xenon_sfc_model_Blocks(), wblocks;
+	unsigned int size = blocks * sfc.nand.BlockSzPhys;
+	unsigned char* image = vmalloc(size);
+	unsigned char* user = vmalloc(sfc.nand.BlockSz);
+	unsigned char* spare = vmalloc(sfc.nand.BlockSz / 0x20);
+	unsigned char* data = vmalloc(sfc.nand.BlockSzPhys);
+	xenon_sfc_waitstat ws[SFC_WAIT_TYPES];
+	unsigned long config;
+	int ret = 0;
+
+	// programs take long, they only run over the first blocks unless told otherwise
+	wblocks = (argc > 0) ? strtoul(argv[0], NULL, 0) : 32;
+	if(!wblocks || (wblocks > blocks))
+		wblocks = blocks;
+
+	printf("latencies: read %uus, program %uus, erase %uus, dma setup %uus; %s; dma chunk 0x%x\n",
+		model.Lat[SFC_MODEL_LAT_READ], model.Lat[SFC_MODEL_LAT_PROGRAM], model.Lat[SFC_MODEL_LAT_ERASE], model.Lat[SFC_MODEL_LAT_DMA],
+		(sfc.irq >= 0) ? "interrupt driven" : "polled", sfc.DmaChunk);
+
+	_xenon_sfc_model_BenchStart();
+	xenon_sfc_ReadFullFlash(image);
+	_xenon_sfc_model_BenchEnd("ReadFullFlash", (unsigned long long)blocks * sfc.nand.BlockSz);
+
+	for(k = 0; k < 2; k++)
+	{
+		xenon_sfc_SetZeroCopy(!k);
+		_xenon_sfc_model_BenchStart();
+		for(i = 0; i < blocks; i++)
+			xenon_sfc_ReadBlockSeparate(user, spare, i);
+		_xenon_sfc_model_BenchEnd(k ? "Separate bounced" : "Separate zero copy", (unsigned long long)blocks * sfc.nand.BlockSz);
+	}
+	xenon_sfc_SetZeroCopy(true);
+
+	_xenon_sfc_model_BenchStart();
+	for(i = 0; i < sfc.nand.PagesInBlock; i++)
+		xenon_sfc_ReadPagePhy(data, i);
+	_xenon_sfc_model_BenchEnd("ReadPagePhy", sfc.nand.BlockSz);
+
+	// unchanged data is only read back and compared
+	memcpy(image, ref, size);
+	_xenon_sfc_model_BenchStart();
+	xenon_sfc_WriteBlocks(image, 0, wblocks);
+	_xenon_sfc_model_BenchEnd("WriteBlocks same", (unsigned long long)wblocks * sfc.nand.BlockSz);
+
+	for(i = 0; i < wblocks; i++)
+		image[(i*sfc.nand.BlockSzPhys)+1] ^= 0x5A;
+	_xenon_sfc_model_BenchStart();
+	xenon_sfc_WriteBlocks(image, 0, wblocks);
+	_xenon_sfc_model_BenchEnd("WriteBlocks", (unsigned long long)wblocks * sfc.nand.BlockSz);
+
+	_xenon_sfc_model_BenchStart();
+	xenon_sfc_EraseBlocks(0, wblocks);
+	_xenon_sfc_model_BenchEnd("EraseBlocks", (unsigned long long)wblocks * sfc.nand.BlockSz);
+
+	// and back to the dump, which has to come out intact
+	xenon_sfc_WriteBlocks(ref, 0, wblocks);
+	for(i = 0; i < wblocks; i++)
+	{
+		if(!_xenon_sfc_model_Expect(i * sfc.nand.BlockSz, sfc.nand.BlockSz) && memcmp(&model.Flash[i*sfc.nand.BlockSzPhys], &ref[i*sfc.nand.BlockSzPhys], sfc.nand.BlockSzPhys))
+		{
+			printf("block 0x%x didn't survive the write/erase/restore cycle\n", i);
+			ret = 1;
+		}
+	}
+
+	// wait behaviour of the whole run above
+	_xenon_sfc_model_BenchStart();
+	config = xenon_sfc_BeginSession(false);
+	for(i = 0; i < blocks; i++)
+		xenon_sfc_ReadBlock(NULL, i);
+	xenon_sfc_EndSession(config);
+	xenon_sfc_GetWaitStats(ws);
+	printf("\nwaits of a full read:\n");
+	for(i = 0; i < SFC_WAIT_TYPES; i++)
+	{
+		if(!ws[i].Count)
+			continue;
+		printf("%-10s %8u waits %8u sleeps %4u timeouts  avg %6lluus  max %6uus\n", waitnames[i],
+			ws[i].Count, ws[i].Sleeps, ws[i].Timeouts, ws[i].TotalUs / ws[i].Count, ws[i].MaxUs);
+	}
+	printf("\ncommands:");
+	for(i = 0; i < 0x10; i++)
+		if(model.Stats.Commands[i])
+			printf(" %s %u", _xenon_sfc_model_cmdnames[i], model.Stats.Commands[i]);
+	printf("\npool misses %u, lost interrupts %u, spurious interrupts %u\n", sfc.PoolMisses, sfc.IrqTimeouts, sfc.cmpl.Spurious);
+
+	vfree(image);
+	vfree(user);
+	vfree(spare);
+	vfree(data);
+	return ret;
+}
+
+static bool _xenon_sfc_model_AddFault(unsigned int* list, unsigned int* count, const char* arg)
+{
+	if(*count >= SFC_MODEL_MAX_FAULTS)
+		return false;
+	list[(*count)++] = strtoul(arg, NULL, 0);
+	return true;
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned char type;
+	const char* out = NULL;
+	int opt, ret = 0;
+
+	model.Lat[SFC_MODEL_LAT_READ] = 25;
+	model.Lat[SFC_MODEL_LAT_PROGRAM] = 200;
+	model.Lat[SFC_MODEL_LAT_ERASE] = 2000;
+	model.Lat[SFC_MODEL_LAT_DMA] = 10;
+
+	while((opt = getopt(argc, argv, "r:p:e:d:zib:u:c:fo:")) != -1)
+	{
+		switch(opt)
+		{
+			case 'r': model.Lat[SFC_MODEL_LAT_READ] = strtoul(optarg, NULL, 0); break;
+			case 'p': model.Lat[SFC_MODEL_LAT_PROGRAM] = strtoul(optarg, NULL, 0); break;
+			case 'e': model.Lat[SFC_MODEL_LAT_ERASE] = strtoul(optarg, NULL, 0); break;
+			case 'd': model.Lat[SFC_MODEL_LAT_DMA] = strtoul(optarg, NULL, 0); break;
+			case 'z': memset(model.Lat, 0, sizeof(model.Lat)); break;
+			case 'i': model.IrqLine = true; break;
+			case 'b': opt = _xenon_sfc_model_AddFault(model.BadBlocks, &model.BadBlockCount, optarg); break;
+			case 'u': opt = _xenon_sfc_model_AddFault(model.EccPages, &model.EccPageCount, optarg); break;
+			case 'c': opt = _xenon_sfc_model_AddFault(model.FixedPages, &model.FixedPageCount, optarg); break;
+			case 'f': fragmented = true; break;
+			case 'o': out = optarg; break;
+			default: opt = 0;
+		}
+		if(!opt)
+		{
+			argc = 0;
+			break;
+		}
+	}
+	argc -= optind;
+	argv += optind;
+
+	if(argc < 3)
+	{
+		printf("Usage: sfc_model [options] nandtype dump_filename.bin command\n");
+		printf("Valid nandtypes: sm, bos, bg (the driver has no MMC path)\n");
+		printf("\nOptions:\n\n");
+		printf("-r us / -p us / -e us - page read, page program and block erase latency (25/200/2000)\n");
+		printf("-d us - fixed setup cost of every DMA command (10)\n");
+		printf("-z - no latencies at all\n");
+		printf("-i - give the driver an interrupt line\n");
+		printf("-b block - bad erase block, may repeat\n");
+		printf("-u page / -c page - page with an unrecoverable / corrected ECC error, may repeat\n");
+		printf("-f - no two DMA mappings are bus contiguous\n");
+		printf("-o out.bin - save the flash contents at exit\n");
+		printf("\nCommands:\n\n");
+		printf("verify - check every driver read path against the dump\n");
+		printf("bench [blocks] - time the read, write and erase paths, writes cover blocks (32)\n");
+		printf("flash image.bin - WriteFullFlash an image and check the flash holds it\n");
+		return 1;
+	}
+
+	if(!strcmp(argv[0],"sm"))
+		type = META_TYPE_SM;
+	else if(!strcmp(argv[0],"bos"))
+		type = META_TYPE_BOS;
+	else if(!strcmp(argv[0],"bg"))
+		type = META_TYPE_BG;
+	else
+	{
+		printf("Unsupported meta-type: %s\n", argv[0]);
+		return 2;
+	}
+	if(!_xenon_sfc_model_Load(type, argv[1]))
+		return 4;
+
+	if(xenon_sfc_pci_driver.probe(&pdev, &_xenon_sfc_pci_tbl[0]))
+	{
+		printf("probe failed\n");
+		return 5;
+	}
+	printf("\n");
+
+	if(!strcmp(argv[2],"verify"))
+		ret = cmdVerify();
+	else if(!strcmp(argv[2],"bench"))
+		ret = cmdBench(argc-3, &argv[3]);
+	else if(!strcmp(argv[2],"flash") && (argc > 3))
+		ret = cmdFlash(argv[3]);
+	else
+	{
+		printf("Unknown command: %s\n", argv[2]);
+		ret = 1;
+	}
+
+	xenon_sfc_pci_driver.remove(&pdev);
+	if(out && !_xenon_sfc_model_Save(out))
+		ret = 4;
+	return ret;
+}
@@ -0,0 +1,184 @@
+#ifndef _XENON_SFC_MODEL_H
+#define _XENON_SFC_MODEL_H
+
+// userspace stand-ins for the kernel interfaces xenon_sfc.c uses, built with SFC_MODEL every
+// register access and DMA of the driver lands in the software controller of xenon_sfc_model.c
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+
+typedef unsigned long long u64;
+typedef long long s64;
+typedef uint32_t u32;
+typedef u32 dma_addr_t; // bus addresses handed out by the model, they fit the 32 bit registers
+typedef s64 ktime_t;
+
+#define __iomem
+#define __init
+#define __exit
+#define KERN_INFO ""
+#define printk printf
+#define dev_printk(level, dev, fmt, ...) printf(fmt, ##__VA_ARGS__)
+
+#define module_init(fn) static int (*_xenon_sfc_model_init)(void) __attribute__((unused)) = fn;
+#define module_exit(fn) static void (*_xenon_sfc_model_exit)(void) __attribute__((unused)) = fn;
+#define MODULE_DESCRIPTION(s)
+#define MODULE_LICENSE(s)
+#define MODULE_VERSION(s)
+#define MODULE_DEVICE_TABLE(type, tbl)
+
+// the model is single threaded, interrupts are delivered from inside the waits
+typedef struct { int unused; } spinlock_t;
+typedef struct { int unused; } wait_queue_head_t;
+#define spin_lock_init(l) ((void)(l))
+#define spin_lock(l) ((void)(l))
+#define spin_unlock(l) ((void)(l))
+#define spin_lock_irqsave(l, flags) do { (void)(l); (flags) = 0; } while(0)
+#define spin_unlock_irqrestore(l, flags) do { (void)(l); (void)(flags); } while(0)
+#define init_waitqueue_head(q) ((void)(q))
+#define wake_up(q) ((void)(q))
+
+// jiffies are microseconds here
+#define msecs_to_jiffies(ms) ((long)(ms) * 1000)
+#define usecs_to_jiffies(us) ((long)(us))
+long xenon_sfc_model_Idle(long us);
+#define wait_event_timeout(wq, condition, timeout) \
+	({ long __left = (timeout); \
+	   while(!(condition) && (__left > 0)) \
+		__left = xenon_sfc_model_Idle(__left); \
+	   (condition) ? ((__left > 0) ? __left : 1) : 0; })
+
+typedef int irqreturn_t;
+#define IRQ_NONE 0
+#define IRQ_HANDLED 1
+#define IRQF_SHARED 0x80
+typedef irqreturn_t (*irq_handler_t)(int, void*);
+int request_irq(unsigned int irq, irq_handler_t handler, unsigned long flags, const char* name, void* dev);
+void free_irq(unsigned int irq, void* dev);
+
+ktime_t ktime_get(void);
+#define ktime_us_delta(a, b) (((a) - (b)) / 1000)
+#define usleep_range(min, max) usleep(min)
+#define cpu_relax() do { } while(0)
+
+#define PAGE_SIZE 4096UL
+struct page; // a struct page* is the address of the page itself
+#define offset_in_page(p) ((unsigned long)(p) & (PAGE_SIZE-1))
+#define vmalloc_to_page(p) ((struct page*)((uintptr_t)(p) & ~(PAGE_SIZE-1)))
+#define virt_to_page(p) vmalloc_to_page(p)
+#define is_vmalloc_addr(p) 1
+void* vmalloc(unsigned long size);
+#define vfree(p) free(p)
+
+#define GFP_KERNEL 0
+#define DMA_TO_DEVICE 1
+#define DMA_FROM_DEVICE 2
+struct device { int unused; };
+void* dma_alloc_coherent(struct device* dev, size_t size, dma_addr_t* handle, int gfp);
+void dma_free_coherent(struct device* dev, size_t size, void* cpu, dma_addr_t handle);
+dma_addr_t dma_map_page(struct device* dev, struct page* page, unsigned long offset, size_t size, int dir);
+void dma_unmap_page(struct device* dev, dma_addr_t addr, size_t size, int dir);
+#define dma_mapping_error(dev, addr) ((addr) == 0)
+
+struct pci_dev { struct device dev; unsigned int irq; };
+struct pci_device_id { unsigned int vendor, device; unsigned long driver_data; };
+#define PCI_VDEVICE(vendor, dev) 0x1414, (dev)
+struct pci_driver {
+	const char* name;
+	const struct pci_device_id* id_table;
+	int (*probe)(struct pci_dev*, const struct pci_device_id*);
+	void (*remove)(struct pci_dev*);
+};
+#define pci_enable_device(pdev) 0
+#define pci_request_regions(pdev, name) 0
+#define pci_intx(pdev, on) ((void)(pdev))
+#define pci_resource_start(pdev, bar) 0ULL
+#define pci_release_regions(pdev) ((void)(pdev))
+#define pci_disable_device(pdev) ((void)(pdev))
+#define pci_register_driver(drv) 0
+#define pci_unregister_driver(drv) ((void)(drv))
+void* ioremap(u64 addr, unsigned long size);
+#define iounmap(p) ((void)(p))
+
+unsigned int readl(const volatile void* addr);
+void writel(unsigned int value, volatile void* addr);
+
+// per command latencies of the model in microseconds
+#define SFC_MODEL_LAT_READ		0	// array to page buffer, per page
+#define SFC_MODEL_LAT_PROGRAM	1	// page buffer to array, per page
+#define SFC_MODEL_LAT_ERASE		2
+#define SFC_MODEL_LAT_DMA		3	// fixed setup cost of every DMA command
+#define SFC_MODEL_LATS			4
+
+#define SFC_MODEL_MAX_MAPS		256
+#define SFC_MODEL_MAX_FAULTS	64
+
+typedef struct _xenon_sfc_model_map
+{
+	dma_addr_t Bus;
+	unsigned char* Host;
+	unsigned int Len;
+} xenon_sfc_model_map, *pxenon_sfc_model_map;
+
+typedef struct _xenon_sfc_model_stats
+{
+	unsigned long long RegReads;
+	unsigned long long RegWrites;
+	unsigned long long StatusPolls; // STATUS reads that found the controller busy
+	unsigned int Commands[0x10]; // by command register value
+	unsigned int CmdWhileBusy; // commands issued before the previous one finished
+	unsigned int Rejected; // programs and erases without the unlock sequence or WP_EN
+	unsigned int Irqs;
+	unsigned long long PagesRead;
+	unsigned long long PagesProgrammed;
+	unsigned int BlocksErased;
+} xenon_sfc_model_stats, *pxenon_sfc_model_stats;
+
+typedef struct _xenon_sfc_model
+{
+	unsigned char* Flash; // the dump, pages of 0x200 user bytes followed by 0x10 spare
+	unsigned int FlashSz;
+	bool isBB;
+	unsigned int BlockSz; // user bytes per erase block
+
+	unsigned int Config;
+	unsigned int Status;
+	unsigned int Address;
+	unsigned int Data;
+	unsigned int DataPhy;
+	unsigned int SparePhy;
+	unsigned char PageBuf[0x210];
+	unsigned int BufPtr;
+	unsigned int Unlock; // unlock commands seen since the last real command
+
+	s64 BusyUntil; // ns, STATUS_BUSY until then
+	unsigned int Pending; // status bits raised once the command completes
+
+	unsigned int Lat[SFC_MODEL_LATS];
+	unsigned int BadBlocks[SFC_MODEL_MAX_FAULTS];
+	unsigned int BadBlockCount;
+	unsigned int EccPages[SFC_MODEL_MAX_FAULTS]; // unrecoverable
+	unsigned int EccPageCount;
+	unsigned int FixedPages[SFC_MODEL_MAX_FAULTS]; // corrected
+	unsigned int FixedPageCount;
+
+	bool IrqLine; // request_irq succeeds
+	irq_handler_t Handler;
+	void* HandlerDev;
+
+	xenon_sfc_model_map Maps[SFC_MODEL_MAX_MAPS];
+	dma_addr_t NextBus;
+	unsigned char Regs[0x400]; // only its address matters, ioremap of the registers returns it
+
+	xenon_sfc_model_stats Stats;
+} xenon_sfc_model, *pxenon_sfc_model;
+
+extern xenon_sfc_model model;
+
+#endif